@@ -0,0 +1,54 @@
+// Copyright (c) 2017-2018 The Popchain Core Developers
+
+#include "bench.h"
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "main.h"
+#include "miner.h"
+#include "random.h"
+#include "txmempool.h"
+#include "utiltime.h"
+
+#include <memory>
+
+// A synthetic pool the size of a busy mempool: chains of 1 to 25
+// transactions with random fees, so most packages have ancestors and the
+// modified-entry bookkeeping gets exercised.
+static void FillPool(CTxMemPool& pool, unsigned int nTransactions)
+{
+    seed_insecure_rand(true);
+    LOCK(pool.cs);
+    unsigned int nRoot = 0;
+    while (pool.size() < nTransactions) {
+        unsigned int nChain = 1 + insecure_rand() % 25;
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(ArithToUint256(arith_uint256(++nRoot)), 0);
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1;
+        tx.vout[0].nValue = 10 * COIN;
+        for (unsigned int i = 0; i < nChain && pool.size() < nTransactions; i++) {
+            CAmount nFee = 1000 + insecure_rand() % 100000;
+            LockPoints lp;
+            pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, GetTime(), 0.0, 1, i == 0, 0, false, 1, lp));
+            tx.vin[0].prevout = COutPoint(tx.GetHash(), 0);
+            tx.vout[0].nValue -= nFee;
+        }
+    }
+}
+
+// Template selection over a 300k transaction pool
+static void AssembleBlock(benchmark::State& state)
+{
+    CTxMemPool pool(CFeeRate(0));
+    FillPool(pool, 300000);
+    const CChainParams& chainparams = Params(CBaseChainParams::MAIN);
+
+    while (state.KeepRunning()) {
+        std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(chainparams, pool).SelectTransactions(1, GetTime()));
+        assert(pblocktemplate->block.vtx.size() > 1);
+    }
+}
+
+BENCHMARK(AssembleBlock);
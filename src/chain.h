@@ -149,6 +149,12 @@ public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
+	/*popchain ghost*/
+	//! (memory only) Hashes of the uncle headers this block includes, valid if fHaveUncleHashes
+	std::vector<uint256> vUncleHashes;
+	bool fHaveUncleHashes;
+	/*popchain ghost*/
+
     void SetNull()
     {
         phashBlock = NULL;
@@ -163,6 +169,10 @@ public:
         nChainTx = 0;
         nStatus = 0;
         nSequenceId = 0;
+		/*popchain ghost*/
+		vUncleHashes.clear();
+		fHaveUncleHashes = false;
+		/*popchain ghost*/
 
         nVersion       = 0;
 		/*popchain ghost*/
@@ -209,6 +209,9 @@ public:
 
         consensus.nPowTargetSpacing = 45;                         // Pop: 45 second
         consensus.fPowAllowMinDifficultyBlocks = false;
+        // Raise both at release time, once the chain has history worth trusting.
+        consensus.nMinimumChainWork = uint256();
+        consensus.defaultAssumeValid = uint256();
         consensus.fPowNoRetargeting = false;
         consensus.nRuleChangeActivationThreshold = 1916;                // 95% of 2016
         consensus.nMinerConfirmationWindow = 2016;                      // nPowTargetTimespan / nPowTargetSpacing
@@ -335,6 +338,8 @@ public:
 
         consensus.nPowTargetSpacing = 45;
         consensus.fPowAllowMinDifficultyBlocks = true;
+        consensus.nMinimumChainWork = uint256();
+        consensus.defaultAssumeValid = uint256();
         consensus.nRuleChangeActivationThreshold = 1512;                // 75% for testchains
         consensus.nMinerConfirmationWindow = 2016; 			// nPowTargetTimespan / nPowTargetSpacing
         consensus.vDeployments[Consensus::DEPLOYMENT_TESTDUMMY].bit = 28;
@@ -448,6 +453,8 @@ public:
         consensus.powLimit = uint256S("0x0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f0f");
         consensus.nPowTargetSpacing = 45;                         // Pop: 2.5 minutes
         consensus.fPowAllowMinDifficultyBlocks = true;
+        consensus.nMinimumChainWork = uint256();
+        consensus.defaultAssumeValid = uint256();
         consensus.fPowNoRetargeting = true;
 		
         /*popchain ghost*/
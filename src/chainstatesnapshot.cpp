@@ -0,0 +1,432 @@
+// Copyright (c) 2017-2018 The Popchain Core Developers
+
+#include "chainstatesnapshot.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "claimtrie.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "hash.h"
+#include "init.h"
+#include "main.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+static const uint32_t CHAINSTATE_SNAPSHOT_MAGIC = 0x70736e70; // "psnp"
+/** Sanity limit on the snapshot height so a damaged header cannot make us allocate gigabytes */
+static const int MAX_SNAPSHOT_HEIGHT = 100000000;
+
+/** Serializes to a file while hashing everything written */
+class CHashedFileWriter
+{
+private:
+    CAutoFile& file;
+    CHashWriter hasher;
+    uint64_t nBytes;
+
+public:
+    CHashedFileWriter(CAutoFile& fileIn) : file(fileIn), hasher(SER_DISK, CLIENT_VERSION), nBytes(0) {}
+
+    CHashedFileWriter& write(const char* pch, size_t nSize)
+    {
+        file.write(pch, nSize);
+        hasher.write(pch, nSize);
+        nBytes += nSize;
+        return *this;
+    }
+
+    template<typename T>
+    CHashedFileWriter& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj, file.GetType(), file.GetVersion());
+        return *this;
+    }
+
+    uint64_t GetBytes() const { return nBytes; }
+    // invalidates the object
+    uint256 GetHash() { return hasher.GetHash(); }
+};
+
+/** Deserializes from a file while hashing everything read */
+class CHashedFileReader
+{
+private:
+    CAutoFile& file;
+    CHashWriter hasher;
+    uint64_t nBytes;
+
+public:
+    CHashedFileReader(CAutoFile& fileIn) : file(fileIn), hasher(SER_DISK, CLIENT_VERSION), nBytes(0) {}
+
+    CHashedFileReader& read(char* pch, size_t nSize)
+    {
+        file.read(pch, nSize);
+        hasher.write(pch, nSize);
+        nBytes += nSize;
+        return *this;
+    }
+
+    template<typename T>
+    CHashedFileReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, file.GetType(), file.GetVersion());
+        return *this;
+    }
+
+    uint64_t GetBytes() const { return nBytes; }
+    // invalidates the object
+    uint256 GetHash() { return hasher.GetHash(); }
+};
+
+/** Feeds coins into a hash the same way CCoinsViewDB::GetStats computes hash_serialized */
+static void HashCoins(CHashWriter& ss, const CCoins& coins)
+{
+    for (unsigned int i=0; i<coins.vout.size(); i++) {
+        const CTxOut &out = coins.vout[i];
+        if (!out.IsNull()) {
+            ss << VARINT(i+1);
+            ss << out;
+        }
+    }
+    ss << VARINT(0);
+}
+
+/** Only records under the claim trie's own prefixes are carried, not the database's obfuscation key */
+static bool IsClaimTrieRecord(const std::vector<unsigned char>& vKey)
+{
+    if (vKey.empty())
+        return false;
+    switch (vKey[0]) {
+    case HASH_BLOCK:
+    case CURRENT_HEIGHT:
+    case TRIE_NODE:
+    case CLAIM_QUEUE_ROW:
+    case CLAIM_QUEUE_NAME_ROW:
+    case EXP_QUEUE_ROW:
+    case SUPPORT:
+    case SUPPORT_QUEUE_ROW:
+    case SUPPORT_QUEUE_NAME_ROW:
+    case SUPPORT_EXP_QUEUE_ROW:
+        return true;
+    }
+    return false;
+}
+
+static bool SnapshotError(std::string& strError, const std::string& strMessage)
+{
+    strError = strMessage;
+    return error("chainstate snapshot: %s", strMessage);
+}
+
+bool DumpChainstateSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, CChainstateSnapshotInfo& info, std::string& strError)
+{
+    std::vector<const CBlockIndex*> vChain;
+    std::vector<std::vector<uint256> > vUncleHashes;
+    boost::scoped_ptr<CCoinsViewCursor> pcoinsCursor;
+    boost::scoped_ptr<CDBIterator> pclaimCursor;
+    {
+        // Flush and open both database cursors under one lock so they see the
+        // same block; the cursors keep that view while we write without the lock.
+        LOCK(cs_main);
+        CBlockIndex* pindexTip = chainActive.Tip();
+        if (pindexTip == NULL || pindexTip->nHeight < 1)
+            return SnapshotError(strError, "No blocks to snapshot");
+        if (!hashExpected.IsNull() && pindexTip->GetBlockHash() != hashExpected)
+            return SnapshotError(strError, strprintf("Block %s is not the active tip", hashExpected.ToString()));
+
+        FlushStateToDisk();
+        pcoinsCursor.reset(pcoinsTip->Cursor());
+        if (!pcoinsCursor || pcoinsCursor->GetBestBlock() != pindexTip->GetBlockHash())
+            return SnapshotError(strError, "Coin database is not at the active tip");
+        pclaimCursor.reset(pclaimTrie->db.NewIterator());
+        info.hashClaimTrie = pclaimTrie->getMerkleHash();
+
+        vChain.reserve(pindexTip->nHeight);
+        for (int nHeight = 1; nHeight <= pindexTip->nHeight; nHeight++)
+            vChain.push_back(chainActive[nHeight]);
+        // The loading node has no blocks to look up the uncles the next blocks must not repeat
+        CBlockIndex* pindexUncles = pindexTip;
+        for (int i = 0; i < UNCLE_FAMILY_DEPTH && pindexUncles->nHeight > 0; i++, pindexUncles = pindexUncles->pprev) {
+            vUncleHashes.push_back(std::vector<uint256>());
+            if (!GetBlockUncleHashes(pindexUncles, vUncleHashes.back()))
+                return SnapshotError(strError, strprintf("Cannot read the uncles of block %s", pindexUncles->GetBlockHash().ToString()));
+        }
+        info.hashBlock = pindexTip->GetBlockHash();
+        info.nHeight = pindexTip->nHeight;
+    }
+
+    // Write to a temporary file and only move it into place once complete
+    boost::filesystem::path pathTmp = path.string() + ".incomplete";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return SnapshotError(strError, strprintf("Cannot open %s for writing", pathTmp.string()));
+
+    try {
+        CHashedFileWriter writer(fileout);
+        writer << CHAINSTATE_SNAPSHOT_MAGIC << CHAINSTATE_SNAPSHOT_VERSION;
+        writer << FLATDATA(Params().MessageStart());
+        writer << info.hashBlock << info.nHeight;
+
+        BOOST_FOREACH(const CBlockIndex* pindex, vChain)
+            writer << pindex->GetBlockHeader() << pindex->nTx;
+        writer << vUncleHashes;
+
+        CHashWriter ssCoins(SER_GETHASH, PROTOCOL_VERSION);
+        ssCoins << info.hashBlock;
+        while (pcoinsCursor->Valid()) {
+            boost::this_thread::interruption_point();
+            uint256 txid;
+            CCoins coins;
+            if (!pcoinsCursor->GetKey(txid) || !pcoinsCursor->GetValue(coins))
+                return SnapshotError(strError, "Unable to read coin database");
+            writer << true << txid << coins;
+            HashCoins(ssCoins, coins);
+            info.nCoins++;
+            pcoinsCursor->Next();
+        }
+        writer << false;
+        info.hashCoins = ssCoins.GetHash();
+
+        for (pclaimCursor->SeekToFirst(); pclaimCursor->Valid(); pclaimCursor->Next()) {
+            boost::this_thread::interruption_point();
+            std::vector<unsigned char> vKey = pclaimCursor->GetKeyBytes();
+            if (!IsClaimTrieRecord(vKey))
+                continue;
+            writer << true << vKey << pclaimCursor->GetValueBytes();
+            info.nClaimRecords++;
+        }
+        writer << false;
+
+        writer << info.nCoins << info.hashCoins << info.nClaimRecords << info.hashClaimTrie;
+        info.nBytes = writer.GetBytes() + sizeof(uint256);
+        info.hashChecksum = writer.GetHash();
+        fileout << info.hashChecksum;
+        FileCommit(fileout.Get());
+    } catch (const std::exception& e) {
+        return SnapshotError(strError, strprintf("Error writing %s: %s", pathTmp.string(), e.what()));
+    }
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, path))
+        return SnapshotError(strError, strprintf("Cannot rename %s to %s", pathTmp.string(), path.string()));
+
+    LogPrintf("Wrote chainstate snapshot %s: block %s height %d, %u coins, %u claim records, %u bytes\n",
+        path.string(), info.hashBlock.ToString(), info.nHeight, info.nCoins, info.nClaimRecords, info.nBytes);
+    return true;
+}
+
+/**
+ * Remove everything a failed load wrote to the coin and claim trie databases
+ * and restore their previous best blocks, so that the next start neither
+ * resumes from nor trusts a partial or unverified chainstate.
+ */
+static bool WipeSnapshotData(CCoinsViewDB* pcoinsdbview, const uint256& hashCoinsBest, bool fClaimBest, const uint256& hashClaimBest, int nClaimHeight)
+{
+    LogPrintf("Chainstate snapshot: wiping the partially loaded chainstate\n");
+    CCoinsMap mapCoins;
+    boost::scoped_ptr<CCoinsViewCursor> pcoinsCursor(pcoinsdbview->Cursor());
+    for (; pcoinsCursor->Valid(); pcoinsCursor->Next()) {
+        uint256 txid;
+        if (!pcoinsCursor->GetKey(txid))
+            return error("%s: unable to read coin database", __func__);
+        // A pruned dirty entry erases the record
+        mapCoins[txid].flags = CCoinsCacheEntry::DIRTY;
+        if (mapCoins.size() >= SNAPSHOT_LOAD_BATCH && !pcoinsdbview->BatchWrite(mapCoins, uint256()))
+            return error("%s: failed to write to coin database", __func__);
+    }
+    if (!pcoinsdbview->BatchWrite(mapCoins, hashCoinsBest))
+        return error("%s: failed to write to coin database", __func__);
+
+    CDBWrapper& claimdb = pclaimTrie->db;
+    boost::scoped_ptr<CDBBatch> pbatch(new CDBBatch(&claimdb.GetObfuscateKey()));
+    boost::scoped_ptr<CDBIterator> pclaimCursor(claimdb.NewIterator());
+    unsigned int nErased = 0;
+    for (pclaimCursor->SeekToFirst(); pclaimCursor->Valid(); pclaimCursor->Next()) {
+        std::vector<unsigned char> vKey = pclaimCursor->GetKeyBytes();
+        if (!IsClaimTrieRecord(vKey))
+            continue;
+        pbatch->EraseBytes(vKey);
+        if (++nErased % SNAPSHOT_LOAD_BATCH == 0) {
+            if (!claimdb.WriteBatch(*pbatch))
+                return error("%s: failed to write to claim trie database", __func__);
+            pbatch.reset(new CDBBatch(&claimdb.GetObfuscateKey()));
+        }
+    }
+    if (fClaimBest) {
+        pbatch->Write(HASH_BLOCK, hashClaimBest);
+        pbatch->Write(CURRENT_HEIGHT, nClaimHeight);
+    }
+    if (!claimdb.WriteBatch(*pbatch, true))
+        return error("%s: failed to write to claim trie database", __func__);
+    return true;
+}
+
+/** Does the work of LoadChainstateSnapshot; fWritten tells whether the databases were touched */
+static bool ReadChainstateSnapshot(CAutoFile& filein, const boost::filesystem::path& path, const uint256& hashCoinsExpected, const uint256& hashClaimTrieExpected,
+                                   const CChainParams& chainparams, CCoinsViewDB* pcoinsdbview, CChainstateSnapshotInfo& info, std::string& strError, bool& fWritten)
+{
+    std::vector<unsigned int> vTxCounts;
+    std::vector<std::vector<uint256> > vUncleHashes;
+    CBlockIndex* pindexSnapshot = NULL;
+    uint256 hashClaimTrieRequired;
+    CCoinsMap mapCoins;
+
+    try {
+        CHashedFileReader reader(filein);
+        uint32_t nMagic, nVersion;
+        CMessageHeader::MessageStartChars pchMessageStart;
+        reader >> nMagic >> nVersion;
+        if (nMagic != CHAINSTATE_SNAPSHOT_MAGIC)
+            return SnapshotError(strError, strprintf("%s is not a chainstate snapshot", path.string()));
+        if (nVersion != CHAINSTATE_SNAPSHOT_VERSION)
+            return SnapshotError(strError, strprintf("Unsupported snapshot version %u", nVersion));
+        reader >> FLATDATA(pchMessageStart);
+        if (memcmp(pchMessageStart, chainparams.MessageStart(), MESSAGE_START_SIZE) != 0)
+            return SnapshotError(strError, "Snapshot is for a different network");
+        reader >> info.hashBlock >> info.nHeight;
+        if (info.nHeight < 1 || info.nHeight > MAX_SNAPSHOT_HEIGHT)
+            return SnapshotError(strError, strprintf("Invalid snapshot height %d", info.nHeight));
+
+        // Headers go through the usual header checks (proof of work, checkpoints)
+        vTxCounts.resize(info.nHeight + 1, 0);
+        for (int nHeight = 1; nHeight <= info.nHeight; nHeight++) {
+            if (ShutdownRequested())
+                return SnapshotError(strError, "Interrupted");
+            CBlockHeader header;
+            unsigned int nTx;
+            reader >> header >> nTx;
+            CValidationState state;
+            if (!ProcessNewBlockHeader(header, state, chainparams, &pindexSnapshot))
+                return SnapshotError(strError, strprintf("Invalid header at height %d: %s", nHeight, state.GetRejectReason()));
+            if (pindexSnapshot->nHeight != nHeight)
+                return SnapshotError(strError, strprintf("Header %s is not at height %d", pindexSnapshot->GetBlockHash().ToString(), nHeight));
+            vTxCounts[nHeight] = nTx;
+        }
+        if (pindexSnapshot->GetBlockHash() != info.hashBlock)
+            return SnapshotError(strError, "Headers do not lead to the snapshot block");
+        LogPrintf("Chainstate snapshot: accepted %d headers\n", info.nHeight);
+        reader >> vUncleHashes;
+
+        // Only the header is covered by proof of work; fall back to the
+        // caller's root if its miner did not commit to the claim trie.
+        hashClaimTrieRequired = pindexSnapshot->hashClaimTrie.IsNull() ? hashClaimTrieExpected : pindexSnapshot->hashClaimTrie;
+        if (hashClaimTrieRequired.IsNull())
+            return SnapshotError(strError, "The snapshot block does not commit to a claim trie root, so the expected root must be given");
+
+        // Coins are written without a best block; the snapshot block is only
+        // recorded once everything has been checked.
+        fWritten = true;
+        CHashWriter ssCoins(SER_GETHASH, PROTOCOL_VERSION);
+        ssCoins << info.hashBlock;
+        bool fMore;
+        for (reader >> fMore; fMore; reader >> fMore) {
+            uint256 txid;
+            CCoins coins;
+            reader >> txid >> coins;
+            if (coins.IsPruned())
+                return SnapshotError(strError, strprintf("Snapshot contains spent transaction %s", txid.ToString()));
+            HashCoins(ssCoins, coins);
+            CCoinsCacheEntry& entry = mapCoins[txid];
+            entry.coins.swap(coins);
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            if (++info.nCoins % SNAPSHOT_LOAD_BATCH == 0) {
+                if (ShutdownRequested())
+                    return SnapshotError(strError, "Interrupted");
+                if (!pcoinsdbview->BatchWrite(mapCoins, uint256()))
+                    return SnapshotError(strError, "Failed to write to coin database");
+            }
+        }
+        uint256 hashCoins = ssCoins.GetHash();
+        LogPrintf("Chainstate snapshot: read %u coins\n", info.nCoins);
+
+        CDBWrapper& claimdb = pclaimTrie->db;
+        boost::scoped_ptr<CDBBatch> pbatch(new CDBBatch(&claimdb.GetObfuscateKey()));
+        for (reader >> fMore; fMore; reader >> fMore) {
+            std::vector<unsigned char> vKey, vValue;
+            reader >> vKey >> vValue;
+            if (!IsClaimTrieRecord(vKey))
+                return SnapshotError(strError, "Snapshot contains an unknown claim trie record");
+            pbatch->WriteBytes(vKey, vValue);
+            if (++info.nClaimRecords % SNAPSHOT_LOAD_BATCH == 0) {
+                if (!claimdb.WriteBatch(*pbatch))
+                    return SnapshotError(strError, "Failed to write to claim trie database");
+                pbatch.reset(new CDBBatch(&claimdb.GetObfuscateKey()));
+            }
+        }
+        if (!claimdb.WriteBatch(*pbatch, true))
+            return SnapshotError(strError, "Failed to write to claim trie database");
+        LogPrintf("Chainstate snapshot: read %u claim trie records\n", info.nClaimRecords);
+
+        uint64_t nCoins, nClaimRecords;
+        reader >> nCoins >> info.hashCoins >> nClaimRecords >> info.hashClaimTrie;
+        info.nBytes = reader.GetBytes() + sizeof(uint256);
+        uint256 hashChecksum = reader.GetHash();
+        filein >> info.hashChecksum;
+        if (hashChecksum != info.hashChecksum)
+            return SnapshotError(strError, "Snapshot checksum mismatch");
+        if (nCoins != info.nCoins || nClaimRecords != info.nClaimRecords || hashCoins != info.hashCoins)
+            return SnapshotError(strError, "Snapshot contents do not match its trailer");
+        // The trailer is only as trustworthy as the file; the coin set hash must come from elsewhere
+        if (hashCoins != hashCoinsExpected)
+            return SnapshotError(strError, strprintf("Coin set hash mismatch: got %s, expected %s", hashCoins.ToString(), hashCoinsExpected.ToString()));
+    } catch (const std::exception& e) {
+        return SnapshotError(strError, strprintf("Error reading %s: %s", path.string(), e.what()));
+    }
+
+    LOCK(cs_main);
+    // Rebuild the in-memory claim trie from what was just written and check its root
+    pclaimTrie->clear();
+    if (!pclaimTrie->ReadFromDisk(true))
+        return SnapshotError(strError, "Loaded claim trie is inconsistent");
+    if (pclaimTrie->getMerkleHash() != hashClaimTrieRequired)
+        return SnapshotError(strError, strprintf("Claim trie root mismatch: got %s, expected %s", pclaimTrie->getMerkleHash().ToString(), hashClaimTrieRequired.ToString()));
+
+    if (!pcoinsdbview->BatchWrite(mapCoins, info.hashBlock))
+        return SnapshotError(strError, "Failed to write to coin database");
+    if (!ActivateSnapshotChain(pindexSnapshot, vTxCounts, vUncleHashes))
+        return SnapshotError(strError, "Failed to activate the snapshot chain");
+    return true;
+}
+
+bool LoadChainstateSnapshot(const boost::filesystem::path& path, const uint256& hashCoinsExpected, const uint256& hashClaimTrieExpected,
+                            const CChainParams& chainparams, CCoinsViewDB* pcoinsdbview, CChainstateSnapshotInfo& info, std::string& strError)
+{
+    if (hashCoinsExpected.IsNull())
+        return SnapshotError(strError, "The expected coin set hash of the snapshot is required");
+    {
+        LOCK(cs_main);
+        if (chainActive.Height() != 0)
+            return SnapshotError(strError, "The chainstate is not empty");
+    }
+
+    FILE* file = fopen(path.string().c_str(), "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return SnapshotError(strError, strprintf("Cannot open %s", path.string()));
+
+    LogPrintf("Loading chainstate snapshot %s...\n", path.string());
+    int64_t nStart = GetTimeMillis();
+    // What the databases pointed at before, to put back if the snapshot is rejected
+    uint256 hashCoinsBest = pcoinsdbview->GetBestBlock();
+    uint256 hashClaimBest;
+    int nClaimHeight = 0;
+    bool fClaimBest = pclaimTrie->db.Read(HASH_BLOCK, hashClaimBest) && pclaimTrie->db.Read(CURRENT_HEIGHT, nClaimHeight);
+
+    bool fWritten = false;
+    if (!ReadChainstateSnapshot(filein, path, hashCoinsExpected, hashClaimTrieExpected, chainparams, pcoinsdbview, info, strError, fWritten)) {
+        if (fWritten && !WipeSnapshotData(pcoinsdbview, hashCoinsBest, fClaimBest, hashClaimBest, nClaimHeight))
+            strError += "; the partially loaded chainstate could not be removed, restart with -reindex";
+        return false;
+    }
+
+    LogPrintf("Loaded chainstate snapshot at block %s height %d in %dms\n", info.hashBlock.ToString(), info.nHeight, GetTimeMillis() - nStart);
+    return true;
+}
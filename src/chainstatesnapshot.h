@@ -0,0 +1,65 @@
+// Copyright (c) 2017-2018 The Popchain Core Developers
+
+/**
+ * Chainstate snapshots: the UTXO set and the claim trie as of one block,
+ * written as a single checksummed stream so a new node can start from it
+ * instead of downloading and replaying the whole chain.
+ *
+ * File layout, all in disk serialization:
+ *  - magic, version, network message start, snapshot block hash and height
+ *  - the header and transaction count of every block from height 1 up to
+ *    the snapshot block
+ *  - the uncle hashes of the snapshot block and its ancestors, newest first,
+ *    for the last UNCLE_FAMILY_DEPTH blocks
+ *  - the coins records (txid, CCoins), ended by a false marker
+ *  - the raw claim trie database records (key, value), ended by a false marker
+ *  - trailer: coins count, coin set hash (the hash_serialized of
+ *    gettxoutsetinfo), claim record count and claim trie merkle root
+ *  - double SHA256 of everything above
+ */
+#ifndef BITCOIN_CHAINSTATESNAPSHOT_H
+#define BITCOIN_CHAINSTATESNAPSHOT_H
+
+#include "uint256.h"
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+class CChainParams;
+class CCoinsViewDB;
+
+static const uint32_t CHAINSTATE_SNAPSHOT_VERSION = 2;
+/** Coins written to the coin database per batch while loading a snapshot */
+static const unsigned int SNAPSHOT_LOAD_BATCH = 100000;
+
+struct CChainstateSnapshotInfo
+{
+    uint256 hashBlock;
+    int nHeight;
+    uint64_t nCoins;            //!< transactions with unspent outputs
+    uint256 hashCoins;
+    uint64_t nClaimRecords;
+    uint256 hashClaimTrie;
+    uint256 hashChecksum;
+    uint64_t nBytes;
+
+    CChainstateSnapshotInfo() : nHeight(-1), nCoins(0), nClaimRecords(0), nBytes(0) {}
+};
+
+/** Write the chainstate at the active tip to path. If hashExpected is set it must be the tip. */
+bool DumpChainstateSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, CChainstateSnapshotInfo& info, std::string& strError);
+
+/**
+ * Bootstrap a fresh chainstate (only the genesis block connected) from a
+ * snapshot: accept the headers, bulk load the coins and claim trie and make
+ * the snapshot block the active tip. The file is not trusted: the coin set
+ * must hash to hashCoinsExpected, and the claim trie must match the root in
+ * the snapshot block header, or hashClaimTrieExpected if the header has none.
+ * A rejected snapshot is removed from the databases again.
+ */
+bool LoadChainstateSnapshot(const boost::filesystem::path& path, const uint256& hashCoinsExpected, const uint256& hashClaimTrieExpected,
+                            const CChainParams& chainparams, CCoinsViewDB* pcoinsdbview, CChainstateSnapshotInfo& info, std::string& strError);
+
+#endif // BITCOIN_CHAINSTATESNAPSHOT_H
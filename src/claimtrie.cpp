@@ -2600,6 +2600,7 @@ bool CClaimTrieCache::clear() const
     supportQueueNameCache.clear();
     namesToCheckForTakeover.clear();
     cacheTakeoverHeights.clear();
+    lastControllingClaims.clear();
     return true;
 }
 
@@ -2692,3 +2693,45 @@ CClaimTrieProof CClaimTrieCache::getProofForName(const std::string& name) const
     return CClaimTrieProof(nodes, fNameHasValue, outPoint,
                            nHeightOfLastTakeover);
 }
+
+void CClaimTrieCache::getControllingClaimChanges(std::set<std::string>& names) const
+{
+    for (nodeCacheType::const_iterator itCache = cache.begin(); itCache != cache.end(); ++itCache)
+    {
+        CClaimValue claimInCache;
+        CClaimValue claimBefore;
+        bool haveClaimInCache = itCache->second->getBestClaim(claimInCache);
+        bool haveClaimBefore;
+        std::map<std::string, std::pair<bool, CClaimValue> >::const_iterator itLast = lastControllingClaims.find(itCache->first);
+        if (itLast != lastControllingClaims.end())
+        {
+            haveClaimBefore = itLast->second.first;
+            claimBefore = itLast->second.second;
+        }
+        else
+            haveClaimBefore = base->getInfoForName(itCache->first, claimBefore);
+        if (haveClaimInCache != haveClaimBefore || (haveClaimInCache && claimInCache != claimBefore))
+        {
+            names.insert(itCache->first);
+            lastControllingClaims[itCache->first] = std::make_pair(haveClaimInCache, claimInCache);
+        }
+    }
+}
+
+void CClaimTrieDelta::addBlockUndo(const insertUndoType& insertUndo,
+                                   const claimQueueRowType& expireUndo,
+                                   const insertUndoType& insertSupportUndo,
+                                   const supportQueueRowType& expireSupportUndo,
+                                   const std::vector<std::pair<std::string, int> >& takeoverHeightUndo)
+{
+    for (insertUndoType::const_iterator it = insertUndo.begin(); it != insertUndo.end(); ++it)
+        setActivated.insert(it->name);
+    for (insertUndoType::const_iterator it = insertSupportUndo.begin(); it != insertSupportUndo.end(); ++it)
+        setActivated.insert(it->name);
+    for (claimQueueRowType::const_iterator it = expireUndo.begin(); it != expireUndo.end(); ++it)
+        setExpired.insert(it->first);
+    for (supportQueueRowType::const_iterator it = expireSupportUndo.begin(); it != expireSupportUndo.end(); ++it)
+        setExpired.insert(it->first);
+    for (std::vector<std::pair<std::string, int> >::const_iterator it = takeoverHeightUndo.begin(); it != takeoverHeightUndo.end(); ++it)
+        setTakeovers.insert(it->first);
+}
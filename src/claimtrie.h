@@ -10,6 +10,7 @@
 #include "dbwrapper.h"
 #include "primitives/transaction.h"
 
+#include <set>
 #include <string>
 #include <vector>
 
@@ -273,8 +274,19 @@ struct claimsForNameType
     std::vector<CSupportValue> supports;
     int nLastTakeoverHeight;
 
+    claimsForNameType() : nLastTakeoverHeight(0) {}
     claimsForNameType(std::vector<CClaimValue> claims, std::vector<CSupportValue> supports, int nLastTakeoverHeight)
     : claims(claims), supports(supports), nLastTakeoverHeight(nLastTakeoverHeight) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(claims);
+        READWRITE(supports);
+        READWRITE(nLastTakeoverHeight);
+    }
 };
 
 class CClaimTrieCache;
@@ -283,7 +295,7 @@ class CClaimTrie
 {
 public:
     CClaimTrie(bool fMemory = false, bool fWipe = false, int nProportionalDelayFactor = 32)
-               : db(GetDataDir() / "claimtrie", 100, fMemory, fWipe, false)
+               : db(GetDataDir() / "claimtrie", CDBOptions("claimtrie", 100), fMemory, fWipe, false)
                , nCurrentHeight(1), nExpirationTime(262974)
                , nProportionalDelayFactor(nProportionalDelayFactor)
                , root(uint256S("0000000000000000000000000000000000000000000000000000000000000000"))
@@ -420,6 +432,16 @@ public:
     std::vector<std::pair<unsigned char, uint256> > children;
     bool hasValue;
     uint256 valHash;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(children);
+        READWRITE(hasValue);
+        READWRITE(valHash);
+    }
 };
 
 class CClaimTrieProof
@@ -431,6 +453,58 @@ public:
     bool hasValue;
     COutPoint outPoint;
     int nHeightOfLastTakeover;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nodes);
+        READWRITE(hasValue);
+        READWRITE(outPoint);
+        READWRITE(nHeightOfLastTakeover);
+    }
+};
+
+/**
+ * Names affected by connecting or disconnecting a single block, so that
+ * listeners caching name lookups can invalidate precisely. When a block is
+ * disconnected the sets describe the names whose state was rolled back.
+ */
+class CClaimTrieDelta
+{
+public:
+    uint256 hashBlock;
+    int nHeight;
+    bool fConnected;
+    std::set<std::string> setChanged;   // controlling claim differs after the block
+    std::set<std::string> setTakeovers; // last takeover height was updated
+    std::set<std::string> setExpired;   // a claim or support expired
+    std::set<std::string> setActivated; // a queued claim or support became active
+
+    CClaimTrieDelta() : nHeight(0), fConnected(true) {}
+    CClaimTrieDelta(const uint256& hashBlock, int nHeight, bool fConnected)
+                    : hashBlock(hashBlock), nHeight(nHeight), fConnected(fConnected) {}
+
+    void addBlockUndo(const insertUndoType& insertUndo,
+                      const claimQueueRowType& expireUndo,
+                      const insertUndoType& insertSupportUndo,
+                      const supportQueueRowType& expireSupportUndo,
+                      const std::vector<std::pair<std::string, int> >& takeoverHeightUndo);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(fConnected);
+        READWRITE(setChanged);
+        READWRITE(setTakeovers);
+        READWRITE(setExpired);
+        READWRITE(setActivated);
+    }
 };
 
 class CClaimTrieCache
@@ -493,6 +567,10 @@ public:
                              CClaimValue& claim,
                              bool fCheckTakeover = false) const;
     CClaimTrieProof getProofForName(const std::string& name) const;
+    // names whose controlling claim in the cache differs from what the previous
+    // call saw, or from the base trie on the first call, so a cache that undoes
+    // several blocks in a row can report the changes of each block
+    void getControllingClaimChanges(std::set<std::string>& names) const;
 
     bool finalizeDecrement() const;
 private:
@@ -513,6 +591,8 @@ private:
     mutable expirationQueueType supportExpirationQueueCache;
     mutable std::set<std::string> namesToCheckForTakeover;
     mutable std::map<std::string, int> cacheTakeoverHeights; 
+    // controlling claim (if any) of each name last reported by getControllingClaimChanges
+    mutable std::map<std::string, std::pair<bool, CClaimValue> > lastControllingClaims;
     mutable int nCurrentHeight; // Height of the block that is being worked on, which is
                                 // one greater than the height of the chain's tip
     
@@ -44,6 +44,7 @@ bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
+CCoinsViewCursor *CCoinsView::Cursor() const { return NULL; }
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
@@ -53,6 +54,7 @@ uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
 bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
+CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
@@ -64,7 +66,14 @@ CCoinsViewCache::~CCoinsViewCache()
 }
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
-    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
+    return memusage::DynamicUsage(cacheCoins) + memusage::DynamicUsage(vDirty) + cachedCoinsUsage;
+}
+
+void CCoinsViewCache::MarkDirty(CCoinsMap::iterator it) {
+    if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+        it->second.flags |= CCoinsCacheEntry::DIRTY;
+        vDirty.push_back(it->first);
+    }
 }
 
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
@@ -85,6 +94,16 @@ CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const
     return ret;
 }
 
+void CCoinsViewCache::AddFromBase(const uint256 &txid, CCoins &coins) {
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    if (!ret.second)
+        return;
+    coins.swap(ret.first->second.coins);
+    if (ret.first->second.coins.IsPruned())
+        ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    cachedCoinsUsage += ret.first->second.coins.DynamicMemoryUsage();
+}
+
 bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
     CCoinsMap::const_iterator it = FetchCoins(txid);
     if (it != cacheCoins.end()) {
@@ -111,7 +130,7 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
         cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
+    MarkDirty(ret.first);
     return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
 
@@ -119,8 +138,9 @@ CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid) {
     assert(!hasModifier);
     std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
     ret.first->second.coins.Clear();
-    ret.first->second.flags = CCoinsCacheEntry::FRESH;
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
+    ret.first->second.flags &= CCoinsCacheEntry::DIRTY;
+    ret.first->second.flags |= CCoinsCacheEntry::FRESH;
+    MarkDirty(ret.first);
     return CCoinsModifier(*this, ret.first, 0);
 }
 
@@ -168,10 +188,11 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                 if (!(it->second.flags & CCoinsCacheEntry::FRESH && it->second.coins.IsPruned())) {
                     // Otherwise we will need to create it in the parent
                     // and move the data up and mark it as dirty
-                    CCoinsCacheEntry& entry = cacheCoins[it->first];
+                    CCoinsMap::iterator itNew = cacheCoins.insert(std::make_pair(it->first, CCoinsCacheEntry())).first;
+                    CCoinsCacheEntry& entry = itNew->second;
                     entry.coins.swap(it->second.coins);
                     cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
-                    entry.flags = CCoinsCacheEntry::DIRTY;
+                    MarkDirty(itNew);
                     // We can mark it FRESH in the parent if it was FRESH in the child
                     // Otherwise it might have just been flushed from the parent's cache
                     // and already exist in the grandparent
@@ -191,7 +212,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
                     cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
-                    itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    MarkDirty(itUs);
                 }
             }
         }
@@ -205,10 +226,34 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
+    vDirty.clear();
     cachedCoinsUsage = 0;
     return fOk;
 }
 
+bool CCoinsViewCache::WriteDirty() {
+    assert(!hasModifier);
+    CCoinsMap mapDirty;
+    BOOST_FOREACH(const uint256& txid, vDirty) {
+        CCoinsMap::iterator it = cacheCoins.find(txid);
+        if (it == cacheCoins.end() || !(it->second.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        CCoinsCacheEntry& entry = mapDirty[txid];
+        entry.flags = it->second.flags;
+        if (it->second.coins.IsPruned()) {
+            cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+            entry.coins.swap(it->second.coins);
+            cacheCoins.erase(it);
+        } else {
+            // The base has this version now, so the entry is neither dirty nor fresh any more
+            entry.coins = it->second.coins;
+            it->second.flags = 0;
+        }
+    }
+    vDirty.clear();
+    return base->BatchWrite(mapDirty, hashBlock);
+}
+
 void CCoinsViewCache::Uncache(const uint256& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
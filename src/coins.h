@@ -309,6 +309,26 @@ struct CCoinsStats
 
 
 /** Abstract view on the open txout dataset. */
+/** Cursor for iterating over the state of a CCoinsView */
+class CCoinsViewCursor
+{
+public:
+    CCoinsViewCursor(const uint256 &hashBlockIn): hashBlock(hashBlockIn) {}
+    virtual ~CCoinsViewCursor() {}
+
+    virtual bool GetKey(uint256 &txid) const = 0;
+    virtual bool GetValue(CCoins &coins) const = 0;
+    virtual unsigned int GetValueSize() const = 0;
+
+    virtual bool Valid() const = 0;
+    virtual void Next() = 0;
+
+    //! Best block at the time this cursor was created
+    const uint256 &GetBestBlock() const { return hashBlock; }
+private:
+    uint256 hashBlock;
+};
+
 class CCoinsView
 {
 public:
@@ -329,6 +349,9 @@ public:
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
 
+    //! Get a cursor over the whole state, or NULL if unsupported; the caller owns it
+    virtual CCoinsViewCursor *Cursor() const;
+
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
 };
@@ -348,6 +371,7 @@ public:
     void SetBackend(CCoinsView &viewIn);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+    CCoinsViewCursor *Cursor() const;
 };
 
 
@@ -391,6 +415,11 @@ protected:
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Txids of entries that became dirty since the last write; may hold stale or duplicate txids. */
+    std::vector<uint256> vDirty;
+
+    void MarkDirty(CCoinsMap::iterator it);
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -434,6 +463,19 @@ public:
      */
     CCoinsModifier ModifyNewCoins(const uint256 &txid);
 
+    /**
+     * Look txid up in the base view only, without touching this cache. May be
+     * called from several threads at once as long as neither this cache nor
+     * its base is modified meanwhile.
+     */
+    bool GetCoinsFromBase(const uint256 &txid, CCoins &coins) const { return base->GetCoins(txid, coins); }
+
+    /**
+     * Add coins read with GetCoinsFromBase as an unmodified entry, unless txid
+     * is cached already. Same effect as the fetch done by AccessCoins.
+     */
+    void AddFromBase(const uint256 &txid, CCoins &coins);
+
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
@@ -441,6 +483,16 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push only the modified entries to the base and keep everything else
+     * cached. Entries that are still unspent stay in the cache as clean
+     * entries, spent ones are dropped.
+     */
+    bool WriteDirty();
+
+    //! Upper bound on the number of modified entries, cheap to query
+    size_t GetDirtyCount() const { return vDirty.size(); }
+
     /**
      * Removes the transaction with the given hash from the cache, if it is
      * not modified.
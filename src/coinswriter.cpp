@@ -0,0 +1,224 @@
+// Copyright (c) 2017-2018 The Popchain Core Developers
+
+#include "coinswriter.h"
+
+#include "init.h"
+#include "memusage.h"
+#include "txdb.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+
+CCoinsViewWriter::CCoinsViewWriter(CCoinsViewDB* dbIn) : CCoinsViewBacked(dbIn), db(dbIn), cachedQueuedUsage(0), fQueued(false), cachedWritingUsage(0), fWriting(false), fFailed(false), fRunning(false), nMaxQueuedUsage(0)
+{
+}
+
+CCoinsViewWriter::~CCoinsViewWriter()
+{
+    Stop();
+}
+
+bool CCoinsViewWriter::GetCoins(const uint256 &txid, CCoins &coins) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CCoinsMap::const_iterator it = mapQueued.find(txid);
+        if (it != mapQueued.end()) {
+            coins = it->second.coins;
+            return true;
+        }
+        it = mapWriting.find(txid);
+        if (it != mapWriting.end()) {
+            coins = it->second.coins;
+            return true;
+        }
+    }
+    // Entries only leave mapWriting once they are in the database
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewWriter::HaveCoins(const uint256 &txid) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CCoinsMap::const_iterator it = mapQueued.find(txid);
+        if (it != mapQueued.end())
+            return !it->second.coins.IsPruned();
+        it = mapWriting.find(txid);
+        if (it != mapWriting.end())
+            return !it->second.coins.IsPruned();
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewWriter::GetBestBlock() const
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!hashQueued.IsNull())
+            return hashQueued;
+        if (!hashWriting.IsNull())
+            return hashWriting;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewWriter::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    // Keep the queued set bounded when the database cannot keep up
+    while (fRunning && fWriting && !fFailed && nMaxQueuedUsage > 0 && memusage::DynamicUsage(mapQueued) + cachedQueuedUsage > nMaxQueuedUsage)
+        condWritten.wait(lock);
+    if (fFailed)
+        return false;
+    // Newer versions of an entry replace queued ones; the set is only ever written as a whole
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        CCoinsCacheEntry& entry = mapQueued[it->first];
+        cachedQueuedUsage -= entry.coins.DynamicMemoryUsage();
+        entry.coins.swap(it->second.coins);
+        cachedQueuedUsage += entry.coins.DynamicMemoryUsage();
+        entry.flags = CCoinsCacheEntry::DIRTY;
+    }
+    mapCoins.clear();
+    if (!hashBlock.IsNull())
+        hashQueued = hashBlock;
+    fQueued = true;
+
+    if (!fRunning) {
+        while (fWriting && !fFailed)
+            condWritten.wait(lock);
+        return CommitQueued(lock);
+    }
+    condQueued.notify_one();
+    return true;
+}
+
+bool CCoinsViewWriter::CommitQueued(boost::unique_lock<boost::mutex>& lock) const
+{
+    if (fFailed)
+        return false;
+    assert(!fWriting);
+    mapWriting.swap(mapQueued);
+    hashWriting = hashQueued;
+    hashQueued.SetNull();
+    cachedWritingUsage = cachedQueuedUsage;
+    cachedQueuedUsage = 0;
+    fQueued = false;
+    fWriting = true;
+
+    // mapWriting is not modified until the write is done, so readers may
+    // keep looking into it while the database work runs without the lock
+    lock.unlock();
+    int64_t nStart = GetTimeMicros();
+    bool fOk = false;
+    try {
+        fOk = db->WriteCoins(mapWriting, hashWriting);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    int64_t nElapsed = GetTimeMicros() - nStart;
+    lock.lock();
+
+    if (fOk) {
+        LogPrint("coindb", "Wrote %u coins to the coin database in %.2fms\n", mapWriting.size(), nElapsed * 0.001);
+        mapWriting.clear();
+        hashWriting.SetNull();
+        cachedWritingUsage = 0;
+        fWriting = false;
+    } else {
+        // Keep the failed set readable; nothing more is written so the
+        // database stays at its last consistent best block
+        fFailed = true;
+    }
+    condWritten.notify_all();
+    return fOk;
+}
+
+bool CCoinsViewWriter::WaitForWrites() const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (!fFailed && (fWriting || (fRunning && fQueued)))
+        condWritten.wait(lock);
+    if (!fFailed && fQueued)
+        return CommitQueued(lock);
+    return !fFailed;
+}
+
+size_t CCoinsViewWriter::DynamicMemoryUsage() const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return memusage::DynamicUsage(mapQueued) + cachedQueuedUsage + memusage::DynamicUsage(mapWriting) + cachedWritingUsage;
+}
+
+void CCoinsViewWriter::SetMaxQueuedUsage(size_t nMaxQueuedUsageIn)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    nMaxQueuedUsage = nMaxQueuedUsageIn;
+}
+
+bool CCoinsViewWriter::GetStats(CCoinsStats &coinsStats) const
+{
+    if (!WaitForWrites())
+        return false;
+    return base->GetStats(coinsStats);
+}
+
+CCoinsViewCursor *CCoinsViewWriter::Cursor() const
+{
+    if (!WaitForWrites())
+        return NULL;
+    return base->Cursor();
+}
+
+void CCoinsViewWriter::ThreadWrite()
+{
+    while (true) {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (!fQueued)
+            condQueued.wait(lock);
+        if (!CommitQueued(lock)) {
+            LogPrintf("*** %s\n", "Failed to write to coin database");
+            uiInterface.ThreadSafeMessageBox(_("Error: A fatal internal error occurred, see debug.log for details"), "", CClientUIInterface::MSG_ERROR);
+            StartShutdown();
+            return;
+        }
+    }
+}
+
+void CCoinsViewWriter::Start()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    if (fRunning)
+        return;
+    fRunning = true;
+    boost::function<void()> fn = boost::bind(&CCoinsViewWriter::ThreadWrite, this);
+    thread = boost::thread(boost::bind(&TraceThread<boost::function<void()> >, "coinswriter", fn));
+}
+
+void CCoinsViewWriter::Interrupt()
+{
+    thread.interrupt();
+}
+
+void CCoinsViewWriter::Stop()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fRunning)
+            return;
+    }
+    thread.interrupt();
+    thread.join();
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fRunning = false;
+    }
+    condWritten.notify_all();
+    // Whatever the thread did not get to is written from here
+    WaitForWrites();
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2017-2018 The Popchain Core Developers
+
+/**
+ * Background writer for the coin database.
+ *
+ * CCoinsViewWriter sits between the coin cache and CCoinsViewDB. A BatchWrite
+ * into it (from pcoinsTip->Flush or pcoinsTip->WriteDirty, under cs_main)
+ * only moves the modified entries into a queued set; a dedicated thread
+ * commits each set to the database as one atomic batch together with its
+ * best block, so the database only ever moves from one consistent state to
+ * the next. Queued and in-flight entries stay readable through this view,
+ * so the cache above may evict anything at any time. A BatchWrite only waits
+ * for the thread when the queued set has grown past its memory limit while
+ * another set is still being written.
+ */
+#ifndef BITCOIN_COINSWRITER_H
+#define BITCOIN_COINSWRITER_H
+
+#include "coins.h"
+
+#include <boost/thread.hpp>
+
+class CCoinsViewDB;
+
+class CCoinsViewWriter : public CCoinsViewBacked
+{
+public:
+    CCoinsViewWriter(CCoinsViewDB* dbIn);
+    ~CCoinsViewWriter();
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    /** Queue the dirty entries of mapCoins for the writer thread, or write them now if it is not running */
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool GetStats(CCoinsStats &stats) const;
+    CCoinsViewCursor *Cursor() const;
+
+    /** Wait until everything queued so far is in the database. Returns false if a write failed. */
+    bool WaitForWrites() const;
+    /** Memory held by the queued and in-flight sets */
+    size_t DynamicMemoryUsage() const;
+    /** Limit on the memory of the queued set before BatchWrite waits for the writer; 0 for none */
+    void SetMaxQueuedUsage(size_t nMaxQueuedUsageIn);
+
+    void Start();
+    void Interrupt();
+    /** Stop the thread and write whatever is still queued from the calling thread */
+    void Stop();
+
+private:
+    CCoinsViewWriter(const CCoinsViewWriter&);
+    void operator=(const CCoinsViewWriter&);
+
+    void ThreadWrite();
+    bool CommitQueued(boost::unique_lock<boost::mutex>& lock) const;
+
+    CCoinsViewDB* db;
+    mutable boost::mutex cs;
+    //! Signalled when a set is queued
+    mutable boost::condition_variable condQueued;
+    //! Signalled when a set has been committed (or failed)
+    mutable boost::condition_variable condWritten;
+    //! Newest changes, merged across BatchWrite calls until the writer picks them up
+    mutable CCoinsMap mapQueued;
+    mutable uint256 hashQueued;
+    mutable size_t cachedQueuedUsage;
+    mutable bool fQueued;
+    //! The set being written; not modified while the write is in progress
+    mutable CCoinsMap mapWriting;
+    mutable uint256 hashWriting;
+    mutable size_t cachedWritingUsage;
+    mutable bool fWriting;
+    mutable bool fFailed;
+    bool fRunning;
+    size_t nMaxQueuedUsage;
+    boost::thread thread;
+};
+
+#endif // BITCOIN_COINSWRITER_H
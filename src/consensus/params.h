@@ -89,6 +89,10 @@ struct Params {
     bool fPowNoRetargeting;
     int64_t nPowTargetSpacing;
     uint32_t nYolandaTime;
+    /** The best chain should have at least this much work */
+    uint256 nMinimumChainWork;
+    /** By default assume that the signatures in ancestors of this block are valid */
+    uint256 defaultAssumeValid;
     
 };
 } // namespace Consensus
@@ -2454,52 +2454,38 @@ void CDarksendPool::UpdatedBlockTip(const CBlockIndex *pindex)
 }
 
 // Popchain DevTeam
-void ThreadCheckDarkSendPool()
+void CheckDarkSendPool()
 {
-    if(fLiteMode) return; // disable all Pop specific functionality
+    static unsigned int nTick = 0;
+    static unsigned int nDoAutoNextRun = nTick + PRIVATESEND_AUTO_TIMEOUT_MIN;
 
-    static bool fOneThread;
-    if(fOneThread) return;
-    fOneThread = true;
+    // try to sync from all available nodes, one step at a time
+    popnodeSync.ProcessTick();
 
-    // Make this thread recognisable as the PrivateSend thread
-    RenameThread("pop-privatesend");
+    if(popnodeSync.IsBlockchainSynced() && !ShutdownRequested()) {
 
-    unsigned int nTick = 0;
-    unsigned int nDoAutoNextRun = nTick + PRIVATESEND_AUTO_TIMEOUT_MIN;
+        nTick++;
 
-    while (true)
-    {
-        MilliSleep(1000);
-
-        // try to sync from all available nodes, one step at a time
-        popnodeSync.ProcessTick();
-
-        if(popnodeSync.IsBlockchainSynced() && !ShutdownRequested()) {
-
-            nTick++;
+        // make sure to check all popnodes first
+        mnodeman.Check();
 
-            // make sure to check all popnodes first
-            mnodeman.Check();
+        // check if we should activate or ping every few minutes,
+        // slightly postpone first run to give net thread a chance to connect to some peers
+        if(nTick % POPNODE_MIN_MNP_SECONDS == 15)
+            activePopnode.ManageState();
 
-            // check if we should activate or ping every few minutes,
-            // slightly postpone first run to give net thread a chance to connect to some peers
-            if(nTick % POPNODE_MIN_MNP_SECONDS == 15)
-                activePopnode.ManageState();
-
-            if(nTick % 60 == 0) {
-                mnodeman.ProcessPopnodeConnections();
-                mnodeman.CheckAndRemove();
-                instantsend.CheckAndRemove();
-            }
+        if(nTick % 60 == 0) {
+            mnodeman.ProcessPopnodeConnections();
+            mnodeman.CheckAndRemove();
+            instantsend.CheckAndRemove();
+        }
 
-            darkSendPool.CheckTimeout();
-            darkSendPool.CheckForCompleteQueue();
+        darkSendPool.CheckTimeout();
+        darkSendPool.CheckForCompleteQueue();
 
-            if(nDoAutoNextRun == nTick) {
-                darkSendPool.DoAutomaticDenominating();
-                nDoAutoNextRun = nTick + PRIVATESEND_AUTO_TIMEOUT_MIN + GetRandInt(PRIVATESEND_AUTO_TIMEOUT_MAX - PRIVATESEND_AUTO_TIMEOUT_MIN);
-            }
+        if(nDoAutoNextRun == nTick) {
+            darkSendPool.DoAutomaticDenominating();
+            nDoAutoNextRun = nTick + PRIVATESEND_AUTO_TIMEOUT_MIN + GetRandInt(PRIVATESEND_AUTO_TIMEOUT_MAX - PRIVATESEND_AUTO_TIMEOUT_MIN);
         }
     }
 }
@@ -476,6 +476,7 @@ public:
     void UpdatedBlockTip(const CBlockIndex *pindex);
 };
 
-void ThreadCheckDarkSendPool();
+/// Popnode sync, popnode list and PrivateSend maintenance, run every second by the scheduler
+void CheckDarkSendPool();
 
 #endif
@@ -4,8 +4,14 @@
 
 #include "util.h"
 #include "random.h"
+#include "sync.h"
+
+#include <set>
+#include <sstream>
+#include <stdio.h>
 
 #include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
@@ -27,14 +33,121 @@ void HandleError(const leveldb::Status& status) throw(dbwrapper_error)
     throw dbwrapper_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+/**
+ * leveldb::Cache that forwards to another cache and counts how the database
+ * owning it uses it. Block lookups are keyed by table cache ids obtained
+ * from NewId(), so any number of these can share one underlying cache.
+ */
+class CDBBlockCache : public leveldb::Cache
+{
+private:
+    leveldb::Cache* pbase;
+    bool fOwnsBase;
+
+public:
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+    std::atomic<uint64_t> nInserts;
+    std::atomic<uint64_t> nInsertedBytes;
+
+    CDBBlockCache(leveldb::Cache* pbaseIn, bool fOwnsBaseIn) : pbase(pbaseIn), fOwnsBase(fOwnsBaseIn), nHits(0), nMisses(0), nInserts(0), nInsertedBytes(0) {}
+
+    ~CDBBlockCache()
+    {
+        if (fOwnsBase)
+            delete pbase;
+    }
+
+    bool IsShared() const { return !fOwnsBase; }
+
+    Handle* Insert(const leveldb::Slice& key, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value))
+    {
+        nInserts++;
+        nInsertedBytes += charge;
+        return pbase->Insert(key, value, charge, deleter);
+    }
+
+    Handle* Lookup(const leveldb::Slice& key)
+    {
+        Handle* handle = pbase->Lookup(key);
+        if (handle)
+            nHits++;
+        else
+            nMisses++;
+        return handle;
+    }
+
+    void Release(Handle* handle) { pbase->Release(handle); }
+    void* Value(Handle* handle) { return pbase->Value(handle); }
+    void Erase(const leveldb::Slice& key) { pbase->Erase(key); }
+    uint64_t NewId() { return pbase->NewId(); }
+};
+
+// Never freed, so it outlives every database regardless of shutdown order.
+static leveldb::Cache* pSharedBlockCache = NULL;
+
+static CCriticalSection cs_dbwrappers;
+static std::set<const CDBWrapper*> setDBWrappers;
+
+void InitSharedDBCache(size_t nSize)
+{
+    if (pSharedBlockCache)
+        return;
+    pSharedBlockCache = leveldb::NewLRUCache(nSize);
+    LogPrintf("Using a shared %.1fMiB LevelDB block cache\n", nSize * (1.0 / 1024 / 1024));
+}
+
+void GetDBStats(std::vector<CDBStats>& vStats)
+{
+    LOCK(cs_dbwrappers);
+    vStats.clear();
+    vStats.reserve(setDBWrappers.size());
+    BOOST_FOREACH(const CDBWrapper* pdbwrapper, setDBWrappers) {
+        vStats.push_back(CDBStats());
+        pdbwrapper->GetStats(vStats.back());
+    }
+}
+
+/** Apply -dboption=<name>.<option>=<value> overrides to dbOptions */
+static void ApplyDBOptionOverrides(CDBOptions& dbOptions)
+{
+    if (!mapMultiArgs.count("-dboption"))
+        return;
+    const std::string strPrefix = dbOptions.strName + ".";
+    BOOST_FOREACH(const std::string& strOption, mapMultiArgs["-dboption"]) {
+        if (strOption.compare(0, strPrefix.size(), strPrefix) != 0)
+            continue;
+        size_t nEquals = strOption.find('=');
+        if (nEquals == std::string::npos) {
+            LogPrintf("Ignoring malformed -dboption=%s\n", strOption);
+            continue;
+        }
+        std::string strKey = strOption.substr(strPrefix.size(), nEquals - strPrefix.size());
+        int64_t nValue = atoi64(strOption.substr(nEquals + 1));
+        if (strKey == "cache")
+            dbOptions.nCacheSize = std::max<int64_t>(nValue, 0) << 20;
+        else if (strKey == "maxopenfiles")
+            dbOptions.nMaxOpenFiles = std::max<int64_t>(nValue, 20);
+        else if (strKey == "bloombits")
+            dbOptions.nBloomBits = std::max<int64_t>(nValue, 0);
+        else if (strKey == "compression")
+            dbOptions.fCompression = nValue != 0;
+        else
+            LogPrintf("Ignoring unknown -dboption=%s\n", strOption);
+    }
+}
+
+static leveldb::Options GetOptions(const CDBOptions& dbOptions, bool fSharedCache)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    if (fSharedCache)
+        options.block_cache = new CDBBlockCache(pSharedBlockCache, false);
+    else
+        options.block_cache = new CDBBlockCache(leveldb::NewLRUCache(dbOptions.nCacheSize / 2), true);
+    options.write_buffer_size = dbOptions.nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    options.filter_policy = dbOptions.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(dbOptions.nBloomBits) : NULL;
+    options.compression = dbOptions.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = dbOptions.nMaxOpenFiles;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -45,12 +158,33 @@ static leveldb::Options GetOptions(size_t nCacheSize)
 
 CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
 {
+    Open(path, CDBOptions(path.filename().string(), nCacheSize), fMemory, fWipe, obfuscate);
+}
+
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, const CDBOptions& dbOptions, bool fMemory, bool fWipe, bool obfuscate)
+{
+    Open(path, dbOptions, fMemory, fWipe, obfuscate);
+}
+
+void CDBWrapper::Open(const boost::filesystem::path& path, const CDBOptions& dbOptionsIn, bool fMemory, bool fWipe, bool obfuscate)
+{
+    CDBOptions dbOptions(dbOptionsIn);
+    ApplyDBOptionOverrides(dbOptions);
+    strName = dbOptions.strName;
+    strPath = fMemory ? "" : path.string();
+    nCacheSize = dbOptions.nCacheSize;
+    nWrites = 0;
+    nWriteMicros = 0;
+    nWriteStalls = 0;
+
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    // in-memory databases keep a private cache so they never evict blocks of the on-disk ones
+    options = GetOptions(dbOptions, pSharedBlockCache && !fMemory);
+    pblockcache = static_cast<CDBBlockCache*>(options.block_cache);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -86,10 +220,17 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
     }
 
     LogPrintf("Using obfuscation key for %s: %s\n", path.string(), GetObfuscateKeyHex());
+
+    LOCK(cs_dbwrappers);
+    setDBWrappers.insert(this);
 }
 
 CDBWrapper::~CDBWrapper()
 {
+    {
+        LOCK(cs_dbwrappers);
+        setDBWrappers.erase(this);
+    }
     delete pdb;
     pdb = NULL;
     delete options.filter_policy;
@@ -102,7 +243,14 @@ CDBWrapper::~CDBWrapper()
 
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync) throw(dbwrapper_error)
 {
+    int64_t nStart = GetTimeMicros();
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
+    int64_t nElapsed = GetTimeMicros() - nStart;
+    nWrites++;
+    nWriteMicros += nElapsed;
+    // sync writes wait for the disk, so only count the others as stalled on compaction
+    if (!fSync && nElapsed > DB_WRITE_STALL_MICROS)
+        nWriteStalls++;
     HandleError(status);
     return true;
 }
@@ -144,6 +292,37 @@ std::string CDBWrapper::GetObfuscateKeyHex() const
     return HexStr(obfuscate_key);
 }
 
+void CDBWrapper::GetStats(CDBStats& stats) const
+{
+    stats.strName = strName;
+    stats.strPath = strPath;
+    stats.nCacheSize = nCacheSize;
+    stats.fSharedCache = pblockcache->IsShared();
+    stats.nCacheHits = pblockcache->nHits;
+    stats.nCacheMisses = pblockcache->nMisses;
+    stats.nCacheInserts = pblockcache->nInserts;
+    stats.nCacheInsertedBytes = pblockcache->nInsertedBytes;
+    stats.nWrites = nWrites;
+    stats.nWriteMicros = nWriteMicros;
+    stats.nWriteStalls = nWriteStalls;
+    stats.vLevels.clear();
+
+    // "leveldb.stats" is a table with a three line header followed by one
+    // row per non-empty level: level, files, size, and compaction time,
+    // read and write totals.
+    std::string strStats;
+    if (!pdb->GetProperty("leveldb.stats", &strStats))
+        return;
+    std::istringstream iss(strStats);
+    std::string strLine;
+    while (std::getline(iss, strLine)) {
+        CDBLevelStats level;
+        if (sscanf(strLine.c_str(), "%d %d %lf %lf %lf %lf", &level.nLevel, &level.nFiles, &level.dSizeMB,
+                   &level.dCompactionSeconds, &level.dReadMB, &level.dWriteMB) == 6)
+            stats.vLevels.push_back(level);
+    }
+}
+
 CDBIterator::~CDBIterator() { delete piter; }
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
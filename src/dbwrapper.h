@@ -10,6 +10,8 @@
 #include "utilstrencodings.h"
 #include "version.h"
 
+#include <atomic>
+
 #include <boost/filesystem/path.hpp>
 
 #include <leveldb/db.h>
@@ -23,6 +25,65 @@ public:
 
 void HandleError(const leveldb::Status& status) throw(dbwrapper_error);
 
+/** Default for -dbsharedcache */
+static const bool DEFAULT_DB_SHARED_CACHE = true;
+/** Non-sync writes taking longer than this are counted as write stalls */
+static const int64_t DB_WRITE_STALL_MICROS = 50 * 1000;
+
+/** LevelDB tuning for a single database. Can be overridden per database with -dboption. */
+struct CDBOptions
+{
+    //! name under which the database is reported and configured
+    std::string strName;
+    //! bytes budgeted for the database, half block cache and a quarter per write buffer
+    size_t nCacheSize;
+    int nMaxOpenFiles;
+    int nBloomBits;
+    bool fCompression;
+
+    CDBOptions(const std::string& strNameIn, size_t nCacheSizeIn)
+        : strName(strNameIn), nCacheSize(nCacheSizeIn), nMaxOpenFiles(64), nBloomBits(10), fCompression(false) {}
+};
+
+/** Compaction statistics for one LevelDB level */
+struct CDBLevelStats
+{
+    int nLevel;
+    int nFiles;
+    double dSizeMB;
+    double dCompactionSeconds;
+    double dReadMB;
+    double dWriteMB;
+};
+
+/** Snapshot of the counters and internal state of a CDBWrapper */
+struct CDBStats
+{
+    std::string strName;
+    std::string strPath;
+    size_t nCacheSize;
+    bool fSharedCache;
+    uint64_t nCacheHits;
+    uint64_t nCacheMisses;
+    uint64_t nCacheInserts;
+    uint64_t nCacheInsertedBytes;
+    uint64_t nWrites;
+    uint64_t nWriteMicros;
+    uint64_t nWriteStalls;
+    std::vector<CDBLevelStats> vLevels;
+};
+
+/**
+ * Create one LevelDB block cache of nSize bytes that is shared by every
+ * database opened afterwards. A single LRU lets the cache follow the load:
+ * whichever database is being read most keeps the most blocks resident,
+ * instead of each database being limited to a fixed slice of -dbcache.
+ */
+void InitSharedDBCache(size_t nSize);
+
+/** Collect statistics of all open databases */
+void GetDBStats(std::vector<CDBStats>& vStats);
+
 /** Batch of changes queued to be written to a CDBWrapper */
 class CDBBatch
 {
@@ -55,6 +116,18 @@ public:
         batch.Put(slKey, slValue);
     }
 
+    /** Write an already serialized key and value, e.g. when copying entries between databases */
+    void WriteBytes(const std::vector<unsigned char>& key, const std::vector<unsigned char>& value)
+    {
+        leveldb::Slice slKey((const char*)begin_ptr(key), key.size());
+
+        CDataStream ssValue(value, SER_DISK, CLIENT_VERSION);
+        ssValue.Xor(*obfuscate_key);
+        leveldb::Slice slValue(&ssValue[0], ssValue.size());
+
+        batch.Put(slKey, slValue);
+    }
+
     template <typename K>
     void Erase(const K& key)
     {
@@ -65,6 +138,14 @@ public:
 
         batch.Delete(slKey);
     }
+
+    /** Erase an already serialized key */
+    void EraseBytes(const std::vector<unsigned char>& key)
+    {
+        leveldb::Slice slKey((const char*)begin_ptr(key), key.size());
+
+        batch.Delete(slKey);
+    }
 };
 
 class CDBIterator
@@ -128,8 +209,24 @@ public:
         return piter->value().size();
     }
 
+    /** The serialized key of the current entry */
+    std::vector<unsigned char> GetKeyBytes() {
+        leveldb::Slice slKey = piter->key();
+        return std::vector<unsigned char>(slKey.data(), slKey.data() + slKey.size());
+    }
+
+    /** The serialized value of the current entry, with the obfuscation removed */
+    std::vector<unsigned char> GetValueBytes() {
+        leveldb::Slice slValue = piter->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue.Xor(*obfuscate_key);
+        return std::vector<unsigned char>(ssValue.begin(), ssValue.end());
+    }
+
 };
 
+class CDBBlockCache;
+
 class CDBWrapper
 {
 private:
@@ -154,6 +251,18 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    //! name and location reported in statistics
+    std::string strName;
+    std::string strPath;
+    size_t nCacheSize;
+
+    //! counting wrapper around the block cache in options.block_cache
+    CDBBlockCache* pblockcache;
+
+    std::atomic<uint64_t> nWrites;
+    std::atomic<uint64_t> nWriteMicros;
+    std::atomic<uint64_t> nWriteStalls;
+
     //! a key used for optional XOR-obfuscation of the database
     std::vector<unsigned char> obfuscate_key;
 
@@ -165,6 +274,8 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
+    void Open(const boost::filesystem::path& path, const CDBOptions& dbOptions, bool fMemory, bool fWipe, bool obfuscate);
+
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
@@ -175,6 +286,7 @@ public:
      *                        with a zero'd byte array.
      */
     CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const boost::filesystem::path& path, const CDBOptions& dbOptions, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -272,6 +384,12 @@ public:
      */
     std::string GetObfuscateKeyHex() const;
 
+    /**
+     * Fill stats with the cache and write counters and the per-level
+     * compaction statistics reported by LevelDB.
+     */
+    void GetStats(CDBStats& stats) const;
+
 };
 
 #endif // BITCOIN_DBWRAPPER_H
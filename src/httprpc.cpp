@@ -187,7 +187,7 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 
         // array of requests
         } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
+            strReply = JSONRPCExecBatch(valRequest.get_array(), &QueueHTTPWork);
         else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
@@ -59,6 +59,23 @@ private:
     HTTPRequestHandler func;
 };
 
+/** Work item running an arbitrary function on an HTTP worker thread */
+class HTTPFunctionItem : public HTTPClosure
+{
+public:
+    HTTPFunctionItem(const boost::function<void(void)>& func):
+        func(func)
+    {
+    }
+    void operator()()
+    {
+        func();
+    }
+
+private:
+    boost::function<void(void)> func;
+};
+
 /** Simple work queue for distributing work over multiple threads.
  * Work items are simply callable objects.
  */
@@ -113,7 +130,7 @@ public:
     bool Enqueue(WorkItem* item)
     {
         boost::unique_lock<boost::mutex> lock(cs);
-        if (queue.size() >= maxDepth) {
+        if (!running || queue.size() >= maxDepth) {
             return false;
         }
         queue.push_back(item);
@@ -455,6 +472,30 @@ bool StartHTTPServer()
     return true;
 }
 
+std::string urlDecode(const std::string &urlEncoded)
+{
+    std::string res;
+    if (!urlEncoded.empty()) {
+        char *decoded = evhttp_uridecode(urlEncoded.c_str(), false, NULL);
+        if (decoded) {
+            res = std::string(decoded);
+            free(decoded);
+        }
+    }
+    return res;
+}
+
+bool QueueHTTPWork(const boost::function<void(void)>& func)
+{
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPFunctionItem> item(new HTTPFunctionItem(func));
+    if (!workQueue->Enqueue(item.get()))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
+}
+
 void InterruptHTTPServer()
 {
     LogPrint("http", "Interrupting HTTP server\n");
@@ -482,6 +523,7 @@ void StopHTTPServer()
         workQueue->WaitExit();
 #endif        
         delete workQueue;
+        workQueue = 0;
     }
     if (eventBase) {
         LogPrint("http", "Waiting for HTTP event thread to exit\n");
@@ -42,6 +42,15 @@ void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPR
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
+/** Run func on one of the HTTP worker threads, sharing the -rpcworkqueue
+ * depth with incoming requests. Returns false if the queue is full or the
+ * server is not running; the caller must then run func itself.
+ */
+bool QueueHTTPWork(const boost::function<void(void)>& func);
+
+/** Decode a %-escaped URI component */
+std::string urlDecode(const std::string &urlEncoded);
+
 /** Return evhttp event base. This can be used by submodules to
  * queue timers or custom events.
  */
@@ -0,0 +1,381 @@
+// Copyright (c) 2017-2018 The Popchain Core Developers
+
+#include "indexwriter.h"
+
+#include "chainparams.h"
+#include "init.h"
+#include "txdb.h"
+#include "ui_interface.h"
+#include "undo.h"
+#include "util.h"
+#include "script/standard.h"
+
+#include <algorithm>
+#include <deque>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+/** Protects the queue and the writer statistics */
+static boost::mutex cs_indexwriter;
+/** Signalled when a delta is queued */
+static boost::condition_variable condIndexQueued;
+/** Signalled when a batch has been committed (or failed) */
+static boost::condition_variable condIndexWritten;
+static std::deque<CIndexDelta> queueIndexDeltas;
+static CIndexWriterStats indexWriterStats = { uint256(), -1, 0, 0, 0, false };
+static bool fIndexWriterFailed = false;
+/** Set once the writer thread is interrupted; it may already be gone, so nobody waits for it any more */
+static bool fIndexWriterStopping = false;
+/** Held while a batch is taken off the queue and written, so batches reach the database in queue order */
+static boost::mutex cs_indexcommit;
+static boost::thread threadIndexWriter;
+
+void CIndexDelta::swap(CIndexDelta& other)
+{
+    std::swap(hashTip, other.hashTip);
+    std::swap(nTipHeight, other.nTipHeight);
+    std::swap(fConnect, other.fConnect);
+    vAddressIndex.swap(other.vAddressIndex);
+    vAddressUnspentIndex.swap(other.vAddressUnspentIndex);
+    vSpentIndex.swap(other.vSpentIndex);
+    vTimestampIndex.swap(other.vTimestampIndex);
+    vBlockIndex.swap(other.vBlockIndex);
+    vBlockFiles.swap(other.vBlockFiles);
+    std::swap(nLastBlockFile, other.nLastBlockFile);
+}
+
+bool CIndexDelta::IsEmpty() const
+{
+    return vAddressIndex.empty() && vAddressUnspentIndex.empty() && vSpentIndex.empty() && vTimestampIndex.empty();
+}
+
+void BuildIndexDelta(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockundo, bool fConnect, CIndexDelta& delta)
+{
+    assert(blockundo.vtxundo.size() + 1 == block.vtx.size());
+
+    delta.fConnect = fConnect;
+    if (fConnect) {
+        delta.hashTip = pindex->GetBlockHash();
+        delta.nTipHeight = pindex->nHeight;
+    } else {
+        delta.hashTip = pindex->pprev->GetBlockHash();
+        delta.nTipHeight = pindex->nHeight - 1;
+    }
+
+    if (fConnect) {
+        for (unsigned int i = 0; i < block.vtx.size(); i++) {
+            const CTransaction &tx = block.vtx[i];
+            const uint256 txhash = tx.GetHash();
+
+            if (i > 0 && (fAddressIndex || fSpentIndex)) {
+                const CTxUndo &txundo = blockundo.vtxundo[i-1];
+                for (size_t j = 0; j < tx.vin.size(); j++) {
+                    const CTxIn &input = tx.vin[j];
+                    const CTxOut &prevout = txundo.vprevout[j].txout;
+                    uint160 hashBytes;
+                    int addressType = 0;
+                    if (DecodeAddressHash(prevout.scriptPubKey, hashBytes, addressType)) {
+                        if (fAddressIndex && addressType > 0) {
+                            // record spending activity
+                            delta.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, j, true), prevout.nValue * -1));
+
+                            // remove address from unspent index
+                            delta.vAddressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
+                        }
+                    }
+                    if (fSpentIndex) {
+                        // add the spent index to determine the txid and input that spent an output
+                        // and to find the amount and address from an input
+                        delta.vSpentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue(txhash, j, pindex->nHeight, prevout.nValue, addressType, hashBytes)));
+                    }
+                }
+            }
+
+            if (fAddressIndex) {
+                for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                    const CTxOut &out = tx.vout[k];
+                    uint160 hashBytes;
+                    int addressType;
+                    if (DecodeAddressHash(out.scriptPubKey, hashBytes, addressType)) {
+                        // record receiving activity
+                        delta.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, k, false), out.nValue));
+
+                        // record unspent output
+                        delta.vAddressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
+                    }
+                }
+            }
+        }
+
+        if (fTimestampIndex)
+            delta.vTimestampIndex.push_back(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash()));
+        return;
+    }
+
+    // undo transactions in reverse order
+    for (int i = block.vtx.size() - 1; i >= 0; i--) {
+        const CTransaction &tx = block.vtx[i];
+        const uint256 txhash = tx.GetHash();
+
+        if (fAddressIndex) {
+            for (unsigned int k = tx.vout.size(); k-- > 0;) {
+                const CTxOut &out = tx.vout[k];
+                uint160 hashBytes;
+                int addressType;
+                if (DecodeAddressHash(out.scriptPubKey, hashBytes, addressType)) {
+                    // undo receiving activity
+                    delta.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, k, false), out.nValue));
+
+                    // undo unspent index
+                    delta.vAddressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, txhash, k), CAddressUnspentValue()));
+                }
+            }
+        }
+
+        if (i == 0)
+            continue;
+
+        const CTxUndo &txundo = blockundo.vtxundo[i-1];
+        for (unsigned int j = tx.vin.size(); j-- > 0;) {
+            const CTxIn &input = tx.vin[j];
+            const CTxInUndo &undo = txundo.vprevout[j];
+
+            if (fSpentIndex) {
+                // undo and delete the spent index
+                delta.vSpentIndex.push_back(std::make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue()));
+            }
+
+            if (fAddressIndex) {
+                const CTxOut &prevout = undo.txout;
+                uint160 hashBytes;
+                int addressType;
+                if (DecodeAddressHash(prevout.scriptPubKey, hashBytes, addressType)) {
+                    // undo spending activity
+                    delta.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, j, true), prevout.nValue * -1));
+
+                    // restore unspent index
+                    delta.vAddressUnspentIndex.push_back(std::make_pair(CAddressUnspentKey(addressType, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight)));
+                }
+            }
+        }
+    }
+}
+
+/** Take up to nMaxDeltas deltas off the queue and commit them in one batch */
+static bool CommitIndexDeltas(unsigned int nMaxDeltas)
+{
+    boost::unique_lock<boost::mutex> lockCommit(cs_indexcommit);
+    std::vector<CIndexDelta> vDeltas;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_indexwriter);
+        if (fIndexWriterFailed)
+            return false;
+        vDeltas.reserve(std::min((size_t)nMaxDeltas, queueIndexDeltas.size()));
+        while (!queueIndexDeltas.empty() && vDeltas.size() < nMaxDeltas) {
+            vDeltas.push_back(CIndexDelta());
+            vDeltas.back().swap(queueIndexDeltas.front());
+            queueIndexDeltas.pop_front();
+        }
+        indexWriterStats.nQueued = queueIndexDeltas.size();
+    }
+    if (vDeltas.empty())
+        return true;
+
+    int64_t nStart = GetTimeMicros();
+    bool fOk = false;
+    try {
+        fOk = pblocktree->WriteIndexDeltas(vDeltas);
+    } catch (const std::runtime_error& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    LogPrint("bench", "    - Index batch: %u blocks in %.2fms\n", vDeltas.size(), 0.001 * (GetTimeMicros() - nStart));
+
+    {
+        boost::unique_lock<boost::mutex> lock(cs_indexwriter);
+        if (fOk) {
+            indexWriterStats.hashTip = vDeltas.back().hashTip;
+            indexWriterStats.nTipHeight = vDeltas.back().nTipHeight;
+            indexWriterStats.nBatches++;
+            indexWriterStats.nDeltasWritten += vDeltas.size();
+        } else {
+            fIndexWriterFailed = true;
+        }
+    }
+    condIndexWritten.notify_all();
+    return fOk;
+}
+
+static void AbortIndexWriter()
+{
+    LogPrintf("*** %s\n", "Failed to write address, spent or timestamp index");
+    uiInterface.ThreadSafeMessageBox(_("Error: A fatal internal error occurred, see debug.log for details"), "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+}
+
+static void ThreadIndexWriter()
+{
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(cs_indexwriter);
+            while (queueIndexDeltas.empty())
+                condIndexQueued.wait(lock);
+        }
+        // Deltas queued while a batch is being written pile up, so under load
+        // batches grow towards MAX_INDEX_WRITER_BATCH on their own.
+        if (!CommitIndexDeltas(MAX_INDEX_WRITER_BATCH)) {
+            AbortIndexWriter();
+            return;
+        }
+    }
+}
+
+void QueueIndexDelta(CIndexDelta& delta)
+{
+    // Called from ConnectBlock/DisconnectBlock, which must not be torn apart by an interrupt
+    boost::this_thread::disable_interruption di;
+    bool fCommitNow;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_indexwriter);
+        while (indexWriterStats.fRunning && !fIndexWriterStopping && !fIndexWriterFailed && queueIndexDeltas.size() >= MAX_INDEX_WRITER_QUEUE)
+            condIndexWritten.wait(lock);
+        queueIndexDeltas.push_back(CIndexDelta());
+        queueIndexDeltas.back().swap(delta);
+        indexWriterStats.nQueued = queueIndexDeltas.size();
+        fCommitNow = (!indexWriterStats.fRunning || fIndexWriterStopping) && queueIndexDeltas.size() >= MAX_INDEX_WRITER_QUEUE;
+    }
+    condIndexQueued.notify_one();
+    // Without a running writer (startup, shutdown) keep memory bounded by writing inline
+    if (fCommitNow && !FlushIndexWriter())
+        AbortIndexWriter();
+}
+
+bool FlushIndexWriter()
+{
+    while (true) {
+        if (!CommitIndexDeltas(MAX_INDEX_WRITER_BATCH))
+            return false;
+        boost::unique_lock<boost::mutex> lock(cs_indexwriter);
+        if (queueIndexDeltas.empty())
+            return true;
+    }
+}
+
+static void SetIndexWriterTip(const CBlockIndex* pindex)
+{
+    boost::unique_lock<boost::mutex> lock(cs_indexwriter);
+    indexWriterStats.hashTip = pindex->GetBlockHash();
+    indexWriterStats.nTipHeight = pindex->nHeight;
+}
+
+static bool ReadBlockAndUndo(const CBlockIndex* pindex, const Consensus::Params& consensusParams, CBlock& block, CBlockUndo& blockundo)
+{
+    if (!ReadBlockFromDisk(block, pindex, consensusParams))
+        return false;
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull() || pindex->pprev == NULL)
+        return false;
+    return UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash());
+}
+
+bool CatchUpIndexes(const CChainParams& chainparams)
+{
+    AssertLockHeld(cs_main);
+    CBlockIndex* pindexChainTip = chainActive.Tip();
+    if ((!fAddressIndex && !fSpentIndex && !fTimestampIndex) || pindexChainTip == NULL)
+        return true;
+
+    uint256 hashIndexTip;
+    if (!pblocktree->ReadIndexTip(hashIndexTip)) {
+        // Indexes written before the background writer existed were kept in step with the chain state
+        LogPrintf("%s: no index tip recorded, assuming indexes are at %s\n", __func__, pindexChainTip->GetBlockHash().ToString());
+        SetIndexWriterTip(pindexChainTip);
+        return pblocktree->WriteIndexTip(pindexChainTip->GetBlockHash());
+    }
+
+    BlockMap::iterator mi = mapBlockIndex.find(hashIndexTip);
+    // Every delta commits its block's index entry with it, so this means the databases disagree
+    if (mi == mapBlockIndex.end())
+        return error("%s: index tip %s is not in the block index, restart with -reindex", __func__, hashIndexTip.ToString());
+
+    CBlockIndex* pindexIndex = mi->second;
+    const CBlockIndex* pindexFork = chainActive.FindFork(pindexIndex);
+    if (pindexFork == NULL)
+        return error("%s: index tip %s does not share history with the active chain", __func__, hashIndexTip.ToString());
+    SetIndexWriterTip(pindexIndex);
+    if (pindexIndex == pindexChainTip)
+        return true;
+
+    int nDisconnected = 0, nConnected = 0;
+    // Undo blocks the indexes saw but the chain state did not keep
+    while (pindexIndex != pindexFork) {
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockAndUndo(pindexIndex, chainparams.GetConsensus(), block, blockundo))
+            return error("%s: cannot read block or undo data of %s, restart with -reindex", __func__, pindexIndex->GetBlockHash().ToString());
+        CIndexDelta delta;
+        BuildIndexDelta(block, pindexIndex, blockundo, false, delta);
+        QueueIndexDelta(delta);
+        pindexIndex = pindexIndex->pprev;
+        nDisconnected++;
+    }
+    // Replay blocks connected after the last index commit
+    for (CBlockIndex* pindex = chainActive.Next(pindexFork); pindex != NULL; pindex = chainActive.Next(pindex)) {
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockAndUndo(pindex, chainparams.GetConsensus(), block, blockundo))
+            return error("%s: cannot read block or undo data of %s, restart with -reindex", __func__, pindex->GetBlockHash().ToString());
+        CIndexDelta delta;
+        BuildIndexDelta(block, pindex, blockundo, true, delta);
+        QueueIndexDelta(delta);
+        nConnected++;
+    }
+    if (!FlushIndexWriter())
+        return error("%s: failed to write indexes", __func__);
+    LogPrintf("%s: indexes caught up to height %d (%d blocks undone, %d replayed)\n", __func__, pindexChainTip->nHeight, nDisconnected, nConnected);
+    return true;
+}
+
+void StartIndexWriter()
+{
+    boost::unique_lock<boost::mutex> lock(cs_indexwriter);
+    if (indexWriterStats.fRunning)
+        return;
+    indexWriterStats.fRunning = true;
+    fIndexWriterStopping = false;
+    threadIndexWriter = boost::thread(boost::bind(&TraceThread<void (*)()>, "indexwriter", &ThreadIndexWriter));
+}
+
+void InterruptIndexWriter()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_indexwriter);
+        fIndexWriterStopping = true;
+    }
+    // Wake anyone waiting for room in the queue; they write inline from now on
+    condIndexWritten.notify_all();
+    threadIndexWriter.interrupt();
+}
+
+void StopIndexWriter()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs_indexwriter);
+        if (!indexWriterStats.fRunning)
+            return;
+    }
+    threadIndexWriter.interrupt();
+    threadIndexWriter.join();
+    {
+        boost::unique_lock<boost::mutex> lock(cs_indexwriter);
+        indexWriterStats.fRunning = false;
+    }
+    // Anything still queued is written by the final FlushStateToDisk
+    condIndexWritten.notify_all();
+}
+
+void GetIndexWriterStats(CIndexWriterStats& stats)
+{
+    boost::unique_lock<boost::mutex> lock(cs_indexwriter);
+    stats = indexWriterStats;
+}
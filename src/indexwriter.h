@@ -0,0 +1,81 @@
+// Copyright (c) 2017-2018 The Popchain Core Developers
+
+/**
+ * Background writer for the address, spent and timestamp indexes.
+ *
+ * ConnectBlock and DisconnectBlock only compute the index changes of a block
+ * (a CIndexDelta) and queue them; a dedicated thread commits queued deltas to
+ * the block tree database in large batches together with the hash of the
+ * block the indexes now reflect (the index tip). Readers may briefly see the
+ * indexes lag the active chain; FlushStateToDisk drains the queue before the
+ * block index is written, and CatchUpIndexes repairs any gap left by a crash.
+ *
+ * A connect delta also carries the block's own index entry and block file
+ * info, committed in the same batch, so the index tip is always a block the
+ * block index knows about. After a crash CatchUpIndexes can then undo index
+ * entries for blocks beyond the chain state tip using their undo data.
+ */
+#ifndef BITCOIN_INDEXWRITER_H
+#define BITCOIN_INDEXWRITER_H
+
+#include "main.h"
+#include "spentindex.h"
+
+#include <utility>
+#include <vector>
+
+/** Maximum number of queued block deltas before ConnectBlock waits for the writer */
+static const unsigned int MAX_INDEX_WRITER_QUEUE = 2048;
+/** Maximum number of block deltas committed in one database batch */
+static const unsigned int MAX_INDEX_WRITER_BATCH = 256;
+
+/** Address, spent and timestamp index changes from connecting or disconnecting one block */
+struct CIndexDelta
+{
+    //! The index tip once this delta is applied: the block itself, or its parent when disconnecting
+    uint256 hashTip;
+    int nTipHeight;
+    bool fConnect;
+    //! Written when connecting, erased when disconnecting
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    //! Null values are erased, everything else is written
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpentIndex;
+    std::vector<CTimestampIndexKey> vTimestampIndex;
+    //! Block index entry and block file state of the connected block, written with the index records
+    std::vector<CDiskBlockIndex> vBlockIndex;
+    std::vector<std::pair<int, CBlockFileInfo> > vBlockFiles;
+    int nLastBlockFile;
+
+    CIndexDelta() : nTipHeight(-1), fConnect(true), nLastBlockFile(-1) {}
+
+    void swap(CIndexDelta& other);
+    bool IsEmpty() const;
+};
+
+struct CIndexWriterStats
+{
+    uint256 hashTip;
+    int nTipHeight;
+    size_t nQueued;
+    uint64_t nBatches;
+    uint64_t nDeltasWritten;
+    bool fRunning;
+};
+
+/** Compute the index changes of connecting (or disconnecting) block at pindex, given its undo data */
+void BuildIndexDelta(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockundo, bool fConnect, CIndexDelta& delta);
+
+/** Hand a delta to the writer; its contents are taken. Blocks while the queue is full. */
+void QueueIndexDelta(CIndexDelta& delta);
+/** Commit every queued delta from the calling thread. Returns false if a database write failed. */
+bool FlushIndexWriter();
+/** Bring the on-disk indexes in line with chainActive after a restart. Call with cs_main held. */
+bool CatchUpIndexes(const CChainParams& chainparams);
+
+void StartIndexWriter();
+void InterruptIndexWriter();
+void StopIndexWriter();
+void GetIndexWriterStats(CIndexWriterStats& stats);
+
+#endif // BITCOIN_INDEXWRITER_H
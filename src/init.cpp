@@ -11,11 +11,14 @@
 #include "amount.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "chainstatesnapshot.h"
 #include "checkpoints.h"
+#include "coinswriter.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "indexwriter.h"
 #include "key.h"
 #include "main.h"
 #include "miner.h"
@@ -115,6 +118,8 @@ enum BindFlags {
 };
 
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
+/** How often the fee estimates are checkpointed to disk, in seconds */
+static const int64_t FEE_ESTIMATES_FLUSH_INTERVAL = 15 * 60;
 CClientUIInterface uiInterface; // Declared but not defined in ui_interface.h
 
 //////////////////////////////////////////////////////////////////////////////
@@ -189,9 +194,36 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    InterruptIndexWriter();
+    if (pcoinswriter)
+        pcoinswriter->Interrupt();
     threadGroup.interrupt_all();
 }
 
+// Write the fee estimates next to the old file and move them over it, so
+// a crash in the middle of a checkpoint leaves the previous one intact
+static void FlushFeeEstimates()
+{
+    static CCriticalSection cs_feeEstimates;
+    LOCK(cs_feeEstimates);
+    if (!fFeeEstimatesInitialized)
+        return;
+
+    boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
+    boost::filesystem::path est_path_new = GetDataDir() / (std::string(FEE_ESTIMATES_FILENAME) + ".new");
+    CAutoFile est_fileout(fopen(est_path_new.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (est_fileout.IsNull()) {
+        LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path_new.string());
+        return;
+    }
+    bool fWritten = mempool.WriteFeeEstimates(est_fileout);
+    if (fWritten)
+        FileCommit(est_fileout.Get());
+    est_fileout.fclose();
+    if (fWritten && !RenameOver(est_path_new, est_path))
+        LogPrintf("%s: Failed to rename fee estimates to %s\n", __func__, est_path.string());
+}
+
 /** Preparing steps before shutting down or restarting the wallet */
 void PrepareShutdown()
 {
@@ -230,24 +262,27 @@ void PrepareShutdown()
 
     if (fFeeEstimatesInitialized)
     {
-        boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
-        CAutoFile est_fileout(fopen(est_path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
-        if (!est_fileout.IsNull())
-            mempool.WriteFeeEstimates(est_fileout);
-        else
-            LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path.string());
+        FlushFeeEstimates();
         fFeeEstimatesInitialized = false;
     }
 
+    // Whatever the index writer has not committed yet is written by FlushStateToDisk
+    StopIndexWriter();
+
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
         }
+        // Waits for the coin writer to commit everything handed to it
+        if (pcoinswriter != NULL)
+            pcoinswriter->Stop();
         delete pcoinsTip;
         pcoinsTip = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
+        delete pcoinswriter;
+        pcoinswriter = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
@@ -373,6 +408,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)"), Params(CBaseChainParams::MAIN).GetConsensus().defaultAssumeValid.GetHex(), Params(CBaseChainParams::TESTNET).GetConsensus().defaultAssumeValid.GetHex()));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -387,7 +423,14 @@ std::string HelpMessage(HelpMessageMode mode)
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dboption=<db>.<option>=<n>", _("Override a LevelDB option of one database (blockindex, chainstate or claimtrie); options are cache (MiB), maxopenfiles, bloombits and compression (0/1). Can be specified multiple times"));
+    strUsage += HelpMessageOpt("-dbsharedcache", strprintf(_("Share one LevelDB block cache between all databases instead of giving each a fixed part of -dbcache (default: %u)"), DEFAULT_DB_SHARED_CACHE));
+    strUsage += HelpMessageOpt("-dbwritebatch=<n>", strprintf(_("Hand modified coins to the background database writer once <n> transactions have changed, 0 to only write on the usual flushes (default: %u)"), DEFAULT_COINS_WRITE_BATCH));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadchainstate=<file>", _("Bootstrap a new data directory from a chainstate snapshot written by dumpchainstate. "
+            "Blocks up to the snapshot are not downloaded; only use snapshots from a source you trust"));
+    strUsage += HelpMessageOpt("-loadchainstatehash=<hash>", _("Coin set hash (hash_serialized of dumpchainstate or gettxoutsetinfo) the snapshot given by -loadchainstate must have; required"));
+    strUsage += HelpMessageOpt("-loadchainstateclaimroot=<hash>", _("Claim trie root the snapshot must have if its block header does not commit to one"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
@@ -494,6 +537,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtxlock=<address>", _("Enable publish raw transaction (locked via InstantSend) in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubclaimtrie=<address>", _("Enable publish claim trie changes of each block in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubrawuncles=<address>", _("Enable publish raw uncle headers included by each block in <address>"));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
@@ -539,7 +584,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (0 to %d, default: %u)", MAX_MAX_SIG_CACHE_SIZE, DEFAULT_MAX_SIG_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
         CURRENCY_UNIT, FormatMoney(DEFAULT_MIN_RELAY_TX_FEE)));
@@ -1015,6 +1060,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
+    hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
+    if (!hashAssumeValid.IsNull())
+        LogPrintf("Assuming ancestors of block %s have valid signatures.\n", hashAssumeValid.GetHex());
+    else
+        LogPrintf("Validating signatures for all blocks.\n");
+
     // mempool limits
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     int64_t nMempoolSizeMin = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000 * 40;
@@ -1201,10 +1252,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
+    InitSignatureCache();
+
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadCoinsPrefetch);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadBlockCheck);
     }
 
     if (mapArgs.count("-sporkkey")) // spork priv key
@@ -1213,9 +1270,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             return InitError(_("Unable to sign spork message, wrong key?"));
     }
 
-    // Start the lightweight task scheduler thread
+    // Start the lightweight task scheduler threads; several, so that a slow
+    // task (DNS seeding, popnode maintenance) does not hold up the others
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    for (int i = 0; i < SCHEDULER_THREADS; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1438,8 +1497,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greated than nMaxDbcache
     int64_t nBlockTreeDBCache = nTotalCache / 8;
-    if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", DEFAULT_TXINDEX))
-        nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
+    bool fBlockTreeIndexes = GetBoolArg("-txindex", DEFAULT_TXINDEX) || GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) ||
+                             GetBoolArg("-spentindex", DEFAULT_SPENTINDEX) || GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
+    if (nBlockTreeDBCache > (1 << 21) && !fBlockTreeIndexes)
+        nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB without any of the indexes it holds
     nTotalCache -= nBlockTreeDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
@@ -1448,6 +1509,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+    nCoinsWriteBatch = std::max((int64_t)0, GetArg("-dbwritebatch", DEFAULT_COINS_WRITE_BATCH));
+    // Pool the block caches of the databases so the busiest one can use
+    // whatever the others leave idle.
+    if (GetBoolArg("-dbsharedcache", DEFAULT_DB_SHARED_CACHE))
+        InitSharedDBCache((nBlockTreeDBCache + nCoinDBCache) / 2);
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1461,14 +1527,18 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
-                delete pcoinsdbview;
                 delete pcoinscatcher;
+                delete pcoinswriter;
+                delete pcoinsdbview;
                 delete pblocktree;
 				delete pclaimTrie;  // claim opt
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                pcoinswriter = new CCoinsViewWriter(pcoinsdbview);
+                // Queued coins count against -dbcache together with the cache itself
+                pcoinswriter->SetMaxQueuedUsage(nCoinCacheUsage / 2);
+                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinswriter);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 				pclaimTrie = new CClaimTrie(false, fReindex); // claim
 
@@ -1513,6 +1583,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                if (mapArgs.count("-loadchainstate")) {
+                    if (chainActive.Height() == 0) {
+                        uiInterface.InitMessage(_("Loading chainstate snapshot..."));
+                        CChainstateSnapshotInfo info;
+                        std::string strError;
+                        uint256 hashCoins = uint256S(GetArg("-loadchainstatehash", ""));
+                        uint256 hashClaimTrie = uint256S(GetArg("-loadchainstateclaimroot", ""));
+                        if (!LoadChainstateSnapshot(GetArg("-loadchainstate", ""), hashCoins, hashClaimTrie, chainparams, pcoinsdbview, info, strError)) {
+                            strLoadError = strprintf(_("Error loading chainstate snapshot: %s"), strError);
+                            break;
+                        }
+                    } else {
+                        LogPrintf("Ignoring -loadchainstate: the block database is not empty\n");
+                    }
+                }
+
                 uiInterface.InitMessage(_("Verifying blocks..."));
                 if (fHavePruned && GetArg("-checkblocks", DEFAULT_CHECKBLOCKS) > MIN_BLOCKS_TO_KEEP) {
                     LogPrintf("Prune: pruned datadir may not have more than %d blocks; -checkblocks=%d may fail\n",
@@ -1530,6 +1616,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     }
                 }
 
+                {
+                    LOCK(cs_main);
+                    if (!CatchUpIndexes(chainparams)) {
+                        strLoadError = _("Error catching up address, spent and timestamp indexes");
+                        break;
+                    }
+                }
+
                 if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
                               GetArg("-checkblocks", DEFAULT_CHECKBLOCKS))) {
                     strLoadError = _("Corrupted block database detected");
@@ -1579,6 +1673,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (!est_filein.IsNull())
         mempool.ReadFeeEstimates(est_filein);
     fFeeEstimatesInitialized = true;
+    // Checkpoint them while running too, so an unclean exit loses little history
+    scheduler.scheduleEvery(&FlushFeeEstimates, FEE_ESTIMATES_FLUSH_INTERVAL, "feeestimates");
 
     // ********************************************************* Step 8: load wallet
 #ifdef ENABLE_WALLET
@@ -1695,7 +1791,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             //We can't rescan beyond non-pruned blocks, stop and throw an error
             //this might happen if a user uses a old wallet within a pruned node
             // or if he ran -disablewallet for a longer time, then decided to re-enable
-            if (fPruneMode)
+            if (fPruneMode || fHaveSnapshotChain)
             {
                 CBlockIndex *block = chainActive.Tip();
                 while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA) && block->pprev->nTx > 0 && pindexRescan != block)
@@ -1748,6 +1844,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // if pruning, unset the service bit and perform the initial blockstore prune
     // after any wallet rescanning has taken place.
+    if (fHaveSnapshotChain && !fPruneMode) {
+        LogPrintf("Unsetting NODE_NETWORK, blocks below the chainstate snapshot are not available\n");
+        nLocalServices &= ~NODE_NETWORK;
+    }
     if (fPruneMode) {
         LogPrintf("Unsetting NODE_NETWORK on prune mode\n");
         nLocalServices &= ~NODE_NETWORK;
@@ -1763,6 +1863,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         uiInterface.NotifyBlockTip.connect(BlockNotifyCallback);
 
     
+    StartIndexWriter();
+    pcoinswriter->Start();
+
     uiInterface.InitMessage(_(std::string("Activating " + Params().NetworkIDString() + " chain...").c_str()));
     // scan for better chains in the block chain database, that are not yet connected in the active best chain
     CValidationState state;
@@ -1890,9 +1993,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     darkSendPool.UpdatedBlockTip(chainActive.Tip());
     popnodeSync.UpdatedBlockTip(chainActive.Tip());
 
-    // ********************************************************* Step 11d: start pop-privatesend thread
+    // ********************************************************* Step 11d: schedule pop-privatesend maintenance
 
-    threadGroup.create_thread(boost::bind(&ThreadCheckDarkSendPool));
+    if (!fLiteMode)
+        scheduler.scheduleEvery(&CheckDarkSendPool, 1, "privatesend");
 
     // ********************************************************* Step 12: start node
 
@@ -1919,7 +2023,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     StartNode(threadGroup, scheduler);
 
 	/*popchain ghost*/
-	threadGroup.create_thread(boost::bind(&ThreadProcFutureBlocks));
+	scheduler.scheduleEvery(&ProcessFutureBlocks, 15, "futureblocks");
 	/*popchain ghost*/
 
     // Monitor the chain, and alert if we get blocks much quicker or slower than expected
@@ -167,7 +167,7 @@ void CInstantSend::Vote(CTxLockCandidate& txLockCandidate)
 
         int nLockInputHeight = nPrevoutHeight + 4;
 
-        int n = mnodeman.GetPopnodeRank(activePopnode.vin, nLockInputHeight, MIN_INSTANTSEND_PROTO_VERSION);
+        int n = GetPopnodeRank(activePopnode.vin.prevout, nLockInputHeight);
 
         if(n == -1) {
             LogPrint("instantsend", "CInstantSend::Vote -- Unknown Popnode %s\n", activePopnode.vin.prevout.ToStringShort());
@@ -767,9 +767,34 @@ void CInstantSend::Relay(const uint256& txHash)
     }
 }
 
+int CInstantSend::GetPopnodeRank(const COutPoint& outpointPopnode, int nLockInputHeight)
+{
+    // Every input of every lock request asks for the rank of each voter at the
+    // input's height, which means scoring and sorting the whole popnode list.
+    // The lock is not held while ranking so it never nests inside mnodeman's.
+    std::pair<int, COutPoint> key = std::make_pair(nLockInputHeight, outpointPopnode);
+    {
+        LOCK(cs_popnoderanks);
+        std::map<std::pair<int, COutPoint>, int>::iterator it = mapPopnodeRanks.find(key);
+        if(it != mapPopnodeRanks.end()) return it->second;
+    }
+
+    int nRank = mnodeman.GetPopnodeRank(CTxIn(outpointPopnode), nLockInputHeight, MIN_INSTANTSEND_PROTO_VERSION);
+    // unknown popnodes may show up in the list later, don't remember them
+    if(nRank != -1) {
+        LOCK(cs_popnoderanks);
+        mapPopnodeRanks[key] = nRank;
+    }
+    return nRank;
+}
+
 void CInstantSend::UpdatedBlockTip(const CBlockIndex *pindex)
 {
     pCurrentBlockIndex = pindex;
+
+    // The popnode list is checked and pruned as blocks arrive, start over
+    LOCK(cs_popnoderanks);
+    mapPopnodeRanks.clear();
 }
 
 void CInstantSend::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
@@ -870,20 +895,23 @@ bool CTxLockRequest::IsValid(bool fRequireUnspent) const
             // Normally above sould be enough, but in case we are reprocessing this because of
             // a lot of legit orphan votes we should also check already spent outpoints.
             if(fRequireUnspent) return false;
-            CTransaction txOutpointCreated;
-            uint256 nHashOutpointConfirmed;
-            if(!GetTransaction(txin.prevout.hash, txOutpointCreated, Params().GetConsensus(), nHashOutpointConfirmed, true) || nHashOutpointConfirmed == uint256()) {
-                LogPrint("instantsend", "txLockRequest::IsValid -- Failed to find outpoint %s\n", txin.prevout.ToStringShort());
-                return false;
-            }
-            LOCK(cs_main);
-            BlockMap::iterator mi = mapBlockIndex.find(nHashOutpointConfirmed);
-            if(mi == mapBlockIndex.end()) {
-                // not on this chain?
-                LogPrint("instantsend", "txLockRequest::IsValid -- Failed to find block %s for outpoint %s\n", nHashOutpointConfirmed.ToString(), txin.prevout.ToStringShort());
-                return false;
+            // Outpoints spent in recent blocks are remembered; older ones need the creating transaction
+            if(!GetSpentOutPointHeight(txin.prevout, nPrevoutHeight)) {
+                CTransaction txOutpointCreated;
+                uint256 nHashOutpointConfirmed;
+                if(!GetTransaction(txin.prevout.hash, txOutpointCreated, Params().GetConsensus(), nHashOutpointConfirmed, true) || nHashOutpointConfirmed == uint256()) {
+                    LogPrint("instantsend", "txLockRequest::IsValid -- Failed to find outpoint %s\n", txin.prevout.ToStringShort());
+                    return false;
+                }
+                LOCK(cs_main);
+                BlockMap::iterator mi = mapBlockIndex.find(nHashOutpointConfirmed);
+                if(mi == mapBlockIndex.end()) {
+                    // not on this chain?
+                    LogPrint("instantsend", "txLockRequest::IsValid -- Failed to find block %s for outpoint %s\n", nHashOutpointConfirmed.ToString(), txin.prevout.ToStringShort());
+                    return false;
+                }
+                nPrevoutHeight = mi->second ? mi->second->nHeight : 0;
             }
-            nPrevoutHeight = mi->second ? mi->second->nHeight : 0;
         }
 
         int nTxAge = chainActive.Height() - (nPrevoutHeight ? nPrevoutHeight : coins.nHeight) + 1;
@@ -945,25 +973,28 @@ bool CTxLockVote::IsValid(CNode* pnode) const
         LogPrint("instantsend", "CTxLockVote::IsValid -- Failed to find UTXO %s\n", outpoint.ToStringShort());
         // Validating utxo set is not enough, votes can arrive after outpoint was already spent,
         // if lock request was mined. We should process them too to count them later if they are legit.
-        CTransaction txOutpointCreated;
-        uint256 nHashOutpointConfirmed;
-        if(!GetTransaction(outpoint.hash, txOutpointCreated, Params().GetConsensus(), nHashOutpointConfirmed, true) || nHashOutpointConfirmed == uint256()) {
-            LogPrint("instantsend", "CTxLockVote::IsValid -- Failed to find outpoint %s\n", outpoint.ToStringShort());
-            return false;
-        }
-        LOCK(cs_main);
-        BlockMap::iterator mi = mapBlockIndex.find(nHashOutpointConfirmed);
-        if(mi == mapBlockIndex.end() || !mi->second) {
-            // not on this chain?
-            LogPrint("instantsend", "CTxLockVote::IsValid -- Failed to find block %s for outpoint %s\n", nHashOutpointConfirmed.ToString(), outpoint.ToStringShort());
-            return false;
+        // Outpoints spent in recent blocks are remembered; older ones need the creating transaction
+        if(!GetSpentOutPointHeight(outpoint, nPrevoutHeight)) {
+            CTransaction txOutpointCreated;
+            uint256 nHashOutpointConfirmed;
+            if(!GetTransaction(outpoint.hash, txOutpointCreated, Params().GetConsensus(), nHashOutpointConfirmed, true) || nHashOutpointConfirmed == uint256()) {
+                LogPrint("instantsend", "CTxLockVote::IsValid -- Failed to find outpoint %s\n", outpoint.ToStringShort());
+                return false;
+            }
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(nHashOutpointConfirmed);
+            if(mi == mapBlockIndex.end() || !mi->second) {
+                // not on this chain?
+                LogPrint("instantsend", "CTxLockVote::IsValid -- Failed to find block %s for outpoint %s\n", nHashOutpointConfirmed.ToString(), outpoint.ToStringShort());
+                return false;
+            }
+            nPrevoutHeight = mi->second->nHeight;
         }
-        nPrevoutHeight = mi->second->nHeight;
     }
 
     int nLockInputHeight = nPrevoutHeight + 4;
 
-    int n = mnodeman.GetPopnodeRank(CTxIn(outpointPopnode), nLockInputHeight, MIN_INSTANTSEND_PROTO_VERSION);
+    int n = instantsend.GetPopnodeRank(outpointPopnode, nLockInputHeight);
 
     if(n == -1) {
         //can be caused by past versions trying to vote with an invalid protocol
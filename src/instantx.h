@@ -54,6 +54,10 @@ private:
     //track popnodes who voted with no txreq (for DOS protection)
     std::map<COutPoint, int64_t> mapPopnodeOrphanVotes; // mn outpoint - time
 
+    // popnode ranks used for InstantSend voting, dropped on every new tip
+    std::map<std::pair<int, COutPoint>, int> mapPopnodeRanks; // (lock input height, mn outpoint) - rank
+    CCriticalSection cs_popnoderanks;
+
     bool CreateTxLockCandidate(const CTxLockRequest& txLockRequest);
     void Vote(CTxLockCandidate& txLockCandidate);
 
@@ -88,6 +92,9 @@ public:
 
     bool GetTxLockVote(const uint256& hash, CTxLockVote& txLockVoteRet);
 
+    // rank of a popnode among those allowed to vote on inputs at nLockInputHeight, -1 if unknown
+    int GetPopnodeRank(const COutPoint& outpointPopnode, int nLockInputHeight);
+
     bool GetLockedOutPointTxHash(const COutPoint& outpoint, uint256& hashRet);
 
     // verify if transaction is currently locked
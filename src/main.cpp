@@ -9,10 +9,12 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinswriter.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
 #include "hash.h"
+#include "indexwriter.h"
 #include "init.h"
 #include "merkleblock.h"
 #include "net.h"
@@ -33,6 +35,7 @@
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
 #include "validationinterface.h"
+#include "validationstats.h"
 #include "versionbits.h"
 
 #include "darksend.h"
@@ -45,6 +48,7 @@
 #include "superblock.h"
 /*popchain ghost*/
 
+#include <deque>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -94,13 +98,16 @@ bool fAddressIndex = false;
 bool fTimestampIndex = false;
 bool fSpentIndex = false;
 bool fHavePruned = false;
+bool fHaveSnapshotChain = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 unsigned int nBytesPerSigOp = DEFAULT_BYTES_PER_SIGOP;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+uint256 hashAssumeValid;
 size_t nCoinCacheUsage = 5000 * 300;
+size_t nCoinsWriteBatch = DEFAULT_COINS_WRITE_BATCH;
 uint64_t nPruneTarget = 0;
 bool fAlerts = DEFAULT_ALERTS;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
@@ -623,6 +630,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewWriter *pcoinswriter = NULL;
 CClaimTrie *pclaimTrie = NULL; // claim operation
 CBlockTreeDB *pblocktree = NULL;
 
@@ -644,7 +652,7 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(c
     // have been mined or received.
     // 10,000 orphans, each of which is at most 5,000 bytes big is
     // at most 500 megabytes of orphans:
-    unsigned int sz = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
+    unsigned int sz = tx.GetTotalSize();
     if (sz > 5000)
     {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
@@ -957,6 +965,68 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
     return nSigOps;
 }
 
+/** Blocks for which the creation heights of the outpoints they spent are kept */
+static const int SPENT_HEIGHT_WINDOW = 100;
+
+namespace {
+    CCriticalSection cs_spentheights;
+    /** Recently spent outpoint -> (height it was created at, height it was spent at) */
+    std::map<COutPoint, std::pair<int, int> > mapSpentHeights;
+    /** Outpoints spent by each recently connected block, oldest first, for eviction */
+    std::deque<std::pair<int, std::vector<COutPoint> > > dqSpentHeights;
+} // anon namespace
+
+/**
+ * Remember the creation heights of the outpoints a block spends. They are
+ * taken from the coins at spend time: undo data only carries the height
+ * when the spend emptied the transaction's coins.
+ */
+static void RecordSpentHeights(const std::vector<std::pair<COutPoint, int> >& vSpentHeights, int nHeight)
+{
+    LOCK(cs_spentheights);
+    dqSpentHeights.push_back(std::make_pair(nHeight, std::vector<COutPoint>()));
+    std::vector<COutPoint>& vSpent = dqSpentHeights.back().second;
+    vSpent.reserve(vSpentHeights.size());
+    for (size_t i = 0; i < vSpentHeights.size(); i++) {
+        mapSpentHeights[vSpentHeights[i].first] = std::make_pair(vSpentHeights[i].second, nHeight);
+        vSpent.push_back(vSpentHeights[i].first);
+    }
+    while (!dqSpentHeights.empty() && dqSpentHeights.front().first <= nHeight - SPENT_HEIGHT_WINDOW) {
+        BOOST_FOREACH(const COutPoint& outpoint, dqSpentHeights.front().second) {
+            std::map<COutPoint, std::pair<int, int> >::iterator it = mapSpentHeights.find(outpoint);
+            // A reorg may have spent it again in a later block
+            if (it != mapSpentHeights.end() && it->second.second == dqSpentHeights.front().first)
+                mapSpentHeights.erase(it);
+        }
+        dqSpentHeights.pop_front();
+    }
+}
+
+/** Drop what a block recorded once it is disconnected; its inputs are unspent again */
+static void ForgetSpentHeights(const CBlock& block, int nHeight)
+{
+    LOCK(cs_spentheights);
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        BOOST_FOREACH(const CTxIn& txin, block.vtx[i].vin) {
+            std::map<COutPoint, std::pair<int, int> >::iterator it = mapSpentHeights.find(txin.prevout);
+            if (it != mapSpentHeights.end() && it->second.second == nHeight)
+                mapSpentHeights.erase(it);
+        }
+    }
+    if (!dqSpentHeights.empty() && dqSpentHeights.back().first == nHeight)
+        dqSpentHeights.pop_back();
+}
+
+bool GetSpentOutPointHeight(const COutPoint& outpoint, int& nHeightRet)
+{
+    LOCK(cs_spentheights);
+    std::map<COutPoint, std::pair<int, int> >::const_iterator it = mapSpentHeights.find(outpoint);
+    if (it == mapSpentHeights.end())
+        return false;
+    nHeightRet = it->second.first;
+    return true;
+}
+
 int GetUTXOHeight(const COutPoint& outpoint)
 {
     LOCK(cs_main);
@@ -1017,7 +1087,7 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state)
     if (tx.vout.empty())
         return state.DoS(10, false, REJECT_INVALID, "bad-txns-vout-empty");
     // Size limits
-    if (::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) > MAX_BLOCK_SIZE)
+    if (tx.GetTotalSize() > MAX_BLOCK_SIZE)
         return state.DoS(100, false, REJECT_INVALID, "bad-txns-oversize");
 
     // Check for negative or overflow output values
@@ -1615,8 +1685,8 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
 {
     CBlockIndex *pindexSlow = NULL;
 
-    LOCK(cs_main);
-
+    // Only the coins lookup needs cs_main; the mempool has its own lock and the
+    // transaction index and block files are safe to read from any thread
     if (mempool.lookup(hash, txOut))
     {
         return true;
@@ -1644,6 +1714,7 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     }
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
+        LOCK(cs_main);
         int nHeight = -1;
         {
             CCoinsViewCache &view = *pcoinsTip;
@@ -1702,7 +1773,7 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+static bool ReadBlockRecord(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
@@ -1718,6 +1789,13 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    if (!ReadBlockRecord(block, pos))
+        return false;
 
     // Check the header
 	/*popchain ghost*/
@@ -1729,11 +1807,19 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    if (!ReadBlockRecord(block, pindex->GetBlockPos()))
         return false;
-    if (block.GetHash() != pindex->GetBlockHash())
+    // The index holds the header that passed proof of work when the block was
+    // accepted. A record with the same header has the same hash, so it needs
+    // no CryptoPop evaluation; only a differing header is hashed to compare.
+    if (SerializeHash(block.GetBlockHeader()) != SerializeHash(pindex->GetBlockHeader()) &&
+        block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
                 pindex->ToString(), pindex->GetBlockPos().ToString());
+    // The transactions are covered by the merkle root
+    if (BlockMerkleRoot(block) != block.hashMerkleRoot)
+        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): merkle root doesn't match for %s at %s",
+                pindex->ToString(), pindex->GetBlockPos().ToString());
     return true;
 }
 
@@ -2190,6 +2276,8 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
@@ -2217,6 +2305,8 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -2322,7 +2412,35 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, CClaimTr
     return fClean;
 }
 
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, CClaimTrieCache& trieCache, bool* pfClean)
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, CClaimTrieCache& trieCache, bool* pfClean, CClaimTrieDelta* pdelta)
+{
+    CBlockUndo blockUndo;
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull()) {
+        if (pfClean)
+            *pfClean = false;
+        return error("DisconnectBlock(): no undo data available");
+    }
+    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash())) {
+        if (pfClean)
+            *pfClean = false;
+        return error("DisconnectBlock(): failure reading undo data");
+    }
+
+    bool fClean = DisconnectBlock(block, blockUndo, state, pindex, view, trieCache, pfClean, pdelta);
+    if (pfClean || !fClean)
+        return fClean;
+
+    if (fAddressIndex || fSpentIndex || fTimestampIndex) {
+        CIndexDelta indexDelta;
+        BuildIndexDelta(block, pindex, blockUndo, false, indexDelta);
+        QueueIndexDelta(indexDelta);
+    }
+
+    return true;
+}
+
+bool DisconnectBlock(const CBlock& block, CBlockUndo& blockUndo, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, CClaimTrieCache& trieCache, bool* pfClean, CClaimTrieDelta* pdelta)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
     //assert(pindex->GetBlockHash() == trieCache.getBestBlock());
@@ -2332,46 +2450,18 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
     bool fClean = true;
 
-    CBlockUndo blockUndo;
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull())
-        return error("DisconnectBlock(): no undo data available");
-    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash()))
-        return error("DisconnectBlock(): failure reading undo data");
-
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock(): block and undo data inconsistent");
 
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
-    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
-
     assert(trieCache.decrementBlock(blockUndo.insertUndo, blockUndo.expireUndo, blockUndo.insertSupportUndo, blockUndo.expireSupportUndo, blockUndo.takeoverHeightUndo));
+    if (pdelta)
+        pdelta->addBlockUndo(blockUndo.insertUndo, blockUndo.expireUndo, blockUndo.insertSupportUndo, blockUndo.expireSupportUndo, blockUndo.takeoverHeightUndo);
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
 
-        if (fAddressIndex) {
-
-            for (unsigned int k = tx.vout.size(); k-- > 0;) {
-                const CTxOut &out = tx.vout[k];
-				uint160 hashBytes;
-				int addressType;
-
-				if(DecodeAddressHash(out.scriptPubKey, hashBytes, addressType))
-				{
-					// undo receiving activity
-                    addressIndex.push_back(make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, hash, k, false), out.nValue));
-
-                    // undo unspent index
-                    addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, hashBytes, hash, k), CAddressUnspentValue()));
-				}
-            }
-
-        }
-
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
         {
@@ -2447,29 +2537,6 @@ outs->nVersion = outsBlock.nVersion;
                 const CTxInUndo &undo = txundo.vprevout[j];
                 if (!ApplyTxInUndo(undo, view, trieCache, out))
                     fClean = false;
-
-                const CTxIn input = tx.vin[j];
-
-                if (fSpentIndex) {
-                    // undo and delete the spent index
-                    spentIndex.push_back(make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue()));
-                }
-
-                if (fAddressIndex) {
-                    const CTxOut &prevout = view.GetOutputFor(tx.vin[j]);
-					uint160 hashBytes;
-					int addressType;
-
-					if(DecodeAddressHash(prevout.scriptPubKey, hashBytes, addressType))
-					{
-						// undo spending activity
-                        addressIndex.push_back(make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, hash, j, true), prevout.nValue * -1));
-
-                        // restore unspent index
-                        addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight)));
-					}
-                }
-
             }
         }
     }
@@ -2477,8 +2544,11 @@ outs->nVersion = outsBlock.nVersion;
 
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
+    if (pdelta)
+        trieCache.getControllingClaimChanges(pdelta->setChanged);
     assert(trieCache.finalizeDecrement());
-    //trieCache.setBestBlock(pindex->pprev->GetBlockHash());
+    // The claim trie's best block tells startup which block the trie reflects
+    trieCache.setBestBlock(pindex->pprev->GetBlockHash());
     //assert(trieCache.getMerkleHash() == pindex->pprev->hashClaimTrie);
 
     if (pfClean) {
@@ -2486,15 +2556,6 @@ outs->nVersion = outsBlock.nVersion;
         return true;
     }
 
-    if (fAddressIndex) {
-        if (!pblocktree->EraseAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to delete address index");
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
-        }
-    }
-
     return fClean;
 }
 
@@ -2530,6 +2591,82 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Reads the coins of one transaction from the base of a coins cache into a slot owned by the caller */
+class CCoinsPrefetchCheck
+{
+private:
+    const CCoinsViewCache *view;
+    uint256 txid;
+    CCoins *pcoins;
+    char *pfFound;
+
+public:
+    CCoinsPrefetchCheck() : view(NULL), pcoins(NULL), pfFound(NULL) {}
+    CCoinsPrefetchCheck(const CCoinsViewCache *viewIn, const uint256 &txidIn, CCoins *pcoinsIn, char *pfFoundIn) :
+        view(viewIn), txid(txidIn), pcoins(pcoinsIn), pfFound(pfFoundIn) {}
+
+    bool operator()() {
+        *pfFound = view->GetCoinsFromBase(txid, *pcoins);
+        return true;
+    }
+
+    void swap(CCoinsPrefetchCheck &check) {
+        std::swap(view, check.view);
+        std::swap(txid, check.txid);
+        std::swap(pcoins, check.pcoins);
+        std::swap(pfFound, check.pfFound);
+    }
+};
+
+static CCheckQueue<CCoinsPrefetchCheck> prefetchqueue(16);
+
+void ThreadCoinsPrefetch() {
+    RenameThread("pop-prefetch");
+    prefetchqueue.Thread();
+}
+
+/**
+ * Load the coins spent by block into view before it is connected, reading
+ * the ones that are not cached yet from the coin database on the prefetch
+ * threads. Requires cs_main for the whole call: the base must not change
+ * between the reads and their insertion. Returns the number of coins read.
+ */
+static unsigned int PrefetchBlockCoins(const CBlock& block, CCoinsViewCache& view)
+{
+    AssertLockHeld(cs_main);
+    std::vector<uint256> vTxid;
+    std::set<uint256> setSeen;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (setSeen.insert(txin.prevout.hash).second && !view.HaveCoinsInCache(txin.prevout.hash))
+                    vTxid.push_back(txin.prevout.hash);
+            }
+        }
+        // Later spends of this transaction's outputs are created by the block itself
+        setSeen.insert(tx.GetHash());
+    }
+    if (vTxid.empty())
+        return 0;
+
+    std::vector<CCoins> vCoins(vTxid.size());
+    std::vector<char> vFound(vTxid.size(), 0);
+    std::vector<CCoinsPrefetchCheck> vChecks;
+    vChecks.reserve(vTxid.size());
+    for (unsigned int i = 0; i < vTxid.size(); i++)
+        vChecks.push_back(CCoinsPrefetchCheck(&view, vTxid[i], &vCoins[i], &vFound[i]));
+    {
+        CCheckQueueControl<CCoinsPrefetchCheck> control(&prefetchqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+    for (unsigned int i = 0; i < vTxid.size(); i++) {
+        if (vFound[i])
+            view.AddFromBase(vTxid[i], vCoins[i]);
+    }
+    return vTxid.size();
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -2652,6 +2789,61 @@ bool GetAncestorBlocksFromHash(uint256 hash,int n, std::vector<CBlockIndex*>& vC
 	return false;
 }
 
+/*popchain ghost*/
+static void RecordUncleHashes(CBlockIndex* pindex, const CBlock& block)
+{
+	pindex->vUncleHashes.clear();
+	for(std::vector<CBlockHeader>::const_iterator it = block.vuh.begin(); it != block.vuh.end(); ++it)
+		pindex->vUncleHashes.push_back(it->GetHash());
+	pindex->fHaveUncleHashes = true;
+}
+
+/**
+ * The uncle hashes of pindex. They are recorded when the block is accepted;
+ * blocks loaded from the block index read them from disk the first time
+ * only. A null hashUncles means no uncles, so those are never read.
+ */
+static const std::vector<uint256>* GetUncleHashes(CBlockIndex* pindex, const Consensus::Params& consensusParams)
+{
+	AssertLockHeld(cs_main);
+	if(!pindex->fHaveUncleHashes && !pindex->hashUncles.IsNull()){
+		CBlock block;
+		LogPrint("pop","GetUncleHashes():ReadBlockFromDisk %s \n", pindex->GetBlockHash().ToString());
+		if(!ReadBlockFromDisk(block, pindex, consensusParams))
+			return NULL;
+		RecordUncleHashes(pindex, block);
+	}
+	return &pindex->vUncleHashes;
+}
+
+bool GetBlockUncleHashes(CBlockIndex* pindex, std::vector<uint256>& vUncleHashes)
+{
+	const std::vector<uint256>* pvUncles = GetUncleHashes(pindex, Params().GetConsensus());
+	if(pvUncles == NULL)
+		return false;
+	vUncleHashes = *pvUncles;
+	return true;
+}
+
+/**
+ * The GHOST family of a block built on pindexPrev: the hashes of pindexPrev
+ * and its ancestors within UNCLE_FAMILY_DEPTH blocks, and of the uncles they
+ * already include. Built from the block index without hashing any header.
+ */
+static bool GetFamilyWindow(CBlockIndex* pindexPrev, const Consensus::Params& consensusParams, std::set<uint256>& setAncestors, std::set<uint256>& setUncles)
+{
+	CBlockIndex* pindex = pindexPrev;
+	for(int i = 0; i < UNCLE_FAMILY_DEPTH && pindex != NULL; i++, pindex = pindex->pprev){
+		const std::vector<uint256>* pvUncles = GetUncleHashes(pindex, consensusParams);
+		if(pvUncles == NULL)
+			return false;
+		setUncles.insert(pvUncles->begin(), pvUncles->end());
+		setAncestors.insert(pindex->GetBlockHash());
+	}
+	return true;
+}
+/*popchain ghost*/
+
 bool MakeCurrentCycle(uint256 hash)
 {
 	LogPrint("pop","MakeCurrentCycle \n");
@@ -2660,28 +2852,16 @@ bool MakeCurrentCycle(uint256 hash)
 	if(currentParenthash == hash)
 		return true;
 	const CChainParams& chainparams = Params();
-	std::vector<CBlockIndex*> ancestor;
-	if(!GetAncestorBlocksFromHash(hash,7,ancestor)){
+	BlockMap::iterator mi = mapBlockIndex.find(hash);
+	if(mi == mapBlockIndex.end() || (*mi).second == NULL)
 		return false;
-	}
-	CBlock block;
-	CBlockIndex* pBlockIndex;
-	CBlockHeader blockheader;
-	for(std::vector<CBlockIndex*>::iterator it = ancestor.begin(); it != ancestor.end(); ++it){
-		pBlockIndex = *it;
-		LogPrint("pop","MakeCurrentCycle():ReadBlockFromDisk %s \n", pBlockIndex->GetBlockHash().ToString());
-		if(ReadBlockFromDisk(block, pBlockIndex, chainparams.GetConsensus())){
-			for(std::vector<CBlockHeader>::iterator bi = block.vuh.begin(); bi != block.vuh.end(); ++bi){
-				blockheader = *bi;
-				setCurrentFamily.insert(blockheader.GetHash());
-			}
-			setCurrentFamily.insert(block.GetHash());
-			setCurrentAncestor.insert(block.GetHash());
-		}else {
-			return false;
-		}
-		
-	}	
+	std::set<uint256> setAncestors;
+	std::set<uint256> setUncles;
+	if(!GetFamilyWindow((*mi).second, chainparams.GetConsensus(), setAncestors, setUncles))
+		return false;
+	setCurrentAncestor.insert(setAncestors.begin(), setAncestors.end());
+	setCurrentFamily.insert(setAncestors.begin(), setAncestors.end());
+	setCurrentFamily.insert(setUncles.begin(), setUncles.end());
 	currentParenthash = hash;
 	return true;
 }
@@ -2760,52 +2940,39 @@ void FindBlockUncles(uint256 parenthash,std::vector<CBlock>& vuncles)
 /*popchain ghost*/
 
 /*popchain ghost*/
-void ThreadProcFutureBlocks()
+void ProcessFutureBlocks()
 {
-    static bool fOneThread;
-    if(fOneThread) return;
-    fOneThread = true;
-
-    // Make this thread recognisable as the PrivateSend thread
-    RenameThread("pop-procfutureblocks");
-	static int threadCount = 0;
+	static int nRunCount = 0;
 
 	const CChainParams& chainparams = Params();
 	CValidationState state;
-	
-	lruFutureBlock.purge();
-	
-    while (true)
-    {
-    	MilliSleep(15000);
-		LogPrint("pop","ThreadProcFutureBlocks count %d\n",threadCount);
-		int len = 0;
-		lruFutureBlock.length(len);
-		if(len > 0){
-			std::vector<uint256> key;
-			lruFutureBlock.keys(key);
-			for(int i =0;i<key.size();i++){
-				LogPrintf("ThreadProcFutureBlocks key[%d]: %s\n",i,key[i].ToString());
-				CBlock block= lruFutureBlock.get(key[i]);
-				if(block.nTime < (GetAdjustedTime() + 45)){
-					LogPrintf("%s :ThreadProcFutureBlocks ActivateBestChain block %s doing\n", __func__,block.GetHash().ToString());
-					if (ActivateBestChain(state, chainparams, &block)){
-						popnodeSync.IsBlockchainSynced(true);
-						if(block.hashUncles != uint256()){
-							LogPrint("pop","%s :block %s has uncle \n", __func__,block.GetHash().ToString());
-						}
-						LogPrintf("%s : ActivateBestChain ACCEPTED\n", __func__);
-					}else{
-						LogPrintf("%s : ActivateBestChain failed %s\n",__func__,block.GetHash().ToString());
+
+	LogPrint("pop","ProcessFutureBlocks count %d\n",nRunCount);
+	int len = 0;
+	lruFutureBlock.length(len);
+	if(len > 0){
+		std::vector<uint256> key;
+		lruFutureBlock.keys(key);
+		for(int i =0;i<key.size();i++){
+			LogPrintf("ProcessFutureBlocks key[%d]: %s\n",i,key[i].ToString());
+			CBlock block= lruFutureBlock.get(key[i]);
+			if(block.nTime < (GetAdjustedTime() + 45)){
+				LogPrintf("%s :ProcessFutureBlocks ActivateBestChain block %s doing\n", __func__,block.GetHash().ToString());
+				if (ActivateBestChain(state, chainparams, &block)){
+					popnodeSync.IsBlockchainSynced(true);
+					if(block.hashUncles != uint256()){
+						LogPrint("pop","%s :block %s has uncle \n", __func__,block.GetHash().ToString());
 					}
-					lruFutureBlock.remove(block.GetHash());
-					LogPrintf("%s : lruFutureBlock.remove %s \n", __func__,block.GetHash().ToString());
-				}	
+					LogPrintf("%s : ActivateBestChain ACCEPTED\n", __func__);
+				}else{
+					LogPrintf("%s : ActivateBestChain failed %s\n",__func__,block.GetHash().ToString());
+				}
+				lruFutureBlock.remove(block.GetHash());
+				LogPrintf("%s : lruFutureBlock.remove %s \n", __func__,block.GetHash().ToString());
 			}
 		}
-		threadCount++;
-    }
-
+	}
+	nRunCount++;
 }
 
 /*popchain ghost*/
@@ -2847,7 +3014,7 @@ static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
 // added trieCache arg 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, CClaimTrieCache& trieCache, bool fJustCheck)
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, CClaimTrieCache& trieCache, bool fJustCheck, CClaimTrieDelta* pdelta)
 {
     const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
@@ -2884,6 +3051,22 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             fScriptChecks = false;
         }
     }
+    if (fScriptChecks && !hashAssumeValid.IsNull()) {
+        // We've been configured with the hash of a block whose history has been
+        // verified externally, so skip the signatures of its ancestors. Every other
+        // check, including the UTXO, claim trie, uncle and subsidy ones, still runs.
+        BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+        if (it != mapBlockIndex.end() && pindexBestHeader &&
+            it->second->GetAncestor(pindex->nHeight) == pindex &&
+            pindexBestHeader->GetAncestor(pindex->nHeight) == pindex &&
+            pindexBestHeader->nChainWork >= UintToArith256(chainparams.GetConsensus().nMinimumChainWork)) {
+            // Only skip when the block is buried under two weeks worth of work on
+            // the best header chain, so an invalid block can not be slipped in by
+            // telling users to set -assumevalid to something recent, and the
+            // minimum chain work keeps us from skipping on a chain we were fed.
+            fScriptChecks = (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) <= 60 * 60 * 24 * 7 * 2);
+        }
+    }
 
     int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
     LogPrint("bench", "    - Sanity checks: %.2fms [%.2fs]\n", 0.001 * (nTime1 - nTimeStart), nTimeCheck * 0.000001);
@@ -2963,9 +3146,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
-    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
-    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+    int64_t nVerifyMicros = 0;
+    int64_t nClaimMicros = 0;
+    unsigned int nClaims = 0;
+    std::vector<std::pair<COutPoint, int> > vSpentHeights;
 
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
@@ -2991,6 +3175,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
                 prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                vSpentHeights.push_back(std::make_pair(tx.vin[j].prevout, prevheights[j]));
             }
 
             if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
@@ -2998,33 +3183,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                  REJECT_INVALID, "bad-txns-nonfinal");
             }
 
-            if (fAddressIndex || fSpentIndex)
-            {
-                for (size_t j = 0; j < tx.vin.size(); j++) {
-
-                    const CTxIn input = tx.vin[j];
-                    const CTxOut &prevout = view.GetOutputFor(tx.vin[j]);
-                    uint160 hashBytes;
-                    int addressType;
-					if(DecodeAddressHash(prevout.scriptPubKey, hashBytes, addressType))
-					{
-						if (fAddressIndex && addressType > 0) {
-                        	// record spending activity
-                        	addressIndex.push_back(make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, j, true), prevout.nValue * -1));
-
-                        	// remove address from unspent index
-                        	addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
-                    	}
-					}
-                    if (fSpentIndex) {
-                        // add the spent index to determine the txid and input that spent an output
-                        // and to find the amount and address from an input
-                        spentIndex.push_back(make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue(txhash, j, pindex->nHeight, prevout.nValue, addressType, hashBytes)));
-                    }
-                }
-
-            }
-
             if (fStrictPayToScriptHash)
             {
                 // Add in sigops done by pay-to-script-hash inputs;
@@ -3040,9 +3198,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
+            int64_t nVerifyStart = GetTimeMicros();
             if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, nScriptCheckThreads ? &vChecks : NULL))
                 return error("ConnectBlock(): CheckInputs on %s failed with %s",
                     tx.GetHash().ToString(), FormatStateMessage(state));
+            nVerifyMicros += GetTimeMicros() - nVerifyStart;
             control.Add(vChecks);
 			
 			// To handle claim updates, stick all claims found in the inputs into a map of
@@ -3052,6 +3212,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // If there are two or more claims in the inputs with the same name, only
             // use the first.
 
+            int64_t nClaimStart = GetTimeMicros();
             typedef std::vector<std::pair<std::string, uint160> > spentClaimsType;
             spentClaimsType spentClaims;
 
@@ -3065,6 +3226,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 std::vector<std::vector<unsigned char> > vvchParams;
                 if (DecodeClaimScript(coins->vout[txin.prevout.n].scriptPubKey, op, vvchParams))
                 {   
+                    nClaims++;
                     if (op == OP_CLAIM_NAME || op == OP_UPDATE_CLAIM)
                     {   
                         uint160 claimId;
@@ -3110,6 +3272,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 std::vector<std::vector<unsigned char> > vvchParams;
                 if (DecodeClaimScript(txout.scriptPubKey, op, vvchParams))
                 {
+                    nClaims++;
                     if (op == OP_CLAIM_NAME)
                     {   
                         assert(vvchParams.size() == 2);
@@ -3155,22 +3318,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                     }
                 }
             }
-        }
-
-        if (fAddressIndex) {
-            for (unsigned int k = 0; k < tx.vout.size(); k++) {
-                const CTxOut &out = tx.vout[k];
-				uint160 hashBytes;
-				int addressType;
-				if(DecodeAddressHash(out.scriptPubKey, hashBytes, addressType))
-				{
-					// record receiving activity
-                    addressIndex.push_back(make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, k, false), out.nValue));
-
-                    // record unspent output
-                    addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, hashBytes, txhash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
-				}
-            }
+            nClaimMicros += GetTimeMicros() - nClaimStart;
         }
 
         CTxUndo undoDummy;
@@ -3199,10 +3347,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         // inserted into the trie in the first place.
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        pos.nTxOffset += tx.GetTotalSize();
     }
 
+    int64_t nClaimStart = GetTimeMicros();
     assert(trieCache.incrementBlock(blockundo.insertUndo, blockundo.expireUndo, blockundo.insertSupportUndo, blockundo.expireSupportUndo, blockundo.takeoverHeightUndo));
+    if (pdelta) {
+        pdelta->addBlockUndo(blockundo.insertUndo, blockundo.expireUndo, blockundo.insertSupportUndo, blockundo.expireSupportUndo, blockundo.takeoverHeightUndo);
+        trieCache.getControllingClaimChanges(pdelta->setChanged);
+    }
+    nClaimMicros += GetTimeMicros() - nClaimStart;
 
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
@@ -3228,6 +3382,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
     // END PCH
 
+    int64_t nWaitStart = GetTimeMicros();
     if (!control.Wait())
         return state.DoS(100, false);
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
@@ -3236,6 +3391,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     if (fJustCheck)
         return true;
 
+    nVerifyMicros += nTime4 - nWaitStart;
+    RecordValidationTime(VSTAGE_SCRIPT_VERIFY, nVerifyMicros);
+    RecordValidationTime(VSTAGE_CLAIMTRIE_UPDATE, nClaimMicros);
+    AddValidationCount(VCOUNT_BLOCKS);
+    AddValidationCount(VCOUNT_TRANSACTIONS, block.vtx.size());
+    AddValidationCount(VCOUNT_INPUTS, nInputs);
+    AddValidationCount(VCOUNT_SIGOPS, nSigOps);
+    AddValidationCount(VCOUNT_CLAIMS, nClaims);
+    AddValidationCount(VCOUNT_UNCLES, block.vuh.size());
+
     // Write undo information to disk
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS))
     {
@@ -3259,30 +3424,31 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
-    if (fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to write address index");
-        }
+    // Only blocks extending the tip; VerifyDB reconnects blocks that are already recorded
+    if (pindex->pprev == chainActive.Tip())
+        RecordSpentHeights(vSpentHeights, pindex->nHeight);
 
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
+    // Address, spent and timestamp indexes are committed by the background index writer
+    if (fAddressIndex || fSpentIndex || fTimestampIndex) {
+        CIndexDelta indexDelta;
+        BuildIndexDelta(block, pindex, blockundo, true, indexDelta);
+        {
+            // The index tip must never name a block the on-disk block index lacks
+            LOCK(cs_LastBlockFile);
+            indexDelta.vBlockIndex.push_back(CDiskBlockIndex(pindex));
+            indexDelta.vBlockFiles.push_back(std::make_pair(pindex->nFile, vinfoBlockFile[pindex->nFile]));
+            indexDelta.nLastBlockFile = nLastBlockFile;
         }
+        QueueIndexDelta(indexDelta);
     }
 
-    if (fSpentIndex)
-        if (!pblocktree->UpdateSpentIndex(spentIndex))
-            return AbortNode(state, "Failed to write transaction index");
-
-    if (fTimestampIndex)
-        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash())))
-            return AbortNode(state, "Failed to write timestamp index");
-
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
     trieCache.setBestBlock(pindex->GetBlockHash());
 
     int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime5 - nTime4), nTimeIndex * 0.000001);
+    RecordValidationTime(VSTAGE_INDEX_WRITE, nTime5 - nTime4);
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
@@ -3291,6 +3457,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime6 - nTime5), nTimeCallbacks * 0.000001);
+    RecordValidationTime(VSTAGE_CONNECT_BLOCK, nTime6 - nTimeStart);
 
     return true;
 }
@@ -3339,7 +3506,8 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     if (nLastSetChain == 0) {
         nLastSetChain = nNow;
     }
-    size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    // Sets handed to the coin writer stay in memory until written, so they count against the cache limit too
+    size_t cacheSize = pcoinsTip->DynamicMemoryUsage() + (pcoinswriter ? pcoinswriter->DynamicMemoryUsage() : 0);
     // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
     // The cache is over the limit, we have to write now.
@@ -3348,8 +3516,10 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
     // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
     bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
+    // Enough of the cache has been modified that it is time to hand it to the writer, so one write never gets huge.
+    bool fDirtyLarge = mode != FLUSH_STATE_NONE && nCoinsWriteBatch > 0 && pcoinsTip->GetDirtyCount() > nCoinsWriteBatch;
     // Combine all conditions that result in a full cache flush.
-    bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+    bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune || fDirtyLarge;
     // Write blocks and block index to disk.
     if (fDoFullFlush || fPeriodicWrite) {
         // Depend on nMinDiskSpace to ensure we can write block index
@@ -3357,6 +3527,9 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             return state.Error("out of disk space");
         // First make sure all block and undo data is flushed to disk.
         FlushBlockFile();
+        // Commit queued index deltas so the index tip is covered by the block index written below.
+        if (!FlushIndexWriter())
+            return AbortNode(state, "Failed to write address, spent or timestamp index");
         // Then update all block file information (which may refer to block and undo files).
         {
             std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
@@ -3389,10 +3562,17 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         // overwrite one. Still, use a conservative safety factor of 2.
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
-        if(!pclaimTrie->WriteToDisk())                                                                                                                
+        // The claim trie is written first, so the coin database never gets
+        // ahead of it; if it lags after a crash, startup replays the blocks
+        // in between into the coins (see RollForwardCoins).
+        if(!pclaimTrie->WriteToDisk())
             return AbortNode("Failed to write to claim trie database");
         // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // The coin database itself is written by the background writer.
+        // Only a cache over its limit is emptied; otherwise the modified
+        // entries are handed over and everything stays cached.
+        bool fCoinsOk = (fCacheLarge || fCacheCritical) ? pcoinsTip->Flush() : pcoinsTip->WriteDirty();
+        if (!fCoinsOk)
             return AbortNode(state, "Failed to write to coin database");
         nLastFlush = nNow;
     }
@@ -3476,57 +3656,200 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     }
 }
 
-/** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held. */
-bool static DisconnectTip(CValidationState& state, const Consensus::Params& consensusParams)
+/** Most blocks DisconnectTipsTo is asked to undo at once; bounds the blocks and cache kept in memory */
+static const int MAX_DISCONNECT_BATCH = 64;
+
+/**
+ * Reads blocks and their undo data, in the order given, on a helper thread so
+ * that the disk reads overlap with undoing the blocks read before them.
+ */
+class CDisconnectReadAhead
 {
-    CBlockIndex *pindexDelete = chainActive.Tip();
-    assert(pindexDelete);
-    // Read block from disk.
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete, consensusParams))
-        return AbortNode(state, "Failed to read block");
-    // Apply the block atomically to the chain state.
+public:
+    CDisconnectReadAhead(const std::vector<CBlockIndex*>& vpindexIn, const Consensus::Params& consensusParamsIn) :
+        vpindex(vpindexIn), consensusParams(consensusParamsIn), vBlocks(vpindexIn.size()), vUndo(vpindexIn.size()),
+        vBlockOk(vpindexIn.size(), 0), vUndoOk(vpindexIn.size(), 0), nRead(0), fStop(false)
+    {
+        if (vpindex.size() > 1)
+            thread = boost::thread(boost::bind(&CDisconnectReadAhead::ThreadRead, this));
+        else
+            ThreadRead();
+    }
+
+    ~CDisconnectReadAhead()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
+        }
+        if (thread.joinable())
+            thread.join();
+    }
+
+    /** Wait until entry i is read. Its block and undo data are only valid if the corresponding flag is set. */
+    void Wait(size_t i, bool& fBlockOk, bool& fUndoOk)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nRead <= i)
+            condRead.wait(lock);
+        fBlockOk = vBlockOk[i];
+        fUndoOk = vUndoOk[i];
+    }
+
+    CBlock& GetBlock(size_t i) { return vBlocks[i]; }
+    CBlockUndo& GetUndo(size_t i) { return vUndo[i]; }
+
+private:
+    void ThreadRead()
+    {
+        for (size_t i = 0; i < vpindex.size(); i++) {
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                if (fStop)
+                    return;
+            }
+            const CBlockIndex* pindex = vpindex[i];
+            bool fBlockOk = ReadBlockFromDisk(vBlocks[i], pindex, consensusParams);
+            CDiskBlockPos pos = pindex->GetUndoPos();
+            bool fUndoOk = fBlockOk && !pos.IsNull() && UndoReadFromDisk(vUndo[i], pos, pindex->pprev->GetBlockHash());
+            boost::unique_lock<boost::mutex> lock(cs);
+            vBlockOk[i] = fBlockOk;
+            vUndoOk[i] = fUndoOk;
+            nRead = i + 1;
+            condRead.notify_one();
+        }
+    }
+
+    const std::vector<CBlockIndex*>& vpindex;
+    const Consensus::Params& consensusParams;
+    // Entry i is only touched by the reader until nRead > i
+    std::vector<CBlock> vBlocks;
+    std::vector<CBlockUndo> vUndo;
+    std::vector<char> vBlockOk;
+    std::vector<char> vUndoOk;
+    size_t nRead;
+    bool fStop;
+    boost::mutex cs;
+    boost::condition_variable condRead;
+    boost::thread thread;
+};
+
+/**
+ * Disconnect chainActive's tip blocks down to pindexFork, an ancestor of the
+ * tip. The blocks are undone, tip first, into one coins and claim trie
+ * overlay which is only flushed once they all succeeded, so either all of
+ * them are disconnected or none. The mempool and the wallets are updated once
+ * at the end. If pvDisconnected is given the disconnected blocks are appended
+ * to it, tip first.
+ * You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held.
+ */
+bool static DisconnectTipsTo(CValidationState& state, const Consensus::Params& consensusParams, const CBlockIndex* pindexFork, std::vector<CBlock>* pvDisconnected = NULL)
+{
+    AssertLockHeld(cs_main);
+    std::vector<CBlockIndex*> vpindexDelete;
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex != pindexFork; pindex = pindex->pprev) {
+        assert(pindex);
+        vpindexDelete.push_back(pindex);
+    }
+    if (vpindexDelete.empty())
+        return true;
+    CBlockIndex* pindexNewTip = vpindexDelete.back()->pprev;
+
+    // Read blocks and undo data from disk.
+    CDisconnectReadAhead reader(vpindexDelete, consensusParams);
+    // Apply the blocks atomically to the chain state.
     int64_t nStart = GetTimeMicros();
+    std::vector<CClaimTrieDelta> vTrieDelta;
+    vTrieDelta.reserve(vpindexDelete.size());
     {
         CCoinsViewCache view(pcoinsTip);
         CClaimTrieCache trieCache(pclaimTrie);
-        if (!DisconnectBlock(block, state, pindexDelete, view, trieCache))
-            return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
+        for (size_t i = 0; i < vpindexDelete.size(); i++) {
+            CBlockIndex* pindexDelete = vpindexDelete[i];
+            bool fBlockOk, fUndoOk;
+            reader.Wait(i, fBlockOk, fUndoOk);
+            if (!fBlockOk)
+                return AbortNode(state, "Failed to read block");
+            if (!fUndoOk)
+                return error("DisconnectTipsTo(): failure reading undo data for %s", pindexDelete->GetBlockHash().ToString());
+            vTrieDelta.push_back(CClaimTrieDelta(pindexDelete->GetBlockHash(), pindexDelete->nHeight, false));
+            if (!DisconnectBlock(reader.GetBlock(i), reader.GetUndo(i), state, pindexDelete, view, trieCache, NULL, &vTrieDelta.back()))
+                return error("DisconnectTipsTo(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
+        }
         assert(view.Flush());
         assert(trieCache.flush());
     }
-    LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+    if (fAddressIndex || fSpentIndex || fTimestampIndex) {
+        for (size_t i = 0; i < vpindexDelete.size(); i++) {
+            CIndexDelta indexDelta;
+            BuildIndexDelta(reader.GetBlock(i), vpindexDelete[i], reader.GetUndo(i), false, indexDelta);
+            QueueIndexDelta(indexDelta);
+        }
+    }
+    for (size_t i = 0; i < vpindexDelete.size(); i++)
+        ForgetSpentHeights(reader.GetBlock(i), vpindexDelete[i]->nHeight);
+    LogPrint("bench", "- Disconnect %u blocks: %.2fms\n", vpindexDelete.size(), (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
-    // Resurrect mempool transactions from the disconnected block.
+    // Update chainActive and related variables.
+    UpdateTip(pindexNewTip);
+    // Resurrect mempool transactions from the disconnected blocks, oldest
+    // block first so that parents go back in before their children.
     std::vector<uint256> vHashUpdate;
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-        // ignore validation errors in resurrected transactions
-        list<CTransaction> removed;
-        CValidationState stateDummy;
-        if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, true)) {
-            mempool.remove(tx, removed, true);
-        } else if (mempool.exists(tx.GetHash())) {
-            vHashUpdate.push_back(tx.GetHash());
+    std::vector<CTransaction> vtxResurrect;
+    for (size_t i = vpindexDelete.size(); i-- > 0; ) {
+        BOOST_FOREACH(const CTransaction &tx, reader.GetBlock(i).vtx) {
+            if (!tx.IsCoinBase())
+                vtxResurrect.push_back(tx);
+        }
+    }
+    // ignore validation errors in resurrected transactions
+    std::vector<CValidationState> vStateDummy;
+    std::vector<char> vAccepted, vMissingInputs;
+    AcceptToMemoryPoolBatch(mempool, vtxResurrect, false, true, false, vStateDummy, vAccepted, vMissingInputs);
+    size_t nResurrect = 0;
+    for (size_t i = vpindexDelete.size(); i-- > 0; ) {
+        BOOST_FOREACH(const CTransaction &tx, reader.GetBlock(i).vtx) {
+            list<CTransaction> removed;
+            if (tx.IsCoinBase() || !vAccepted[nResurrect++]) {
+                mempool.remove(tx, removed, true);
+            } else if (mempool.exists(tx.GetHash())) {
+                vHashUpdate.push_back(tx.GetHash());
+            }
         }
     }
     // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
     // no in-mempool children, which is generally not true when adding
     // previously-confirmed transactions back to the mempool.
-    // UpdateTransactionsFromBlock finds descendants of any transactions in this
-    // block that were added back and cleans up the mempool state.
+    // UpdateTransactionsFromBlock finds descendants of any transactions in these
+    // blocks that were added back and cleans up the mempool state.
     mempool.UpdateTransactionsFromBlock(vHashUpdate);
-    // Update chainActive and related variables.
-    UpdateTip(pindexDelete->pprev);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-        SyncWithWallets(tx, NULL);
+    for (size_t i = 0; i < vpindexDelete.size(); i++) {
+        BOOST_FOREACH(const CTransaction &tx, reader.GetBlock(i).vtx) {
+            SyncWithWallets(tx, NULL);
+        }
+        GetMainSignals().ClaimTrieChanged(vTrieDelta[i]);
+    }
+    if (pvDisconnected) {
+        for (size_t i = 0; i < vpindexDelete.size(); i++) {
+            pvDisconnected->push_back(CBlock());
+            std::swap(pvDisconnected->back(), reader.GetBlock(i));
+        }
     }
     return true;
 }
 
+/** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held. */
+bool static DisconnectTip(CValidationState& state, const Consensus::Params& consensusParams)
+{
+    CBlockIndex *pindexDelete = chainActive.Tip();
+    assert(pindexDelete);
+    return DisconnectTipsTo(state, consensusParams, pindexDelete->pprev);
+}
+
 static int64_t nTimeReadFromDisk = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
@@ -3552,10 +3875,18 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    RecordValidationTime(VSTAGE_READ_BLOCK, nTime2 - nTime1);
+    if (nScriptCheckThreads) {
+        unsigned int nPrefetched = PrefetchBlockCoins(*pblock, *pcoinsTip);
+        int64_t nTimePrefetch = GetTimeMicros();
+        LogPrint("bench", "  - Prefetch %u coins: %.2fms\n", nPrefetched, (nTimePrefetch - nTime2) * 0.001);
+        RecordValidationTime(VSTAGE_PREFETCH, nTimePrefetch - nTime2);
+    }
+    CClaimTrieDelta trieDelta(pindexNew->GetBlockHash(), pindexNew->nHeight, true);
     {
         CCoinsViewCache view(pcoinsTip);
         CClaimTrieCache trieCache(pclaimTrie);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, trieCache);
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, trieCache, false, &trieDelta);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -3565,8 +3896,13 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         mapBlockSource.erase(pindexNew->GetBlockHash());
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
+        // Compute the claim trie root here, rather than inside flush(), so it is timed on its own
+        trieCache.getMerkleHash();
+        int64_t nTimeRoot = GetTimeMicros();
+        RecordValidationTime(VSTAGE_CLAIMTRIE_ROOT, nTimeRoot - nTime3);
         assert(view.Flush());
         assert(trieCache.flush());
+        RecordValidationTime(VSTAGE_FLUSH, GetTimeMicros() - nTimeRoot);
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -3575,6 +3911,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
+    RecordValidationTime(VSTAGE_CHAINSTATE, nTime5 - nTime4);
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
@@ -3589,10 +3926,16 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
         SyncWithWallets(tx, pblock);
     }
+    // ... and about name and uncle changes made by the block
+    GetMainSignals().ClaimTrieChanged(trieDelta);
+    if (!pblock->vuh.empty())
+        GetMainSignals().NotifyUncles(pindexNew, pblock->vuh);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+    RecordValidationTime(VSTAGE_CALLBACKS, nTime6 - nTime5);
+    RecordValidationTime(VSTAGE_CONNECT_TIP, nTime6 - nTime1);
     return true;
 }
 
@@ -3724,21 +4067,17 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
     // Disconnect active blocks which are no longer in the best chain.
     bool fBlocksDisconnected = false;
 	/*popchain ghost*/
-	uint256 possibleBlockHash;
-	CBlock possibleBlock;
-	CBlockIndex *pindexPossibleBlock;
+	bool fKeepPossibleUncles = (GetBoolArg("-gen", false) || fRpcMining) && pblock != NULL;
 	/*popchain ghost*/
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-		/*popchain ghost*/
-        if ((GetBoolArg("-gen", false) || fRpcMining) && pblock != NULL)
-             pindexPossibleBlock = chainActive.Tip();
-		/*popchain ghost*/
-        if (!DisconnectTip(state, chainparams.GetConsensus()))
+        // Undo the blocks in batches, each flushed to the chain state at once.
+        int nStopHeight = std::max(pindexFork ? pindexFork->nHeight : -1, chainActive.Height() - MAX_DISCONNECT_BATCH);
+        std::vector<CBlock> vDisconnected;
+        if (!DisconnectTipsTo(state, chainparams.GetConsensus(), nStopHeight >= 0 ? chainActive[nStopHeight] : NULL, fKeepPossibleUncles ? &vDisconnected : NULL))
             return false;
 		/*popchain ghost*/
-        if ((GetBoolArg("-gen", false) || fRpcMining) && pblock != NULL){
-                possibleBlockHash = pindexPossibleBlock->GetBlockHash();
-                ReadBlockFromDisk(possibleBlock, pindexPossibleBlock, chainparams.GetConsensus());
+        BOOST_FOREACH(const CBlock& possibleBlock, vDisconnected) {
+                uint256 possibleBlockHash = possibleBlock.GetHash();
                 mapPossibleUncles.insert(std::make_pair(possibleBlockHash,possibleBlock));
                 LogPrintf("ActivateBestChainStep possibleUncles add %s,now possibleUncles size %d",possibleBlockHash.ToString(),mapPossibleUncles.size());
 		}
@@ -4158,11 +4497,16 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
 {
     // Check proof of work matches claimed amount
     /*popchain ghost*/
-	if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus()))
-	{
-		LogPrintf("CheckBlockHeader(): \n--b-l-o-c-k---%s\n\n", block.ToString().c_str());
-        return state.DoS(50, error("CheckBlockHeader(): proof of work failed"),
+	if (fCheckPOW) {
+		int64_t nPowStart = GetTimeMicros();
+		bool fPowValid = CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus());
+		RecordValidationTime(VSTAGE_POW_HASH, GetTimeMicros() - nPowStart);
+		if (!fPowValid)
+		{
+			LogPrintf("CheckBlockHeader(): \n--b-l-o-c-k---%s\n\n", block.ToString().c_str());
+			return state.DoS(50, error("CheckBlockHeader(): proof of work failed"),
                          REJECT_INVALID, "high-hash");
+		}
 	}
 	/*popchain ghost*/
     // Check timestamp
@@ -4193,6 +4537,213 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
     return true;
 }
 
+/** Result slot of the checks of one transaction, see CBlockCheck */
+struct CBlockTxCheckResult
+{
+    CValidationState state;
+    bool fValid;
+    unsigned int nSigOps;
+    bool fLockConflict;
+    uint256 hashLocked;
+
+    CBlockTxCheckResult() : fValid(false), nSigOps(0), fLockConflict(false) {}
+};
+
+/**
+ * One unit of work for the block check threads: either the context free
+ * checks CheckBlock runs on a transaction, writing into a slot owned by the
+ * caller, precomputing the CryptoPop hash of an uncle header, or verifying an
+ * input script ahead of mempool admission.
+ */
+class CBlockCheck
+{
+private:
+    const CTransaction *ptx;
+    bool fCheckLocks;
+    CBlockTxCheckResult *presult;
+    const CBlockHeader *pheader;
+    CScriptCheck *pscript;
+
+public:
+    CBlockCheck() : ptx(NULL), fCheckLocks(false), presult(NULL), pheader(NULL), pscript(NULL) {}
+    CBlockCheck(const CTransaction *ptxIn, bool fCheckLocksIn, CBlockTxCheckResult *presultIn) :
+        ptx(ptxIn), fCheckLocks(fCheckLocksIn), presult(presultIn), pheader(NULL), pscript(NULL) {}
+    CBlockCheck(const CBlockHeader *pheaderIn) : ptx(NULL), fCheckLocks(false), presult(NULL), pheader(pheaderIn), pscript(NULL) {}
+    CBlockCheck(CScriptCheck *pscriptIn) : ptx(NULL), fCheckLocks(false), presult(NULL), pheader(NULL), pscript(pscriptIn) {}
+
+    // Always succeeds so that every transaction gets a result and the caller
+    // can report the first failure in block order
+    bool operator()() {
+        if (pheader) {
+            pheader->CacheHash();
+            return true;
+        }
+        if (pscript) {
+            // Only fills the signature cache; admission verifies the scripts
+            // again and reports the failures
+            (*pscript)();
+            return true;
+        }
+        const CTransaction& tx = *ptx;
+        if (fCheckLocks && !tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                uint256 hashLocked;
+                if (instantsend.GetLockedOutPointTxHash(txin.prevout, hashLocked) && hashLocked != tx.GetHash()) {
+                    presult->fLockConflict = true;
+                    presult->hashLocked = hashLocked;
+                    break;
+                }
+            }
+        }
+        presult->fValid = CheckTransaction(tx, presult->state);
+        presult->nSigOps = GetLegacySigOpCount(tx);
+        return true;
+    }
+
+    void swap(CBlockCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(fCheckLocks, check.fCheckLocks);
+        std::swap(presult, check.presult);
+        std::swap(pheader, check.pheader);
+        std::swap(pscript, check.pscript);
+    }
+};
+
+static CCheckQueue<CBlockCheck> blockcheckqueue(32);
+/** CheckBlock runs on several threads at once; whoever holds this uses the queue, the others check serially */
+static boost::mutex csBlockCheckQueue;
+
+void ThreadBlockCheck() {
+    RenameThread("pop-blockch");
+    blockcheckqueue.Thread();
+}
+
+void AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransaction>& vtx, bool fLimitFree, bool fOverrideMempoolLimit, bool fRejectAbsurdFee,
+                             std::vector<CValidationState>& vState, std::vector<char>& vAccepted, std::vector<char>& vMissingInputs)
+{
+    vState.assign(vtx.size(), CValidationState());
+    vAccepted.assign(vtx.size(), 0);
+    vMissingInputs.assign(vtx.size(), 0);
+
+    std::vector<CBlockTxCheckResult> vResults(vtx.size());
+    std::vector<std::vector<uint256> > vHashTxToUncache(vtx.size());
+    boost::unique_lock<boost::mutex> lockQueue(csBlockCheckQueue, boost::defer_lock);
+    bool fParallel = nScriptCheckThreads && vtx.size() >= MIN_PARALLEL_ADMISSION_BATCH && lockQueue.try_lock();
+    if (fParallel) {
+        // Snapshot the coins the batch spends, with the outputs of the batch
+        // itself so that chains of transactions within it check too
+        CCoinsView dummy;
+        CCoinsViewCache view(&dummy);
+        size_t nInputs = 0;
+        {
+            LOCK2(cs_main, pool.cs);
+            CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+            view.SetBackend(viewMemPool);
+            for (size_t i = 0; i < vtx.size(); i++) {
+                const CTransaction& tx = vtx[i];
+                BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                    if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
+                        vHashTxToUncache[i].push_back(txin.prevout.hash);
+                    view.AccessCoins(txin.prevout.hash);
+                }
+                nInputs += tx.vin.size();
+                if (!view.HaveCoins(tx.GetHash()))
+                    view.ModifyNewCoins(tx.GetHash())->FromTx(tx, MEMPOOL_HEIGHT);
+            }
+            view.SetBackend(dummy);
+        }
+
+        // The context free checks of every transaction and the scripts of
+        // every input found, which fills the signature cache
+        std::vector<CScriptCheck> vScriptChecks;
+        vScriptChecks.reserve(nInputs);
+        std::vector<CBlockCheck> vChecks;
+        for (size_t i = 0; i < vtx.size(); i++) {
+            const CTransaction& tx = vtx[i];
+            vChecks.push_back(CBlockCheck(&tx, false, &vResults[i]));
+            if (tx.IsCoinBase())
+                continue;
+            for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                const CCoins* coins = view.AccessCoins(tx.vin[j].prevout.hash);
+                if (!coins || !coins->IsAvailable(tx.vin[j].prevout.n))
+                    continue;
+                vScriptChecks.push_back(CScriptCheck(*coins, tx, j, STANDARD_SCRIPT_VERIFY_FLAGS, true));
+                vChecks.push_back(CBlockCheck(&vScriptChecks.back()));
+            }
+        }
+        int64_t nStart = GetTimeMicros();
+        CCheckQueueControl<CBlockCheck> control(&blockcheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+        lockQueue.unlock();
+        LogPrint("bench", "Pre-validated %u transactions, %u inputs: %.2fms\n", vtx.size(), vScriptChecks.size(), (GetTimeMicros() - nStart) * 0.001);
+    }
+
+    // Admission proper, in order, so that each transaction sees the ones before it
+    LOCK(cs_main);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (fParallel && !vResults[i].fValid) {
+            vState[i] = vResults[i].state;
+            LogPrint("mempool", "%s: %s %s\n", __func__, vtx[i].GetHash().ToString(), vState[i].GetRejectReason());
+        } else {
+            bool fMissingInputs = false;
+            vAccepted[i] = AcceptToMemoryPool(pool, vState[i], vtx[i], fLimitFree, &fMissingInputs, fOverrideMempoolLimit, fRejectAbsurdFee);
+            vMissingInputs[i] = fMissingInputs;
+        }
+        if (!vAccepted[i]) {
+            BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache[i])
+                pcoinsTip->Uncache(hashTx);
+        }
+    }
+}
+
+/**
+ * Cache the CryptoPop hashes of block and its uncles like
+ * PrecomputeBlockHashes, hashing the uncles on the block check threads while
+ * this thread hashes the block's own header.
+ */
+static void PrecomputeBlockHashesParallel(const CBlock& block)
+{
+    std::vector<CBlockCheck> vChecks;
+    for (size_t i = 0; i < block.vuh.size(); i++)
+        vChecks.push_back(CBlockCheck(&block.vuh[i]));
+    boost::unique_lock<boost::mutex> lockQueue(csBlockCheckQueue, boost::defer_lock);
+    bool fParallel = nScriptCheckThreads && !vChecks.empty() && lockQueue.try_lock();
+    CCheckQueueControl<CBlockCheck> control(fParallel ? &blockcheckqueue : NULL);
+    if (fParallel)
+        control.Add(vChecks);
+    block.CacheHash();
+    if (fParallel)
+        control.Wait();
+    else
+        BOOST_FOREACH(CBlockCheck& check, vChecks)
+            check();
+}
+
+/**
+ * Keeps the hashes of a block and its uncles cached while in scope, unless
+ * the caller cached them already. Callers may reuse and modify their block
+ * afterwards, so the hashes are dropped again on the way out.
+ */
+class CBlockHashesScope
+{
+private:
+    const CBlock& block;
+    bool fOwned;
+
+public:
+    explicit CBlockHashesScope(const CBlock& blockIn) : block(blockIn), fOwned(!blockIn.HasCachedHash())
+    {
+        if (fOwned)
+            PrecomputeBlockHashesParallel(block);
+    }
+    ~CBlockHashesScope()
+    {
+        if (fOwned)
+            ForgetBlockHashes(block);
+    }
+};
+
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     // These are checks that are independent of context.
@@ -4205,6 +4756,21 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     if (!CheckBlockHeader(block, state, fCheckPOW))
         return false;
 
+    // The per-transaction checks are independent of each other and of the
+    // block level checks below, so start them on the block check threads now
+    // and only look at their results once the block level checks passed.
+    bool fCheckLocks = sporkManager.IsSporkActive(SPORK_3_INSTANTSEND_BLOCK_FILTERING);
+    std::vector<CBlockTxCheckResult> vResults(block.vtx.size());
+    std::vector<CBlockCheck> vChecks;
+    vChecks.reserve(block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        vChecks.push_back(CBlockCheck(&block.vtx[i], fCheckLocks, &vResults[i]));
+    boost::unique_lock<boost::mutex> lockQueue(csBlockCheckQueue, boost::defer_lock);
+    bool fParallel = nScriptCheckThreads && vChecks.size() > 1 && lockQueue.try_lock();
+    CCheckQueueControl<CBlockCheck> control(fParallel ? &blockcheckqueue : NULL);
+    if (fParallel)
+        control.Add(vChecks);
+
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
@@ -4222,18 +4788,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     }
 
 	/*popchain ghost*/
-	if(true){
-		uint256 hashUncleRoot = BlockUncleRoot(block);
-		if(block.hashUncles != hashUncleRoot){
-			/*popchain ghost*/
-			CBlock dBlock = block;
-			for(std::vector<CBlockHeader>::iterator it = dBlock.vuh.begin(); it != dBlock.vuh.end(); ++it){
-				CBlockHeader blockheader = *it;	
-			}
-			/*popchain ghost*/
-			return state.DoS(100, error("CheckBlock(): hashUncles mismatch"),
-                             REJECT_INVALID, "bad-uncleshash", true);
-		}
+	if(block.hashUncles != BlockUncleRoot(block)){
+		return state.DoS(100, error("CheckBlock(): hashUncles mismatch"),
+                         REJECT_INVALID, "bad-uncleshash", true);
 	}
 	/*popchain ghost*/
 
@@ -4256,31 +4813,31 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
             return state.DoS(100, error("CheckBlock(): more than one coinbase"),
                              REJECT_INVALID, "bad-cb-multiple");
 
+    if (fParallel)
+        control.Wait();
+    else
+        BOOST_FOREACH(CBlockCheck& check, vChecks)
+            check();
 
     // PCH : CHECK TRANSACTIONS FOR INSTANTSEND
 
-    if(sporkManager.IsSporkActive(SPORK_3_INSTANTSEND_BLOCK_FILTERING)) {
+    if(fCheckLocks) {
         // We should never accept block which conflicts with completed transaction lock,
         // that's why this is in CheckBlock unlike coinbase payee/amount.
         // Require other nodes to comply, send them some data in case they are missing it.
-        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-            // skip coinbase, it has no inputs
-            if (tx.IsCoinBase()) continue;
-            // LOOK FOR TRANSACTION LOCK IN OUR MAP OF OUTPOINTS
-            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-                uint256 hashLocked;
-                if(instantsend.GetLockedOutPointTxHash(txin.prevout, hashLocked) && hashLocked != tx.GetHash()) {
-                    // Every node which relayed this block to us must invalidate it
-                    // but they probably need more data.
-                    // Relay corresponding transaction lock request and all its votes
-                    // to let other nodes complete the lock.
-                    instantsend.Relay(hashLocked);
-                    LOCK(cs_main);
-                    mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
-                    return state.DoS(0, error("CheckBlock(PCH): transaction %s conflicts with transaction lock %s",
-                                                tx.GetHash().ToString(), hashLocked.ToString()),
-                                     REJECT_INVALID, "conflict-tx-lock");
-                }
+        for (unsigned int i = 0; i < block.vtx.size(); i++) {
+            if(vResults[i].fLockConflict) {
+                uint256 hashLocked = vResults[i].hashLocked;
+                // Every node which relayed this block to us must invalidate it
+                // but they probably need more data.
+                // Relay corresponding transaction lock request and all its votes
+                // to let other nodes complete the lock.
+                instantsend.Relay(hashLocked);
+                LOCK(cs_main);
+                mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
+                return state.DoS(0, error("CheckBlock(PCH): transaction %s conflicts with transaction lock %s",
+                                            block.vtx[i].GetHash().ToString(), hashLocked.ToString()),
+                                 REJECT_INVALID, "conflict-tx-lock");
             }
         }
     } else {
@@ -4289,17 +4846,16 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 
     // END PCH
 
-    // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state))
+    // Check transactions, reporting the first failure in block order
+    unsigned int nSigOps = 0;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        if (!vResults[i].fValid) {
+            state = vResults[i].state;
             return error("CheckBlock(): CheckTransaction of %s failed with %s",
-                tx.GetHash().ToString(),
+                block.vtx[i].GetHash().ToString(),
                 FormatStateMessage(state));
-
-    unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-    {
-        nSigOps += GetLegacySigOpCount(tx);
+        }
+        nSigOps += vResults[i].nSigOps;
     }
     if (nSigOps > MAX_BLOCK_SIGOPS)
         return state.DoS(100, error("CheckBlock(): out-of-bounds SigOpCount"),
@@ -4523,32 +5079,17 @@ static bool AcceptUnclesHeader(const CBlock& block, CValidationState& state,  co
 	/*popchain ghost*/
 
 	//const CChainParams& chainparams = Params();
-	LogPrintf("AcceptUnclesHeader() GetAncestorBlocksFromHash block.hashPrevBlock %s \n", block.hashPrevBlock.ToString());
-	std::vector<CBlockIndex*> vecAncestor;
-	if(!GetAncestorBlocksFromHash(block.hashPrevBlock,7,vecAncestor))
+	LogPrintf("AcceptUnclesHeader() family window of block.hashPrevBlock %s \n", block.hashPrevBlock.ToString());
+	BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+	if(mi == mapBlockIndex.end() || (*mi).second == NULL)
 		return false;
-	//LogPrintf("AcceptUnclesHeader vecAncestor size: %d \n", vecAncestor.size());
-	
-	CBlock tmpBlock;
-	CBlockIndex* tmpBlockIndex;
+
 	CBlockHeader tmpBlockHeader;
 
 	std::set<uint256> ancestorset;
 	std::set<uint256> unclesset;
-	
-	for(std::vector<CBlockIndex*>::iterator it = vecAncestor.begin(); it != vecAncestor.end(); ++it){
-		tmpBlockIndex = *it;
-		LogPrintf("AcceptUnclesHeader():ReadBlockFromDisk %s\n", tmpBlockIndex->GetBlockHash().ToString());
-		if(ReadBlockFromDisk(tmpBlock, tmpBlockIndex, chainparams.GetConsensus())){
-			for(std::vector<CBlockHeader>::iterator bi = tmpBlock.vuh.begin(); bi != tmpBlock.vuh.end(); ++bi){
-				tmpBlockHeader = *bi;
-				unclesset.insert(tmpBlockHeader.GetHash());
-			}
-			ancestorset.insert(tmpBlockIndex->GetBlockHash());
-		} else{
-			return false;
-		}
-	}	
+	if(!GetFamilyWindow((*mi).second, chainparams.GetConsensus(), ancestorset, unclesset))
+		return false;
 
 	LogPrintf("AcceptUnclesHeader ancestorset size: %d \n", ancestorset.size());
 		
@@ -4647,6 +5188,12 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
     return true;
 }
 
+bool ProcessNewBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+{
+    LOCK(cs_main);
+    return AcceptBlockHeader(block, state, chainparams, ppindex);
+}
+
 /** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
 static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, CDiskBlockPos* dbp)
 {
@@ -4657,7 +5204,10 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     if (!AcceptBlockHeader(block, state, chainparams, &pindex))
         return false;
 
-	if(!AcceptUnclesHeader(block, state, chainparams))
+	int64_t nUnclesStart = GetTimeMicros();
+	bool fUnclesValid = AcceptUnclesHeader(block, state, chainparams);
+	RecordValidationTime(VSTAGE_UNCLES, GetTimeMicros() - nUnclesStart);
+	if(!fUnclesValid)
 		return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -4691,6 +5241,10 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
 
     int nHeight = pindex->nHeight;
 
+	/*popchain ghost*/
+	RecordUncleHashes(pindex, block);
+	/*popchain ghost*/
+
     // Write block to history file
     try {
         unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
@@ -4737,7 +5291,9 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, c
 	}
 	/*popchain ghost*/
 
-	
+    // Every check below hashes the block header and its uncle headers, some
+    // repeatedly; hash each of them once up front, the uncles in parallel.
+    CBlockHashesScope hashesScope(*pblock);
 
     // Preliminary checks
     bool checked = CheckBlock(*pblock, state);
@@ -4985,6 +5541,55 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+/**
+ * The claim trie is written before the coins it goes with are committed by
+ * the background writer, so after a crash the coin database may be behind
+ * it. Replay the blocks in between into the coins; they were fully validated
+ * when first connected, and the claim trie already reflects them.
+ */
+static bool RollForwardCoins(const CChainParams& chainparams, CBlockIndex* pindexCoins)
+{
+    uint256 hashClaimTrie;
+    if (pclaimTrie == NULL || !pclaimTrie->db.Read(HASH_BLOCK, hashClaimTrie) || hashClaimTrie == pindexCoins->GetBlockHash())
+        return true;
+    BlockMap::iterator mi = mapBlockIndex.find(hashClaimTrie);
+    if (mi == mapBlockIndex.end() || mi->second->GetAncestor(pindexCoins->nHeight) != pindexCoins)
+        return error("%s: claim trie at %s does not follow the coin database at %s, restart with -reindex", __func__, hashClaimTrie.ToString(), pindexCoins->GetBlockHash().ToString());
+
+    std::vector<CBlockIndex*> vBlocks;
+    for (CBlockIndex* pindex = mi->second; pindex != pindexCoins; pindex = pindex->pprev)
+        vBlocks.push_back(pindex);
+    LogPrintf("%s: coin database is %u blocks behind the claim trie, replaying them\n", __func__, vBlocks.size());
+
+    CCoinsViewCache view(pcoinsTip);
+    CValidationState state;
+    BOOST_REVERSE_FOREACH(CBlockIndex* pindex, vBlocks) {
+        CBlock block;
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || (pindex->nStatus & BLOCK_FAILED_MASK) || !ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+            return error("%s: cannot replay block %s, restart with -reindex", __func__, pindex->GetBlockHash().ToString());
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            if (!tx.IsCoinBase() && !view.HaveInputs(tx))
+                return error("%s: inputs of %s in block %s are missing, restart with -reindex", __func__, tx.GetHash().ToString(), pindex->GetBlockHash().ToString());
+            CTxUndo undoDummy;
+            UpdateCoins(tx, state, view, undoDummy, pindex->nHeight);
+        }
+        view.SetBestBlock(pindex->GetBlockHash());
+    }
+    return view.Flush();
+}
+
+/** Give blocks without data the uncle hashes a snapshot carried for them */
+static void SetSnapshotUncleHashes(const std::vector<std::pair<uint256, std::vector<uint256> > >& vUncles)
+{
+    for (size_t i = 0; i < vUncles.size(); i++) {
+        BlockMap::iterator mi = mapBlockIndex.find(vUncles[i].first);
+        if (mi == mapBlockIndex.end() || mi->second->fHaveUncleHashes)
+            continue;
+        mi->second->vUncleHashes = vUncles[i].second;
+        mi->second->fHaveUncleHashes = true;
+    }
+}
+
 bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
@@ -5070,6 +5675,16 @@ bool static LoadBlockIndexDB()
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
+    // Check whether the chainstate was bootstrapped from a snapshot
+    pblocktree->ReadFlag("chainstatesnapshot", fHaveSnapshotChain);
+    if (fHaveSnapshotChain) {
+        LogPrintf("LoadBlockIndexDB(): Chainstate was loaded from a snapshot\n");
+        std::vector<std::pair<uint256, std::vector<uint256> > > vUncles;
+        if (!pblocktree->ReadSnapshotUncles(vUncles))
+            return error("LoadBlockIndexDB(): uncle hashes of the snapshot blocks are missing");
+        SetSnapshotUncleHashes(vUncles);
+    }
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -5095,6 +5710,9 @@ bool static LoadBlockIndexDB()
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
+    if (!RollForwardCoins(chainparams, it->second))
+        return false;
+    it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     chainActive.SetTip(it->second);
 
     PruneBlockIndexCandidates();
@@ -5142,6 +5760,9 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        // Blocks up to a loaded chainstate snapshot were never downloaded
+        if (fHaveSnapshotChain && !(pindex->nStatus & BLOCK_HAVE_DATA))
+            break;
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
@@ -5264,6 +5885,7 @@ void UnloadBlockIndex()
     }
     mapBlockIndex.clear();
     fHavePruned = false;
+    fHaveSnapshotChain = false;
 }
 
 bool LoadBlockIndex()
@@ -5329,98 +5951,368 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
+bool ActivateSnapshotChain(CBlockIndex* pindexSnapshot, const std::vector<unsigned int>& vTxCounts, const std::vector<std::vector<uint256> >& vUncleHashes)
+{
+    LOCK(cs_main);
+    if (chainActive.Height() != 0)
+        return error("%s: chainstate is not empty", __func__);
+    if (pindexSnapshot->nHeight < 1 || vTxCounts.size() != (size_t)pindexSnapshot->nHeight + 1)
+        return error("%s: transaction counts do not match the snapshot height", __func__);
+    if (pindexSnapshot->GetAncestor(0) != chainActive.Genesis())
+        return error("%s: snapshot block does not descend from our genesis block", __func__);
+    if (vUncleHashes.size() != (size_t)std::min(UNCLE_FAMILY_DEPTH, pindexSnapshot->nHeight))
+        return error("%s: uncle hashes do not cover the last %d blocks", __func__, UNCLE_FAMILY_DEPTH);
+
+    // Uncle validation of the next blocks looks at the uncles of the last few
+    // blocks, which we have no data for; each set is checked against its header.
+    std::vector<std::pair<uint256, std::vector<uint256> > > vUncles;
+    CBlockIndex* pindexUncles = pindexSnapshot;
+    for (size_t i = 0; i < vUncleHashes.size(); i++, pindexUncles = pindexUncles->pprev) {
+        if (UncleRoot(vUncleHashes[i]) != pindexUncles->hashUncles)
+            return error("%s: uncle hashes of block %s do not match its header", __func__, pindexUncles->GetBlockHash().ToString());
+        vUncles.push_back(std::make_pair(pindexUncles->GetBlockHash(), vUncleHashes[i]));
+    }
+
+    // Link the snapshot chain as if every block had been received and
+    // connected, then pruned: nChainTx is what marks the ancestors as processed.
+    std::vector<CBlockIndex*> vChain;
+    for (CBlockIndex* pindex = pindexSnapshot; pindex->pprev; pindex = pindex->pprev)
+        vChain.push_back(pindex);
+    BOOST_REVERSE_FOREACH(CBlockIndex* pindex, vChain) {
+        if (vTxCounts[pindex->nHeight] == 0)
+            return error("%s: block %s at height %d has no transactions", __func__, pindex->GetBlockHash().ToString(), pindex->nHeight);
+        pindex->nTx = vTxCounts[pindex->nHeight];
+        pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+        pindex->nSequenceId = nBlockSequenceId++;
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindex);
+    }
+
+    setBlockIndexCandidates.insert(pindexSnapshot);
+    chainActive.SetTip(pindexSnapshot);
+    PruneBlockIndexCandidates();
+    if (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindexSnapshot))
+        pindexBestHeader = pindexSnapshot;
+
+    SetSnapshotUncleHashes(vUncles);
+    fHaveSnapshotChain = true;
+    if (!pblocktree->WriteSnapshotUncles(vUncles))
+        return error("%s: failed to write the snapshot uncle hashes", __func__);
+    pblocktree->WriteFlag("chainstatesnapshot", true);
+    // The coin database already points at the snapshot; keep the cache from writing back the genesis hash
+    pcoinsTip->SetBestBlock(pindexSnapshot->GetBlockHash());
+
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+    CheckBlockIndex(Params().GetConsensus());
+
+    LogPrintf("%s: activated snapshot chain, tip=%s height=%d\n", __func__, pindexSnapshot->GetBlockHash().ToString(), pindexSnapshot->nHeight);
+    return true;
+}
+
+/** A block record read from a block file, decoded by the import workers */
+struct CImportRecord
+{
+    uint64_t nMagicPos;  //!< position of the record's message start
+    CDiskBlockPos pos;   //!< position of the block data, null if not importing from our own block files
+    CDataStream ssData;  //!< serialized block, released once decoded
+    unsigned int nSize;
+    CBlock block;
+    bool fDone;
+    bool fDecoded;
+
+    CImportRecord() : nMagicPos(0), ssData(SER_DISK, CLIENT_VERSION), nSize(0), fDone(false), fDecoded(false) {}
+
+    void Decode()
+    {
+        try {
+            ssData >> block;
+            // the expensive part of validating an imported block is CryptoPop
+            // hashing its header and uncles, so do that here in parallel too
+            PrecomputeBlockHashes(block);
+            fDecoded = true;
+        } catch (const std::exception& e) {
+            LogPrintf("LoadExternalBlockFile: Deserialize or I/O error - %s\n", e.what());
+        }
+        ssData = CDataStream(SER_DISK, CLIENT_VERSION);
+    }
+};
+typedef boost::shared_ptr<CImportRecord> CImportRecordRef;
+
+/**
+ * Staged block import: the importing thread locates records and reads them
+ * into a bounded window, worker threads decode them and precompute their
+ * hashes, and the importing thread submits them to validation in file order.
+ */
+class CBlockImportPipeline
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable condWork;
+    boost::condition_variable condDone;
+    std::deque<CImportRecordRef> queueWork;   //!< records waiting for a worker
+    std::deque<CImportRecordRef> window;      //!< records not submitted yet, in file order
+    size_t nWindowBytes;
+    bool fShutdown;
+    boost::thread_group threads;
+
+    void ThreadDecode()
+    {
+        while (true) {
+            CImportRecordRef rec;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (queueWork.empty() && !fShutdown)
+                    condWork.wait(lock);
+                if (fShutdown)
+                    return;
+                rec = queueWork.front();
+                queueWork.pop_front();
+            }
+            rec->Decode();
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                rec->fDone = true;
+            }
+            condDone.notify_all();
+        }
+    }
+
+    void WaitDone(const CImportRecordRef& rec)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (!rec->fDone)
+            condDone.wait(lock);
+    }
+
+public:
+    CBlockImportPipeline(int nThreads) : nWindowBytes(0), fShutdown(false)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CBlockImportPipeline::ThreadDecode, this));
+    }
+
+    ~CBlockImportPipeline()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fShutdown = true;
+        }
+        condWork.notify_all();
+        threads.join_all();
+        Clear();
+    }
+
+    bool Full() const
+    {
+        return window.size() >= (size_t)MAX_IMPORT_THREADS * 8 || nWindowBytes >= MAX_IMPORT_WINDOW_BYTES;
+    }
+
+    void Push(const CImportRecordRef& rec)
+    {
+        window.push_back(rec);
+        nWindowBytes += rec->nSize;
+        if (threads.size() == 0) {
+            rec->Decode();
+            rec->fDone = true;
+            return;
+        }
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            queueWork.push_back(rec);
+        }
+        condWork.notify_one();
+    }
+
+    /** Return the oldest record once it is decoded, or an empty pointer if none are left */
+    CImportRecordRef Pop()
+    {
+        CImportRecordRef rec;
+        if (window.empty())
+            return rec;
+        rec = window.front();
+        window.pop_front();
+        nWindowBytes -= rec->nSize;
+        WaitDone(rec);
+        return rec;
+    }
+
+    /** Drop all records that were not submitted */
+    void Clear()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            // records no worker has picked up yet will never be decoded
+            BOOST_FOREACH(const CImportRecordRef& rec, queueWork)
+                rec->fDone = true;
+            queueWork.clear();
+        }
+        while (!window.empty()) {
+            CImportRecordRef rec = window.front();
+            window.pop_front();
+            WaitDone(rec);
+        }
+        nWindowBytes = 0;
+    }
+};
+
+/** An imported block whose parent was not known yet */
+struct CUnknownParentBlock
+{
+    CDiskBlockPos pos;    //!< where to re-read the block from if it is not kept in memory
+    CImportRecordRef rec; //!< the decoded block, while within MAX_IMPORT_ORPHAN_BYTES
+};
+
+// Blocks with unknown parent, by parent hash. Kept across calls because
+// during -reindex a child can be stored in an earlier file than its parent.
+static std::multimap<uint256, CUnknownParentBlock> mapBlocksUnknownParent;
+static size_t nBlocksUnknownParentBytes = 0;
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        CBlockImportPipeline pipeline(std::min(GetNumCores(), MAX_IMPORT_THREADS));
         uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+        bool fEndOfFile = false;
+        while (true) {
+            // read ahead, leaving the decoding to the workers
+            while (!fEndOfFile && !pipeline.Full() && !blkdat.eof()) {
+                boost::this_thread::interruption_point();
+
+                blkdat.SetPos(nRewind);
+                nRewind++; // start one byte further next time, in case of failure
+                blkdat.SetLimit(); // remove former limit
+                unsigned int nSize = 0;
+                uint64_t nMagicPos = 0;
+                try {
+                    // locate a header
+                    unsigned char buf[MESSAGE_START_SIZE];
+                    blkdat.FindByte(chainparams.MessageStart()[0]);
+                    nMagicPos = blkdat.GetPos();
+                    nRewind = nMagicPos+1;
+                    blkdat >> FLATDATA(buf);
+                    if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
+                        continue;
+                    // read size
+                    blkdat >> nSize;
+                    if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                        continue;
+                } catch (const std::exception&) {
+                    // no valid block header found; don't complain
+                    fEndOfFile = true;
+                    break;
+                }
+                try {
+                    // read block
+                    CImportRecordRef rec(new CImportRecord());
+                    uint64_t nBlockPos = blkdat.GetPos();
+                    rec->nMagicPos = nMagicPos;
+                    rec->nSize = nSize;
+                    if (dbp)
+                        rec->pos = CDiskBlockPos(dbp->nFile, nBlockPos);
+                    blkdat.SetLimit(nBlockPos + nSize);
+                    rec->ssData.resize(nSize);
+                    blkdat.read(&rec->ssData[0], nSize);
+                    nRewind = blkdat.GetPos();
+                    pipeline.Push(rec);
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                }
+            }
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
+            CImportRecordRef rec = pipeline.Pop();
+            if (!rec)
                 break;
+            if (!rec->fDecoded) {
+                // Like reading serially would have, continue scanning from
+                // just past this record's message start, which means
+                // dropping the records read after it.
+                pipeline.Clear();
+                nRewind = rec->nMagicPos + 1;
+                if (!blkdat.SetPos(nRewind) && !blkdat.Seek(nRewind))
+                    break;
+                fEndOfFile = false;
+                continue;
             }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+            const CBlock& block = rec->block;
+            CDiskBlockPos* pblockpos = dbp ? &rec->pos : NULL;
+            if (dbp)
+                *dbp = rec->pos;
+
+            // detect out of order blocks, and store them for later
+            uint256 hash = block.GetHash();
+            if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                        block.hashPrevBlock.ToString());
+                CUnknownParentBlock orphan;
+                orphan.pos = rec->pos;
+                if (nBlocksUnknownParentBytes + rec->nSize <= MAX_IMPORT_ORPHAN_BYTES) {
+                    orphan.rec = rec;
+                    nBlocksUnknownParentBytes += rec->nSize;
+                } else if (!dbp) {
+                    // without a position in our own block files it can not be re-read
                     continue;
                 }
+                mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, orphan));
+                continue;
+            }
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, chainparams, NULL, &block, true, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+            // process in case the block isn't known yet
+            bool fError = false;
+            if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                CValidationState state;
+                if (ProcessNewBlock(state, chainparams, NULL, &block, true, pblockpos))
+                    nLoaded++;
+                fError = state.IsError();
+            } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+                LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+            }
+            if (fError)
+                break;
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, chainparams, NULL, &block, true, &it->second))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
+            // Recursively process earlier encountered successors of this block
+            deque<uint256> queue;
+            queue.push_back(hash);
+            while (!queue.empty()) {
+                uint256 head = queue.front();
+                queue.pop_front();
+                std::pair<std::multimap<uint256, CUnknownParentBlock>::iterator, std::multimap<uint256, CUnknownParentBlock>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                while (range.first != range.second) {
+                    std::multimap<uint256, CUnknownParentBlock>::iterator it = range.first;
+                    CUnknownParentBlock orphan = it->second;
+                    range.first++;
+                    mapBlocksUnknownParent.erase(it);
+
+                    CBlock blockFromDisk;
+                    const CBlock* pchild = &blockFromDisk;
+                    if (orphan.rec) {
+                        nBlocksUnknownParentBytes -= orphan.rec->nSize;
+                        pchild = &orphan.rec->block;
+                    } else {
+                        try {
+                            if (!ReadBlockFromDisk(blockFromDisk, orphan.pos, chainparams.GetConsensus()))
+                                continue;
+                        } catch (const std::exception& e) {
+                            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                            continue;
                         }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
+                    }
+                    uint256 hashChild = pchild->GetHash();
+                    LogPrintf("%s: Processing out of order child %s of %s\n", __func__, hashChild.ToString(),
+                            head.ToString());
+                    CValidationState dummy;
+                    if (ProcessNewBlock(dummy, chainparams, NULL, pchild, true, orphan.pos.IsNull() ? NULL : &orphan.pos))
+                    {
+                        nLoaded++;
+                        queue.push_back(hashChild);
                     }
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
     } catch (const std::runtime_error& e) {
@@ -5491,7 +6383,7 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0);  // nSequenceId can't be set for blocks that aren't linked
         // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
         // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
-        if (!fHavePruned) {
+        if (!fHavePruned && !fHaveSnapshotChain) {
             // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
             assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
             assert(pindexFirstMissing == pindexFirstNeverProcessed);
@@ -5550,7 +6442,7 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindexFirstMissing == NULL) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
         if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) {
             // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
-            assert(fHavePruned); // We must have pruned.
+            assert(fHavePruned || fHaveSnapshotChain); // We must have pruned, or started from a snapshot.
             // This block may have entered mapBlocksUnlinked if:
             //  - it has a descendant that at some point had more work than the
             //    tip, and
@@ -5869,7 +6761,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                     CTransaction tx;
                     if (mempool.lookup(inv.hash, tx)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
+                        ss.reserve(tx.GetTotalSize());
                         ss << tx;
                         pfrom->PushMessage(NetMsgType::TX, ss);
                         pushed = true;
@@ -6443,6 +7335,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CDarksendBroadcastTx dstx;
         int nInvType = MSG_TX;
 
+        // Keep the message as received, it is what gets relayed if the
+        // transaction is accepted
+        CDataStream ssRelay(vRecv.begin(), vRecv.end(), vRecv.GetType(), vRecv.GetVersion());
+
         // Read data and assign inv type
         if(strCommand == NetMsgType::TX) {
             vRecv >> tx;
@@ -6455,6 +7351,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             tx = dstx.tx;
             nInvType = MSG_DSTX;
         }
+        // Trailing bytes are not relayed, the message is serialized again then
+        if (!vRecv.empty())
+            ssRelay.clear();
 
         CInv inv(nInvType, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
@@ -6518,7 +7417,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             }
 
             mempool.check(pcoinsTip);
-            RelayTransaction(tx);
+            if (ssRelay.empty())
+                RelayTransaction(tx);
+            else
+                RelayTransaction(tx, ssRelay);
             vWorkQueue.push_back(inv.hash);
 
             LogPrint("mempool", "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
@@ -6526,44 +7428,58 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 tx.GetHash().ToString(),
                 mempool.size(), mempool.DynamicMemoryUsage() / 1000);
 
-            // Recursively process any orphan transactions that depended on this one
+            // Recursively process any orphan transactions that depended on this one. Each
+            // generation of orphans is admitted as one batch, which checks the scripts of a
+            // large generation on the block check threads.
             set<NodeId> setMisbehaving;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+            set<uint256> setOrphansTried;
+            unsigned int nWorkDone = 0;
+            while (nWorkDone < vWorkQueue.size())
             {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
+                vector<CTransaction> vOrphanTx;
+                vector<NodeId> vFromPeer;
+                for (; nWorkDone < vWorkQueue.size(); nWorkDone++)
                 {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
+                    map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[nWorkDone]);
+                    if (itByPrev == mapOrphanTransactionsByPrev.end())
                         continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
+                    for (set<uint256>::iterator mi = itByPrev->second.begin();
+                         mi != itByPrev->second.end();
+                         ++mi)
+                    {
+                        const COrphanTx& orphan = mapOrphanTransactions[*mi];
+                        // An orphan spending several accepted parents is only tried once
+                        if (setMisbehaving.count(orphan.fromPeer) || !setOrphansTried.insert(*mi).second)
+                            continue;
+                        vOrphanTx.push_back(orphan.tx);
+                        vFromPeer.push_back(orphan.fromPeer);
+                    }
+                }
+
+                // Use dummy CValidationStates so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                vector<CValidationState> vStateDummy;
+                vector<char> vAccepted, vMissingInputs2;
+                AcceptToMemoryPoolBatch(mempool, vOrphanTx, true, false, false, vStateDummy, vAccepted, vMissingInputs2);
+                for (unsigned int i = 0; i < vOrphanTx.size(); i++)
+                {
+                    const uint256 orphanHash = vOrphanTx[i].GetHash();
+                    if (vAccepted[i])
                     {
                         LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
+                        RelayTransaction(vOrphanTx[i]);
                         vWorkQueue.push_back(orphanHash);
                         vEraseQueue.push_back(orphanHash);
                     }
-                    else if (!fMissingInputs2)
+                    else if (!vMissingInputs2[i])
                     {
                         int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                        if (vStateDummy[i].IsInvalid(nDos) && nDos > 0 && !setMisbehaving.count(vFromPeer[i]))
                         {
                             // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
+                            Misbehaving(vFromPeer[i], nDos);
+                            setMisbehaving.insert(vFromPeer[i]);
                             LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
                         }
                         // Has inputs but not accepted to mempool
@@ -6573,8 +7489,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                         assert(recentRejects);
                         recentRejects->insert(orphanHash);
                     }
-                    mempool.check(pcoinsTip);
                 }
+                mempool.check(pcoinsTip);
             }
 
             BOOST_FOREACH(uint256 hash, vEraseQueue)
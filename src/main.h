@@ -31,8 +31,10 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
 class CChainParams;
+class CCoinsViewWriter;
 class CInv;
 class CScriptCheck;
 class CTxMemPool;
@@ -72,10 +74,18 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
+/** Transactions in a mempool admission batch from which they are verified in parallel first */
+static const unsigned int MIN_PARALLEL_ADMISSION_BATCH = 4;
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads decoding and hashing blocks during -reindex and -loadblock */
+static const int MAX_IMPORT_THREADS = 16;
+/** Maximum serialized size of the blocks read ahead of validation during import */
+static const unsigned int MAX_IMPORT_WINDOW_BYTES = 64 * 1000 * 1000;
+/** Maximum serialized size of out-of-order imported blocks kept in memory rather than re-read from disk */
+static const unsigned int MAX_IMPORT_ORPHAN_BYTES = 64 * 1000 * 1000;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -92,6 +102,8 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Default for -dbwritebatch, the number of modified transactions in the coin cache that triggers a write. */
+static const unsigned int DEFAULT_COINS_WRITE_BATCH = 200000;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Average delay between local address broadcasts in seconds. */
@@ -108,6 +120,8 @@ static const int64_t BLOCK_DOWNLOAD_TIMEOUT_PER_PEER = 125000;
 /*popchain ghost*/
 /** Block download timeout base adjustment paramater , > 1*/
 static const int64_t BLOCK_DOWNLOAD_TIMEOUT_ADJUSTMENT = 5;
+/** Number of blocks, counting the parent, whose hashes and uncles an uncle must not repeat */
+static const int UNCLE_FAMILY_DEPTH = 7;
 /*popchain ghost*/
 
 static const unsigned int DEFAULT_LIMITFREERELAY = 15;
@@ -316,6 +330,9 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fTimestampIndex;
+extern bool fSpentIndex;
 /*popchain ghost*/
 extern bool fRpcMining;
 /*popchain ghost*/
@@ -324,7 +341,10 @@ extern bool fRequireStandard;
 extern unsigned int nBytesPerSigOp;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Block hash whose ancestors we will assume to have valid scripts without checking them. */
+extern uint256 hashAssumeValid;
 extern size_t nCoinCacheUsage;
+extern size_t nCoinsWriteBatch;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern bool fEnableReplacement;
@@ -340,6 +360,8 @@ static const uint64_t nMinDiskSpace = 52428800;
 /** Pruning-related variables and constants */
 /** True if any block files have ever been pruned. */
 extern bool fHavePruned;
+/** True if the active chain was bootstrapped from a chainstate snapshot, so blocks below it have no data. */
+extern bool fHaveSnapshotChain;
 /** True if we're running in -prune mode. */
 extern bool fPruneMode;
 /** Number of MiB of block files that we're trying to stay below. */
@@ -378,6 +400,18 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
  * @return True if state.IsValid()
  */
 bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, CDiskBlockPos* dbp);
+/** Add a block header to the block index after checking it, without requiring the block itself */
+bool ProcessNewBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex = NULL);
+/**
+ * Make pindex the active tip on top of a chainstate loaded from a snapshot.
+ * Its ancestors are marked as fully validated but without block data, like
+ * pruned blocks. vTxCounts holds the transaction count of each block by height;
+ * vUncleHashes the uncle hashes of pindex and its ancestors, newest first, as
+ * far back as uncle validation looks (UNCLE_FAMILY_DEPTH blocks).
+ */
+bool ActivateSnapshotChain(CBlockIndex* pindex, const std::vector<unsigned int>& vTxCounts, const std::vector<std::vector<uint256> >& vUncleHashes);
+/** The hashes of the uncle headers pindex includes, read from its block if not known yet */
+bool GetBlockUncleHashes(CBlockIndex* pindex, std::vector<uint256>& vUncleHashes);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
@@ -404,6 +438,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread that reads block inputs from the coin database ahead of ConnectBlock */
+void ThreadCoinsPrefetch();
+/** Run an instance of the thread that runs CheckBlock's per-transaction checks */
+void ThreadBlockCheck();
 
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
@@ -477,7 +515,21 @@ void PruneAndFlush();
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit=false, bool fRejectAbsurdFee=false, bool fDryRun=false);
 
+/**
+ * Accept a batch of transactions into the memory pool, with the same result
+ * as calling AcceptToMemoryPool on each in order. Large enough batches first
+ * get their context free checks and input scripts verified on the block check
+ * threads, against a snapshot of the coins they spend, which fills the
+ * signature cache; only the admission itself then runs under cs_main, unless
+ * the caller already holds it, as the orphan resolution of incoming
+ * transactions does.
+ */
+void AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransaction>& vtx, bool fLimitFree, bool fOverrideMempoolLimit, bool fRejectAbsurdFee,
+                             std::vector<CValidationState>& vState, std::vector<char>& vAccepted, std::vector<char>& vMissingInputs);
+
 int GetUTXOHeight(const COutPoint& outpoint);
+/** Creation height of an outpoint spent in one of the last blocks, without touching block files; false if not recorded */
+bool GetSpentOutPointHeight(const COutPoint& outpoint, int& nHeightRet);
 int GetInputAge(const CTxIn &txin);
 int GetInputAgeIX(const uint256 &nTXHash, const CTxIn &txin);
 int GetIXConfirmations(const uint256 &nTXHash);
@@ -943,21 +995,26 @@ bool GetAddressUnspent(uint160 addressHash, int type,
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 /** Functions for validating blocks and updating the block tree */
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, CClaimTrieCache& trieCache, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. If pdelta is provided, it is
+ *  filled with the names whose claim trie state was rolled back. */
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, CClaimTrieCache& trieCache, bool* pfClean = NULL, CClaimTrieDelta* pdelta = NULL);
+/** Same as above with the block's undo data already read, and without queueing address and spent index updates */
+bool DisconnectBlock(const CBlock& block, CBlockUndo& blockUndo, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, CClaimTrieCache& trieCache, bool* pfClean = NULL, CClaimTrieDelta* pdelta = NULL);
 
 /** Reprocess a number of blocks to try and get on the correct chain again **/
 bool DisconnectBlocks(int blocks);
 void ReprocessBlocks(int nBlocks);
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, CClaimTrieCache& trieCache, bool fJustCheck = false);
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
+ *  If pdelta is provided, it is filled with the names whose claim trie state the block changed. */
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, CClaimTrieCache& trieCache, bool fJustCheck = false, CClaimTrieDelta* pdelta = NULL);
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
@@ -1049,6 +1106,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** The background coin database writer below pcoinsTip, if any */
+extern CCoinsViewWriter *pcoinswriter;
+
 /** Global variable that points to the active CClaimTrie (protected by cs_main) */                                                                                                                                                                                            
 extern CClaimTrie *pclaimTrie;
 
@@ -1082,7 +1142,8 @@ bool CommitUncle(CBlockHeader uncle);
 void FindBlockUncles(uint256 parenthash,std::vector<CBlock>& vuncles);
 
 
-void ThreadProcFutureBlocks();
+/** Connect the blocks held back for a timestamp too far ahead once they are no longer; run every 15 seconds by the scheduler */
+void ProcessFutureBlocks();
 
 
 
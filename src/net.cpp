@@ -1431,13 +1431,9 @@ void MapPort(bool)
 
 
 
-void ThreadDNSAddressSeed()
+static void DNSAddressSeed(bool fCheckPeers)
 {
-    // goal: only query DNS seeds if address need is acute
-    if ((addrman.size() > 0) &&
-        (!GetBoolArg("-forcednsseed", DEFAULT_FORCEDNSSEED))) {
-        MilliSleep(11 * 1000);
-
+    if (fCheckPeers) {
         LOCK(cs_vNodes);
         if (vNodes.size() >= 2) {
             LogPrintf("P2P peers available. Skipped DNS seeding.\n");
@@ -2032,8 +2028,11 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     if (!GetBoolArg("-dnsseed", true))
         LogPrintf("DNS seeding disabled\n");
-    else
-        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "dnsseed", &ThreadDNSAddressSeed));
+    else {
+        // goal: only query DNS seeds if address need is acute
+        bool fCheckPeers = addrman.size() > 0 && !GetBoolArg("-forcednsseed", DEFAULT_FORCEDNSSEED);
+        scheduler.scheduleFromNow(boost::bind(&DNSAddressSeed, fCheckPeers), fCheckPeers ? 11 : 0, "dnsseed");
+    }
 
     // Map ports with UPnP
     MapPort(GetBoolArg("-upnp", DEFAULT_UPNP));
@@ -2054,7 +2053,7 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
     // Dump network addresses
-    scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
+    scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL, "dumpdata");
 }
 
 bool StopNode()
@@ -2128,7 +2127,8 @@ void CExplicitNetCleanup::callCleanup()
 void RelayTransaction(const CTransaction& tx)
 {
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss.reserve(10000);
+    // The stream is kept in mapRelay for 15 minutes, don't over-allocate
+    ss.reserve(tx.GetTotalSize());
     uint256 hash = tx.GetHash();
     CTxLockRequest txLockRequest;
     if(mapDarksendBroadcastTxes.count(hash)) { // MSG_DSTX
@@ -9,44 +9,53 @@
 #include "txmempool.h"
 #include "util.h"
 
+/** Rescale the moving averages once scale gets this large, long before it could overflow */
+static const double MAX_STATS_SCALE = 1e9;
+
 void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
                                 unsigned int maxConfirms, double _decay, std::string _dataTypeString)
 {
     decay = _decay;
+    scale = 1;
     dataTypeString = _dataTypeString;
     for (unsigned int i = 0; i < defaultBuckets.size(); i++) {
         buckets.push_back(defaultBuckets[i]);
         bucketMap[defaultBuckets[i]] = i;
     }
     confAvg.resize(maxConfirms);
-    curBlockConf.resize(maxConfirms);
     unconfTxs.resize(maxConfirms);
+    extraTxs.resize(maxConfirms);
     for (unsigned int i = 0; i < maxConfirms; i++) {
         confAvg[i].resize(buckets.size());
-        curBlockConf[i].resize(buckets.size());
         unconfTxs[i].resize(buckets.size());
+        extraTxs[i].resize(buckets.size());
     }
 
     oldUnconfTxs.resize(buckets.size());
-    curBlockTxCt.resize(buckets.size());
     txCtAvg.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
     avg.resize(buckets.size());
 }
 
-// Zero out the data for the current block
-void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
+void TxConfirmStats::NewBlock(unsigned int nBlockHeight)
 {
     for (unsigned int j = 0; j < buckets.size(); j++) {
         oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
         unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
-        for (unsigned int i = 0; i < curBlockConf.size(); i++)
-            curBlockConf[i][j] = 0;
-        curBlockTxCt[j] = 0;
-        curBlockVal[j] = 0;
     }
-}
 
+    // Decaying is only a change of scale; the stored values are brought back
+    // to their true size once in a long while so they stay well within range
+    scale /= decay;
+    if (scale > MAX_STATS_SCALE) {
+        for (unsigned int j = 0; j < buckets.size(); j++) {
+            for (unsigned int i = 0; i < confAvg.size(); i++)
+                confAvg[i][j] /= scale;
+            avg[j] /= scale;
+            txCtAvg[j] /= scale;
+        }
+        scale = 1;
+    }
+}
 
 void TxConfirmStats::Record(int blocksToConfirm, double val)
 {
@@ -54,27 +63,28 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     if (blocksToConfirm < 1)
         return;
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
-        curBlockConf[i - 1][bucketindex]++;
-    }
-    curBlockTxCt[bucketindex]++;
-    curBlockVal[bucketindex] += val;
+    for (size_t i = blocksToConfirm; i <= confAvg.size(); i++)
+        confAvg[i - 1][bucketindex] += scale;
+    txCtAvg[bucketindex] += scale;
+    avg[bucketindex] += val * scale;
 }
 
-void TxConfirmStats::UpdateMovingAverages()
+void TxConfirmStats::UpdateExtraTxs(unsigned int nBlockHeight)
 {
+    unsigned int maxConfirms = confAvg.size();
+    unsigned int bins = unconfTxs.size();
     for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
-        avg[j] = avg[j] * decay + curBlockVal[j];
-        txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
+        int nExtra = oldUnconfTxs[j];
+        for (unsigned int confct = maxConfirms; confct > 0; confct--) {
+            extraTxs[confct - 1][j] = nExtra;
+            nExtra += unconfTxs[(nBlockHeight - (confct - 1))%bins][j];
+        }
     }
 }
 
 // returns -1 on error conditions
 double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
-                                         double successBreakPoint, bool requireGreater,
-                                         unsigned int nBlockHeight)
+                                         double successBreakPoint, bool requireGreater)
 {
     // Counters for a bucket (or range of buckets)
     double nConf = 0; // Number of tx's confirmed within the confTarget
@@ -101,16 +111,13 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     unsigned int bestFarBucket = startbucket;
 
     bool foundAnswer = false;
-    unsigned int bins = unconfTxs.size();
 
     // Start counting from highest(default) or lowest fee/pri transactions
     for (int bucket = startbucket; bucket >= 0 && bucket <= maxbucketindex; bucket += step) {
         curFarBucket = bucket;
-        nConf += confAvg[confTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
-        for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
-            extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
-        extraNum += oldUnconfTxs[bucket];
+        nConf += confAvg[confTarget - 1][bucket] / scale;
+        totalNum += txCtAvg[bucket] / scale;
+        extraNum += extraTxs[confTarget - 1][bucket];
         // If we have enough transaction data points in this range of buckets,
         // we can test for success
         // (Only count the confirmed data points, so that each confirmation count
@@ -172,11 +179,21 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
 
 void TxConfirmStats::Write(CAutoFile& fileout)
 {
+    // The file keeps the unscaled averages, as it always has
+    std::vector<double> fileAvg(buckets.size());
+    std::vector<double> fileTxCtAvg(buckets.size());
+    std::vector<std::vector<double> > fileConfAvg(confAvg.size(), std::vector<double>(buckets.size()));
+    for (unsigned int j = 0; j < buckets.size(); j++) {
+        for (unsigned int i = 0; i < confAvg.size(); i++)
+            fileConfAvg[i][j] = confAvg[i][j] / scale;
+        fileAvg[j] = avg[j] / scale;
+        fileTxCtAvg[j] = txCtAvg[j] / scale;
+    }
     fileout << decay;
     fileout << buckets;
-    fileout << avg;
-    fileout << txCtAvg;
-    fileout << confAvg;
+    fileout << fileAvg;
+    fileout << fileTxCtAvg;
+    fileout << fileConfAvg;
 }
 
 void TxConfirmStats::Read(CAutoFile& filein)
@@ -214,24 +231,20 @@ void TxConfirmStats::Read(CAutoFile& filein)
     // Now that we've processed the entire fee estimate data file and not
     // thrown any errors, we can copy it to our data structures
     decay = fileDecay;
+    scale = 1;
     buckets = fileBuckets;
     avg = fileAvg;
-    confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
+    confAvg = fileConfAvg;
     bucketMap.clear();
 
-    // Resize the current block variables which aren't stored in the data file
-    // to match the number of confirms and buckets
-    curBlockConf.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        curBlockConf[i].resize(buckets.size());
-    }
-    curBlockTxCt.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
-
+    // Resize the variables which aren't stored in the data file to match
+    // the number of confirms and buckets
     unconfTxs.resize(maxConfirms);
+    extraTxs.resize(maxConfirms);
     for (unsigned int i = 0; i < maxConfirms; i++) {
         unconfTxs[i].resize(buckets.size());
+        extraTxs[i].resize(buckets.size());
     }
     oldUnconfTxs.resize(buckets.size());
 
@@ -296,7 +309,7 @@ void CBlockPolicyEstimator::removeTx(uint256 hash)
 }
 
 CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
-    : nBestSeenHeight(0)
+    : nBestSeenHeight(0), fEstimatesStale(true)
 {
     minTrackedFee = _minRelayFee < CFeeRate(MIN_FEERATE) ? CFeeRate(MIN_FEERATE) : _minRelayFee;
     std::vector<double> vfeelist;
@@ -450,49 +463,71 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     // a fee/priority is "likely" the reason your tx was included in a block if >85% of such tx's
     // were confirmed in 2 blocks and is "unlikely" if <50% were confirmed in 10 blocks
     LogPrint("estimatefee", "Blockpolicy recalculating dynamic cutoffs:\n");
-    priLikely = priStats.EstimateMedianVal(2, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBlockHeight);
+    feeStats.UpdateExtraTxs(nBlockHeight);
+    priStats.UpdateExtraTxs(nBlockHeight);
+    priLikely = priStats.EstimateMedianVal(2, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true);
     if (priLikely == -1)
         priLikely = INF_PRIORITY;
 
-    double feeLikelyEst = feeStats.EstimateMedianVal(2, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBlockHeight);
+    double feeLikelyEst = feeStats.EstimateMedianVal(2, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true);
     if (feeLikelyEst == -1)
         feeLikely = CFeeRate(INF_FEERATE);
     else
         feeLikely = CFeeRate(feeLikelyEst);
 
-    priUnlikely = priStats.EstimateMedianVal(10, SUFFICIENT_PRITXS, UNLIKELY_PCT, false, nBlockHeight);
+    priUnlikely = priStats.EstimateMedianVal(10, SUFFICIENT_PRITXS, UNLIKELY_PCT, false);
     if (priUnlikely == -1)
         priUnlikely = 0;
 
-    double feeUnlikelyEst = feeStats.EstimateMedianVal(10, SUFFICIENT_FEETXS, UNLIKELY_PCT, false, nBlockHeight);
+    double feeUnlikelyEst = feeStats.EstimateMedianVal(10, SUFFICIENT_FEETXS, UNLIKELY_PCT, false);
     if (feeUnlikelyEst == -1)
         feeUnlikely = CFeeRate(0);
     else
         feeUnlikely = CFeeRate(feeUnlikelyEst);
 
-    // Clear the current block states
-    feeStats.ClearCurrent(nBlockHeight);
-    priStats.ClearCurrent(nBlockHeight);
+    // Decay the history and start counting the new block
+    feeStats.NewBlock(nBlockHeight);
+    priStats.NewBlock(nBlockHeight);
 
-    // Repopulate the current block states
+    // Add the confirmed transactions to the history
     for (unsigned int i = 0; i < entries.size(); i++)
         processBlockTx(nBlockHeight, entries[i]);
 
-    // Update all exponential averages with the current block states
-    feeStats.UpdateMovingAverages();
-    priStats.UpdateMovingAverages();
+    // The estimates for every target are only computed once someone asks for one
+    fEstimatesStale.store(true, std::memory_order_release);
 
     LogPrint("estimatefee", "Blockpolicy after updating estimates for %u confirmed entries, new mempool map size %u\n",
              entries.size(), mapMemPoolTxs.size());
 }
 
-CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
+void CBlockPolicyEstimator::UpdateEstimates()
+{
+    if (!fEstimatesStale.load(std::memory_order_acquire))
+        return;
+
+    CPolicyEstimates estimates;
+    feeStats.UpdateExtraTxs(nBestSeenHeight);
+    priStats.UpdateExtraTxs(nBestSeenHeight);
+    estimates.nFeeTargets = std::min(feeStats.GetMaxConfirms(), MAX_BLOCK_CONFIRMS);
+    for (unsigned int i = 0; i < estimates.nFeeTargets; i++)
+        estimates.vFee[i] = feeStats.EstimateMedianVal(i + 1, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true);
+    estimates.nPriTargets = std::min(priStats.GetMaxConfirms(), MAX_BLOCK_CONFIRMS);
+    for (unsigned int i = 0; i < estimates.nPriTargets; i++)
+        estimates.vPri[i] = priStats.EstimateMedianVal(i + 1, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true);
+    snapshot.Publish(estimates);
+    fEstimatesStale.store(false, std::memory_order_release);
+}
+
+CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget) const
 {
+    CPolicyEstimates estimates;
+    snapshot.Get(estimates);
+
     // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
+    if (confTarget <= 0 || (unsigned int)confTarget > estimates.nFeeTargets)
         return CFeeRate(0);
 
-    double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    double median = estimates.vFee[confTarget - 1];
 
     if (median < 0)
         return CFeeRate(0);
@@ -500,24 +535,27 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
     return CFeeRate(median);
 }
 
-CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool)
+CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool) const
 {
+    CPolicyEstimates estimates;
+    snapshot.Get(estimates);
+
     if (answerFoundAtTarget)
         *answerFoundAtTarget = confTarget;
     // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
+    if (confTarget <= 0 || (unsigned int)confTarget > estimates.nFeeTargets)
         return CFeeRate(0);
 
     double median = -1;
-    while (median < 0 && (unsigned int)confTarget <= feeStats.GetMaxConfirms()) {
-        median = feeStats.EstimateMedianVal(confTarget++, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    while (median < 0 && (unsigned int)confTarget <= estimates.nFeeTargets) {
+        median = estimates.vFee[confTarget++ - 1];
     }
 
     if (answerFoundAtTarget)
         *answerFoundAtTarget = confTarget - 1;
 
     // If mempool is limiting txs , return at least the min fee from the mempool
-    CAmount minPoolFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK();
+    CAmount minPoolFee = pool.GetLastMinFee().GetFeePerK();
     if (minPoolFee > 0 && minPoolFee > median)
         return CFeeRate(minPoolFee);
 
@@ -527,31 +565,37 @@ CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoun
     return CFeeRate(median);
 }
 
-double CBlockPolicyEstimator::estimatePriority(int confTarget)
+double CBlockPolicyEstimator::estimatePriority(int confTarget) const
 {
+    CPolicyEstimates estimates;
+    snapshot.Get(estimates);
+
     // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > priStats.GetMaxConfirms())
+    if (confTarget <= 0 || (unsigned int)confTarget > estimates.nPriTargets)
         return -1;
 
-    return priStats.EstimateMedianVal(confTarget, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    return estimates.vPri[confTarget - 1];
 }
 
-double CBlockPolicyEstimator::estimateSmartPriority(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool)
+double CBlockPolicyEstimator::estimateSmartPriority(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool) const
 {
+    CPolicyEstimates estimates;
+    snapshot.Get(estimates);
+
     if (answerFoundAtTarget)
         *answerFoundAtTarget = confTarget;
     // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > priStats.GetMaxConfirms())
+    if (confTarget <= 0 || (unsigned int)confTarget > estimates.nPriTargets)
         return -1;
 
     // If mempool is limiting txs, no priority txs are allowed
-    CAmount minPoolFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK();
+    CAmount minPoolFee = pool.GetLastMinFee().GetFeePerK();
     if (minPoolFee > 0)
         return INF_PRIORITY;
 
     double median = -1;
-    while (median < 0 && (unsigned int)confTarget <= priStats.GetMaxConfirms()) {
-        median = priStats.EstimateMedianVal(confTarget++, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    while (median < 0 && (unsigned int)confTarget <= estimates.nPriTargets) {
+        median = estimates.vPri[confTarget++ - 1];
     }
 
     if (answerFoundAtTarget)
@@ -574,4 +618,55 @@ void CBlockPolicyEstimator::Read(CAutoFile& filein)
     feeStats.Read(filein);
     priStats.Read(filein);
     nBestSeenHeight = nFileBestSeenHeight;
+    fEstimatesStale.store(true, std::memory_order_release);
+}
+
+CPolicyEstimates::CPolicyEstimates() : nFeeTargets(0), nPriTargets(0)
+{
+    for (unsigned int i = 0; i < MAX_BLOCK_CONFIRMS; i++) {
+        vFee[i] = -1;
+        vPri[i] = -1;
+    }
+}
+
+CPolicyEstimatesSnapshot::CPolicyEstimatesSnapshot() : nSequence(0)
+{
+    Publish(CPolicyEstimates());
+}
+
+void CPolicyEstimatesSnapshot::Publish(const CPolicyEstimates& estimates)
+{
+    unsigned int nSeq = nSequence.load(std::memory_order_relaxed);
+    nSequence.store(nSeq + 1, std::memory_order_relaxed);
+    // Readers that see any of the new values below also see the odd sequence
+    std::atomic_thread_fence(std::memory_order_release);
+
+    nFeeTargets.store(estimates.nFeeTargets, std::memory_order_relaxed);
+    nPriTargets.store(estimates.nPriTargets, std::memory_order_relaxed);
+    for (unsigned int i = 0; i < MAX_BLOCK_CONFIRMS; i++) {
+        vFee[i].store(estimates.vFee[i], std::memory_order_relaxed);
+        vPri[i].store(estimates.vPri[i], std::memory_order_relaxed);
+    }
+
+    nSequence.store(nSeq + 2, std::memory_order_release);
+}
+
+void CPolicyEstimatesSnapshot::Get(CPolicyEstimates& estimates) const
+{
+    while (true) {
+        unsigned int nSeq = nSequence.load(std::memory_order_acquire);
+        if (nSeq & 1)
+            continue;
+
+        estimates.nFeeTargets = nFeeTargets.load(std::memory_order_relaxed);
+        estimates.nPriTargets = nPriTargets.load(std::memory_order_relaxed);
+        for (unsigned int i = 0; i < MAX_BLOCK_CONFIRMS; i++) {
+            estimates.vFee[i] = vFee[i].load(std::memory_order_relaxed);
+            estimates.vPri[i] = vPri[i].load(std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (nSequence.load(std::memory_order_relaxed) == nSeq)
+            return;
+    }
 }
@@ -6,6 +6,7 @@
 #include "amount.h"
 #include "uint256.h"
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <vector>
@@ -51,18 +52,25 @@ class CTxMemPool;
  * paid in each bucket. Then we calculate how many blocks Y it took each
  * transaction to be mined and we track an array of counters in each bucket
  * for how long it to took transactions to get confirmed from 1 to a max of 25
- * and we increment all the counters from Y up to 25. This is because for any
+ * and we increment all the counters from Y up to 25.  This is because for any
  * number Z>=Y the transaction was successfully mined within Z blocks.  We
- * want to save a history of this information, so at any time we have a
- * counter of the total number of transactions that happened in a given fee
- * bucket and the total number that were confirmed in each number 1-25 blocks
- * or less for any bucket.   We save this history by keeping an exponentially
- * decaying moving average of each one of these stats.  Furthermore we also
+ * want to save a history of this information, so at
+ * any time we have a counter of the total number of transactions that happened
+ * in a given fee bucket and the total number that were confirmed in each
+ * number 1-25 blocks or less for any bucket.   We save this history by keeping
+ * an exponentially decaying moving average of each one of these stats.  Rather
+ * than decaying every counter every block, the counters are kept multiplied by
+ * a scale that grows by 1/decay per block, and new data points are added with
+ * that weight.  Furthermore we also
  * keep track of the number unmined (in mempool) transactions in each bucket
  * and for how many blocks they have been outstanding and use that to increase
  * the number of transactions we've seen in that fee bucket when calculating
  * an estimate for any number of confirmations below the number of blocks
  * they've been outstanding.
+ *
+ * The estimates for all targets are computed on the first request after a
+ * block and published in a CPolicyEstimatesSnapshot, which the estimate calls
+ * read without taking the mempool lock until the next block comes in.
  */
 
 /**
@@ -85,20 +93,19 @@ private:
     // Count the total # of txs in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> txCtAvg;
-    // and calcuate the total for the current block to update the moving average
-    std::vector<int> curBlockTxCt;
 
-    // Count the total # of txs confirmed within Y blocks in each bucket
-    // Track the historical moving average of theses totals over blocks
+    // Count the # of txs confirmed within Y blocks in each bucket
+    // Track the historical moving average of theses counts over blocks
     std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
-    // and calcuate the totals for the current block to update the moving averages
-    std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
 
     // Sum the total priority/fee of all tx's in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> avg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<double> curBlockVal;
+
+    // The moving averages above are all stored multiplied by scale.  Each
+    // block multiplies scale by 1/decay, which decays all of them at once,
+    // and new data points are added multiplied by scale.
+    double scale;
 
     // Combine the conf counts with tx counts to calculate the confirmation % for each Y,X
     // Combine the total value with the tx counts to calculate the avg fee/priority per bucket
@@ -113,6 +120,10 @@ private:
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
 
+    // # of txs in the mempool for at least Y blocks in each bucket,
+    // derived from the above by UpdateExtraTxs for EstimateMedianVal
+    std::vector<std::vector<int> > extraTxs; // extraTxs[Y][X]
+
 public:
     /**
      * Initialize the data structures.  This is called by BlockPolicyEstimator's
@@ -124,11 +135,14 @@ public:
      */
     void Initialize(std::vector<double>& defaultBuckets, unsigned int maxConfirms, double decay, std::string dataTypeString);
 
-    /** Clear the state of the curBlock variables to start counting for the new block */
-    void ClearCurrent(unsigned int nBlockHeight);
+    /**
+     * Start counting for a new block: decay the historical moving averages
+     * and age the mempool counts by one block
+     */
+    void NewBlock(unsigned int nBlockHeight);
 
     /**
-     * Record a new transaction data point in the current block stats
+     * Record a new transaction data point for the current block
      * @param blocksToConfirm the number of blocks it took this transaction to confirm
      * @param val either the fee or the priority when entered of the transaction
      * @warning blocksToConfirm is 1-based and has to be >= 1
@@ -142,9 +156,8 @@ public:
     void removeTx(unsigned int entryHeight, unsigned int nBestSeenHeight,
                   unsigned int bucketIndex);
 
-    /** Update our estimates by decaying our historical moving average and updating
-        with the data gathered from the current block */
-    void UpdateMovingAverages();
+    /** Recompute the mempool counts EstimateMedianVal works from as of block nBlockHeight */
+    void UpdateExtraTxs(unsigned int nBlockHeight);
 
     /**
      * Calculate a fee or priority estimate.  Find the lowest value bucket (or range of buckets
@@ -155,10 +168,10 @@ public:
      * @param minSuccess the success probability we require
      * @param requireGreater return the lowest fee/pri such that all higher values pass minSuccess OR
      *        return the highest fee/pri such that all lower values fail minSuccess
-     * @param nBlockHeight the current block height
+     * @warning uses the mempool counts from the last call to UpdateExtraTxs
      */
     double EstimateMedianVal(int confTarget, double sufficientTxVal,
-                             double minSuccess, bool requireGreater, unsigned int nBlockHeight);
+                             double minSuccess, bool requireGreater);
 
     /** Return the max number of confirms we're tracking */
     unsigned int GetMaxConfirms() { return confAvg.size(); }
@@ -208,6 +221,39 @@ static const double FEE_SPACING = 1.1;
 /** Spacing of Priority buckets */
 static const double PRI_SPACING = 2;
 
+/** The estimates for every confirmation target as of one block */
+struct CPolicyEstimates
+{
+    unsigned int nFeeTargets; //!< number of targets vFee holds an answer for
+    unsigned int nPriTargets;
+    double vFee[MAX_BLOCK_CONFIRMS]; //!< indexed by target - 1, -1 if there is no estimate
+    double vPri[MAX_BLOCK_CONFIRMS];
+
+    CPolicyEstimates();
+};
+
+/**
+ * The last published CPolicyEstimates, readable without a lock.  Publish is
+ * only called by one thread at a time (the estimator runs under the mempool
+ * lock); a reader that overlaps a publish sees the sequence number change and
+ * reads again, so it always gets the estimates of a single block.
+ */
+class CPolicyEstimatesSnapshot
+{
+public:
+    CPolicyEstimatesSnapshot();
+
+    void Publish(const CPolicyEstimates& estimates);
+    void Get(CPolicyEstimates& estimates) const;
+
+private:
+    std::atomic<unsigned int> nSequence; //!< odd while a publish is in progress
+    std::atomic<unsigned int> nFeeTargets;
+    std::atomic<unsigned int> nPriTargets;
+    std::atomic<double> vFee[MAX_BLOCK_CONFIRMS];
+    std::atomic<double> vPri[MAX_BLOCK_CONFIRMS];
+};
+
 /**
  *  We want to be able to estimate fees or priorities that are needed on tx's to be included in
  * a certain number of blocks.  Every time a block is added to the best chain, this class records
@@ -239,22 +285,27 @@ public:
     bool isPriDataPoint(const CFeeRate &fee, double pri);
 
     /** Return a fee estimate */
-    CFeeRate estimateFee(int confTarget);
+    CFeeRate estimateFee(int confTarget) const;
 
     /** Estimate fee rate needed to get be included in a block within
      *  confTarget blocks. If no answer can be given at confTarget, return an
      *  estimate at the lowest target where one can be given.
      */
-    CFeeRate estimateSmartFee(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool);
+    CFeeRate estimateSmartFee(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool) const;
 
     /** Return a priority estimate */
-    double estimatePriority(int confTarget);
+    double estimatePriority(int confTarget) const;
 
     /** Estimate priority needed to get be included in a block within
      *  confTarget blocks. If no answer can be given at confTarget, return an
      *  estimate at the lowest target where one can be given.
      */
-    double estimateSmartPriority(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool);
+    double estimateSmartPriority(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool) const;
+
+    /** Whether a block came in since the estimates were last published */
+    bool EstimatesStale() const { return fEstimatesStale.load(std::memory_order_acquire); }
+    /** Compute the estimates for every target and publish them, unless they are current. Call with the mempool lock held. */
+    void UpdateEstimates();
 
     /** Write estimation data to a file */
     void Write(CAutoFile& fileout);
@@ -283,5 +334,9 @@ private:
     /** Breakpoints to help determine whether a transaction was confirmed by priority or Fee */
     CFeeRate feeLikely, feeUnlikely;
     double priLikely, priUnlikely;
+
+    /** What the estimate calls answer from, updated on the first request after a block */
+    CPolicyEstimatesSnapshot snapshot;
+    std::atomic<bool> fEstimatesStale;
 };
 #endif /*BITCOIN_POLICYESTIMATOR_H */
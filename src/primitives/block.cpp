@@ -11,6 +11,9 @@
 uint256 CBlockHeader::GetHash() const
 {
 
+	if (!hashCached.IsNull())
+		return hashCached;
+
 	uint256 hash;
 /*popchain ghost*/
 	CryptoPop(this, (unsigned char *)&hash);
@@ -19,6 +22,26 @@ uint256 CBlockHeader::GetHash() const
 	return hash;	
 }
 
+void CBlockHeader::CacheHash() const
+{
+    hashCached.SetNull();
+    hashCached = GetHash();
+}
+
+void PrecomputeBlockHashes(const CBlock& block)
+{
+    block.CacheHash();
+    for (size_t i = 0; i < block.vuh.size(); i++)
+        block.vuh[i].CacheHash();
+}
+
+void ForgetBlockHashes(const CBlock& block)
+{
+    block.ForgetHash();
+    for (size_t i = 0; i < block.vuh.size(); i++)
+        block.vuh[i].ForgetHash();
+}
+
 std::string CBlockHeader::ToString() const                                                                                                                                                                                                                                   
 {
 /*popchain ghost*/
@@ -75,13 +98,17 @@ std::string CBlock::ToString() const
 
 uint256 BlockUncleRoot(const CBlock& block)
 {
-	uint256 hashUncles = uint256();
     std::vector<uint256> uncles;
     uncles.resize(block.vuh.size());
     for (size_t s = 0; s < block.vuh.size(); s++) {
         uncles[s] = block.vuh[s].GetHash();
     }
+	return UncleRoot(uncles);
+}
 
+uint256 UncleRoot(const std::vector<uint256>& uncles)
+{
+	uint256 hashUncles = uint256();
 	if(uncles.size() == 1){
 		CHash256().Write(uncles[0].begin(), 32).Write(uncles[0].begin(), 32).Finalize(hashUncles.begin());
 	}
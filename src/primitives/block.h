@@ -32,6 +32,9 @@ public:
     uint32_t nBits;
 	uint256 nNonce;
 
+    // memory only
+    mutable uint256 hashCached;  //!< set by CacheHash, null otherwise
+
     CBlockHeader()
     {
         SetNull();
@@ -41,6 +44,8 @@ public:
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        if (ser_action.ForRead())
+            hashCached.SetNull();
         READWRITE(this->nVersion);
         nVersion = this->nVersion;
         READWRITE(hashPrevBlock);
@@ -70,6 +75,7 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce.SetNull();
+        hashCached.SetNull();
     }
 
     bool IsNull() const
@@ -79,6 +85,14 @@ public:
 
     uint256 GetHash() const;
 
+    /**
+     * Compute the CryptoPop hash once and have GetHash return it from then
+     * on. Only for headers that are not modified until ForgetHash is called.
+     */
+    void CacheHash() const;
+    void ForgetHash() const { hashCached.SetNull(); }
+    bool HasCachedHash() const { return !hashCached.IsNull(); }
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
@@ -196,8 +210,19 @@ struct CBlockLocator
     }
 };
 
+/**
+ * Cache the CryptoPop hashes of a block's header and uncle headers ahead of
+ * validation, so bulk import can hash blocks on several threads before
+ * handing them to the single validation thread. The block must not be
+ * modified until ForgetBlockHashes.
+ */
+void PrecomputeBlockHashes(const CBlock& block);
+void ForgetBlockHashes(const CBlock& block);
+
 /*popchain ghost*/
 uint256 BlockUncleRoot(const CBlock& block);
+/** The hashUncles commitment for the given uncle header hashes */
+uint256 UncleRoot(const std::vector<uint256>& uncles);
 
 /*popchain ghost*/
 
@@ -214,6 +214,7 @@ class CTransaction
 private:
     /** Memory only. */
     const uint256 hash;
+    const unsigned int nTotalSize;
     void UpdateHash() const;
 
 public:
@@ -265,6 +266,11 @@ public:
         return hash;
     }
 
+    // Serialized size, computed along with the hash
+    unsigned int GetTotalSize() const {
+        return nTotalSize;
+    }
+
     // Return sum of txouts.
     CAmount GetValueOut() const;
     // GetValueIn() is a method on CCoinsViewCache, because
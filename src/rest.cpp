@@ -2,6 +2,7 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "claimtrie.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
@@ -11,6 +12,7 @@
 #include "sync.h"
 #include "txmempool.h"
 #include "utilstrencodings.h"
+#include "validationstats.h"
 #include "version.h"
 
 #include <boost/algorithm/string.hpp>
@@ -27,6 +29,7 @@ enum RetFormat {
     RF_BINARY,
     RF_HEX,
     RF_JSON,
+    RF_TEXT, //!< only offered by /rest/validationstats, so not in rf_names
 };
 
 static const struct {
@@ -61,6 +64,8 @@ extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
+extern UniValue unclesToJSON(const CBlock& block, const CBlockIndex* blockindex);
+extern UniValue getvalidationstats(const UniValue& params, bool fHelp);
 
 static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message)
 {
@@ -197,6 +202,199 @@ static bool rest_headers(HTTPRequest* req,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/** Writes ss in the requested binary or hex format; returns false if rf is neither */
+static bool RESTWriteSerialized(HTTPRequest* req, enum RetFormat rf, const CDataStream& ss)
+{
+    switch (rf) {
+    case RF_BINARY: {
+        string binary = ss.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binary);
+        return true;
+    }
+    case RF_HEX: {
+        string strHex = HexStr(ss.begin(), ss.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+static void RESTWriteJSON(HTTPRequest* req, const UniValue& obj)
+{
+    string strJSON = obj.write() + "\n";
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteReply(HTTP_OK, strJSON);
+}
+
+static bool rest_headers_uncles(HTTPRequest* req,
+                                const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/uncles/<count>/<hash>.<ext>.");
+
+    long count = strtol(path[0].c_str(), NULL, 10);
+    if (count < 1 || count > 2000)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Header count out of range: " + path[0]);
+
+    string hashStr = path[1];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    std::vector<const CBlockIndex *> headers;
+    headers.reserve(count);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex *pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        while (pindex != NULL && chainActive.Contains(pindex)) {
+            if (fHavePruned && !(pindex->nStatus & BLOCK_HAVE_DATA) && pindex->nTx > 0)
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + " not available (pruned data)");
+            headers.push_back(pindex);
+            if (headers.size() == (unsigned long)count)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    // Uncle headers only live in the block body, so each block is read from
+    // disk; the block index itself is never freed, so no lock is needed here.
+    std::vector<CBlock> blocks(headers.size());
+    for (size_t i = 0; i < headers.size(); i++) {
+        if (!ReadBlockFromDisk(blocks[i], headers[i], Params().GetConsensus()))
+            return RESTERR(req, HTTP_NOT_FOUND, headers[i]->GetBlockHash().GetHex() + " not found");
+    }
+
+    if (rf == RF_JSON) {
+        LOCK(cs_main);
+        UniValue jsonHeaders(UniValue::VARR);
+        for (size_t i = 0; i < headers.size(); i++) {
+            UniValue objHeader = blockheaderToJSON(headers[i]);
+            objHeader.push_back(Pair("uh", unclesToJSON(blocks[i], headers[i])));
+            jsonHeaders.push_back(objHeader);
+        }
+        RESTWriteJSON(req, jsonHeaders);
+        return true;
+    }
+
+    // Per block: header, total chain work, uncle headers
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    for (size_t i = 0; i < headers.size(); i++) {
+        ssHeader << headers[i]->GetBlockHeader();
+        ssHeader << ArithToUint256(headers[i]->nChainWork);
+        ssHeader << blocks[i].vuh;
+    }
+    if (!RESTWriteSerialized(req, rf, ssHeader))
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    return true;
+}
+
+static bool rest_uncles(HTTPRequest* req,
+                        const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string hashStr;
+    const RetFormat rf = ParseDataFormat(hashStr, strURIPart);
+
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    CBlock block;
+    CBlockIndex* pblockindex = NULL;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+
+        pblockindex = mi->second;
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
+    }
+
+    if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+
+    if (rf == RF_JSON) {
+        LOCK(cs_main);
+        RESTWriteJSON(req, unclesToJSON(block, pblockindex));
+        return true;
+    }
+
+    CDataStream ssUncles(SER_NETWORK, PROTOCOL_VERSION);
+    ssUncles << block.vuh;
+    if (!RESTWriteSerialized(req, rf, ssUncles))
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    return true;
+}
+
+static bool rest_claims(HTTPRequest* req,
+                        const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    const std::string name = urlDecode(param);
+
+    if (rf == RF_JSON) {
+        UniValue rpcParams(UniValue::VARR);
+        rpcParams.push_back(name);
+        RESTWriteJSON(req, getclaimsforname(rpcParams, false));
+        return true;
+    }
+
+    CDataStream ssClaims(SER_NETWORK, PROTOCOL_VERSION);
+    {
+        LOCK(cs_main);
+        ssClaims << pclaimTrie->getClaimsForName(name);
+    }
+    if (!RESTWriteSerialized(req, rf, ssClaims))
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    return true;
+}
+
+static bool rest_nameproof(HTTPRequest* req,
+                           const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    const std::string name = urlDecode(param);
+
+    CClaimTrieProof proof;
+    {
+        LOCK(cs_main);
+        if (!GetProofForName(chainActive.Tip(), name, proof))
+            return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Failed to generate proof");
+    }
+
+    if (rf == RF_JSON) {
+        RESTWriteJSON(req, proofToJSON(proof));
+        return true;
+    }
+
+    CDataStream ssProof(SER_NETWORK, PROTOCOL_VERSION);
+    ssProof << proof;
+    if (!RESTWriteSerialized(req, rf, ssProof))
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    return true;
+}
+
 static bool rest_block(HTTPRequest* req,
                        const std::string& strURIPart,
                        bool showTxDetails)
@@ -295,6 +493,37 @@ static bool rest_chaininfo(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_validationstats(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (rf == RF_UNDEF && strURIPart.size() >= 4 && strURIPart.compare(strURIPart.size() - 4, 4, ".txt") == 0)
+        rf = RF_TEXT;
+
+    switch (rf) {
+    case RF_JSON: {
+        UniValue rpcParams(UniValue::VARR);
+        string strJSON = getvalidationstats(rpcParams, false).write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    case RF_TEXT: {
+        req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+        req->WriteReply(HTTP_OK, FormatValidationStatsText());
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json, txt)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_mempool_info(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -345,6 +574,29 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_mempool_claims(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    switch (rf) {
+    case RF_JSON: {
+        UniValue rpcParams(UniValue::VARR);
+        rpcParams.push_back(urlDecode(param));
+        RESTWriteJSON(req, getmempoolclaims(rpcParams, false));
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -601,9 +853,15 @@ static const struct {
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
       {"/rest/chaininfo", rest_chaininfo},
+      {"/rest/validationstats", rest_validationstats},
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
+      {"/rest/mempool/claims/", rest_mempool_claims},
+      {"/rest/headers/uncles/", rest_headers_uncles},
       {"/rest/headers/", rest_headers},
+      {"/rest/uncles/", rest_uncles},
+      {"/rest/claims/", rest_claims},
+      {"/rest/nameproof/", rest_nameproof},
       {"/rest/getutxos", rest_getutxos},
 };
 
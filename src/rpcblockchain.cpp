@@ -3,18 +3,23 @@
 #include "amount.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "chainstatesnapshot.h"
 #include "checkpoints.h"
 #include "coins.h"
 #include "consensus/validation.h"
+#include "dbwrapper.h"
+#include "indexwriter.h"
 #include "main.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpcserver.h"
+#include "script/sigcache.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "validationstats.h"
 
 #include <stdint.h>
 
@@ -135,6 +140,36 @@ void uncleblockheaderToJSON(const CBlockHeader& blockheader,UniValue& entry,int
 	
 }
 
+/** Sum of the coinbase outputs of block paying the miner of uncle header uh */
+CAmount GetUncleRewardInBlock(const CBlock& block, const CBlockIndex* blockindex, const CBlockHeader& uh)
+{
+	uint160 tmpAddress;
+	CAmount tmpAmount = 0;
+	int addressType;
+	const CChainParams& chainparams = Params();
+	CAmount nMaxUncleReward = GetUncleMinerSubsidy(blockindex->nHeight,chainparams.GetConsensus(),(blockindex->nHeight -1));
+	for (const CTxOut &out: block.vtx[0].vout){
+		if(DecodeAddressHash(out.scriptPubKey, tmpAddress, addressType)&&(out.nValue <= nMaxUncleReward)){
+			if(uh.nCoinbase == tmpAddress){
+				tmpAmount += out.nValue;
+			}
+		}
+	}
+	return tmpAmount;
+}
+
+/** Detailed JSON for every uncle header included in block */
+UniValue unclesToJSON(const CBlock& block, const CBlockIndex* blockindex)
+{
+	UniValue uhs(UniValue::VARR);
+	BOOST_FOREACH(const CBlockHeader&uh, block.vuh)
+	{
+		UniValue objUh(UniValue::VOBJ);
+		uncleblockheaderToJSON(uh,objUh,blockindex->nHeight,GetUncleRewardInBlock(block, blockindex, uh));
+		uhs.push_back(objUh);
+	}
+	return uhs;
+}
 /*popchain ghost*/
 
 UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false, bool uhDetails = false)
@@ -173,22 +208,10 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
 	UniValue uhs(UniValue::VARR);
 	UniValue uhsr(UniValue::VARR);
 	//uhDetails  =true;
-	int uncleCount =0;
-	uint160 coinBaseAddress;
-	uint160 tmpAddress;
 	CAmount tmpAmount = 0;
-	int addressType;
-	const CChainParams& chainparams = Params();
 	BOOST_FOREACH(const CBlockHeader&uh, block.vuh)
 	{
-		coinBaseAddress  = block.vuh[uncleCount].nCoinbase;
-		for (const CTxOut &out: block.vtx[0].vout){
-			if(DecodeAddressHash(out.scriptPubKey, tmpAddress, addressType)&&(out.nValue <= GetUncleMinerSubsidy(blockindex->nHeight,chainparams.GetConsensus(),(blockindex->nHeight -1)))){
-				if(coinBaseAddress == tmpAddress){
-						tmpAmount += out.nValue;
-				}
-			}
-		}
+		tmpAmount = GetUncleRewardInBlock(block, blockindex, uh);
 		uhsr.push_back(ValueFromAmount(tmpAmount));
 
 
@@ -200,8 +223,6 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
 			uhs.push_back(uh.GetHash().GetHex());
 		}
 
-		tmpAmount = 0;
-		uncleCount++;
 	}
 	result.push_back(Pair("uh",uhs));
 	result.push_back(Pair("uhr",uhsr));
@@ -877,8 +898,6 @@ UniValue getblock(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblock", "\"00000000000fd08c2fb661d2fcb0d49abb3a91e5f27082ce64feed3b4dede2e2\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -886,15 +905,21 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        pblockindex = mi->second;
 
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+    }
 
+    // Block index entries are never freed, so the (PoW checking) read can
+    // happen without cs_main; this lets batched getblock calls overlap.
     if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
@@ -906,6 +931,7 @@ UniValue getblock(const UniValue& params, bool fHelp)
         return strHex;
     }
 
+    LOCK(cs_main);
     return blockToJSON(block, pblockindex);
 }
 
@@ -947,6 +973,58 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue dumpchainstate(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "dumpchainstate \"filename\" ( \"blockhash\" )\n"
+            "\nWrites the unspent transaction output set and the claim trie at the active tip to a snapshot file,\n"
+            "which a new node can load with -loadchainstate instead of syncing from genesis. The loading node\n"
+            "must be given the hash_serialized result as -loadchainstatehash, from a source it trusts.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The snapshot file, relative to the data directory unless absolute\n"
+            "2. \"blockhash\"   (string, optional) Fail unless this block is still the active tip\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filename\": \"path\",        (string) Full path of the snapshot\n"
+            "  \"blockhash\": \"hash\",       (string) The block the snapshot was taken at\n"
+            "  \"height\": n,                (numeric) Its height\n"
+            "  \"transactions\": n,          (numeric) Transactions with unspent outputs\n"
+            "  \"hash_serialized\": \"hash\", (string) Hash of the output set, as in gettxoutsetinfo\n"
+            "  \"claimrecords\": n,          (numeric) Claim trie database records\n"
+            "  \"claimtrieroot\": \"hash\",   (string) Merkle root of the claim trie\n"
+            "  \"checksum\": \"hash\",        (string) Double SHA256 of the snapshot contents\n"
+            "  \"bytes\": n                  (numeric) Size of the snapshot file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumpchainstate", "\"chainstate.snapshot\"")
+            + HelpExampleRpc("dumpchainstate", "\"chainstate.snapshot\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    uint256 hashExpected;
+    if (params.size() > 1)
+        hashExpected = ParseHashV(params[1], "blockhash");
+
+    CChainstateSnapshotInfo info;
+    std::string strError;
+    if (!DumpChainstateSnapshot(path, hashExpected, info, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filename", path.string()));
+    ret.push_back(Pair("blockhash", info.hashBlock.GetHex()));
+    ret.push_back(Pair("height", info.nHeight));
+    ret.push_back(Pair("transactions", (int64_t)info.nCoins));
+    ret.push_back(Pair("hash_serialized", info.hashCoins.GetHex()));
+    ret.push_back(Pair("claimrecords", (int64_t)info.nClaimRecords));
+    ret.push_back(Pair("claimtrieroot", info.hashClaimTrie.GetHex()));
+    ret.push_back(Pair("checksum", info.hashChecksum.GetHex()));
+    ret.push_back(Pair("bytes", (int64_t)info.nBytes));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -1338,6 +1416,226 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns statistics about the script signature cache.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"elements\": xxxxx,           (numeric) Number of slots in the cache\n"
+            "  \"bytes\": xxxxx,              (numeric) Memory reserved for the cache\n"
+            "  \"hits\": xxxxx,               (numeric) Lookups that found a verified signature\n"
+            "  \"misses\": xxxxx,             (numeric) Lookups that required full signature verification\n"
+            "  \"inserts\": xxxxx,            (numeric) Signatures added to the cache\n"
+            "  \"erases\": xxxxx,             (numeric) Entries released after being used by block validation\n"
+            "  \"hitrate\": x.xxx             (numeric) hits / (hits + misses)\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    SignatureCacheStats stats;
+    GetSignatureCacheStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("elements", (int64_t)stats.nElements));
+    ret.push_back(Pair("bytes", (int64_t)stats.nBytes));
+    ret.push_back(Pair("hits", (int64_t)stats.nHits));
+    ret.push_back(Pair("misses", (int64_t)stats.nMisses));
+    ret.push_back(Pair("inserts", (int64_t)stats.nInserts));
+    ret.push_back(Pair("erases", (int64_t)stats.nErases));
+    uint64_t nLookups = stats.nHits + stats.nMisses;
+    ret.push_back(Pair("hitrate", nLookups ? (double)stats.nHits / nLookups : 0.0));
+    return ret;
+}
+
+UniValue getdbinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbinfo\n"
+            "\nReturns cache, write and compaction statistics of the LevelDB databases.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\": \"name\",            (string) Database name, as used by -dboption\n"
+            "    \"path\": \"path\",            (string) Location on disk\n"
+            "    \"cachesize\": xxxxx,          (numeric) Bytes budgeted for the database\n"
+            "    \"sharedcache\": true|false,   (boolean) Whether the block cache is shared with the other databases\n"
+            "    \"cachehits\": xxxxx,          (numeric) Block reads served from the block cache\n"
+            "    \"cachemisses\": xxxxx,        (numeric) Block reads that went to disk\n"
+            "    \"cachehitrate\": x.xxx,       (numeric) cachehits / (cachehits + cachemisses)\n"
+            "    \"cacheinserts\": xxxxx,       (numeric) Blocks added to the block cache\n"
+            "    \"cacheinsertedbytes\": xxxxx, (numeric) Bytes added to the block cache\n"
+            "    \"writes\": xxxxx,             (numeric) Write batches committed\n"
+            "    \"writetime\": xxxxx,          (numeric) Total time spent writing, in milliseconds\n"
+            "    \"writestalls\": xxxxx,        (numeric) Unsynced writes slower than " + itostr(DB_WRITE_STALL_MICROS / 1000) + " ms\n"
+            "    \"levels\": [                (array) Non-empty levels\n"
+            "      {\n"
+            "        \"level\": n,              (numeric) Level number\n"
+            "        \"files\": n,              (numeric) Number of table files\n"
+            "        \"size\": x.xxx,           (numeric) Size in MiB\n"
+            "        \"compactiontime\": x.xxx, (numeric) Seconds spent compacting into this level\n"
+            "        \"compactionread\": x.xxx, (numeric) MiB read by those compactions\n"
+            "        \"compactionwrite\": x.xxx (numeric) MiB written by those compactions\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbinfo", "")
+            + HelpExampleRpc("getdbinfo", "")
+        );
+
+    std::vector<CDBStats> vStats;
+    GetDBStats(vStats);
+
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH(const CDBStats& stats, vStats) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("name", stats.strName));
+        obj.push_back(Pair("path", stats.strPath));
+        obj.push_back(Pair("cachesize", (int64_t)stats.nCacheSize));
+        obj.push_back(Pair("sharedcache", stats.fSharedCache));
+        obj.push_back(Pair("cachehits", (int64_t)stats.nCacheHits));
+        obj.push_back(Pair("cachemisses", (int64_t)stats.nCacheMisses));
+        uint64_t nLookups = stats.nCacheHits + stats.nCacheMisses;
+        obj.push_back(Pair("cachehitrate", nLookups ? (double)stats.nCacheHits / nLookups : 0.0));
+        obj.push_back(Pair("cacheinserts", (int64_t)stats.nCacheInserts));
+        obj.push_back(Pair("cacheinsertedbytes", (int64_t)stats.nCacheInsertedBytes));
+        obj.push_back(Pair("writes", (int64_t)stats.nWrites));
+        obj.push_back(Pair("writetime", (int64_t)(stats.nWriteMicros / 1000)));
+        obj.push_back(Pair("writestalls", (int64_t)stats.nWriteStalls));
+        UniValue levels(UniValue::VARR);
+        BOOST_FOREACH(const CDBLevelStats& level, stats.vLevels) {
+            UniValue lvl(UniValue::VOBJ);
+            lvl.push_back(Pair("level", level.nLevel));
+            lvl.push_back(Pair("files", level.nFiles));
+            lvl.push_back(Pair("size", level.dSizeMB));
+            lvl.push_back(Pair("compactiontime", level.dCompactionSeconds));
+            lvl.push_back(Pair("compactionread", level.dReadMB));
+            lvl.push_back(Pair("compactionwrite", level.dWriteMB));
+            levels.push_back(lvl);
+        }
+        obj.push_back(Pair("levels", levels));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
+UniValue getindexinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getindexinfo\n"
+            "\nReturns the state of the background writer for the address, spent and timestamp indexes.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"addressindex\": true|false,   (boolean) Whether -addressindex is enabled\n"
+            "  \"spentindex\": true|false,     (boolean) Whether -spentindex is enabled\n"
+            "  \"timestampindex\": true|false, (boolean) Whether -timestampindex is enabled\n"
+            "  \"running\": true|false,        (boolean) Whether the writer thread is running\n"
+            "  \"bestblockhash\": \"hash\",     (string) The block the committed indexes reflect\n"
+            "  \"height\": n,                  (numeric) Height of that block\n"
+            "  \"lag\": n,                     (numeric) Blocks the committed indexes are behind the active chain\n"
+            "  \"queued\": n,                  (numeric) Block deltas waiting to be written\n"
+            "  \"batches\": n,                 (numeric) Database batches written since startup\n"
+            "  \"blocks\": n                   (numeric) Block deltas written since startup\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getindexinfo", "")
+            + HelpExampleRpc("getindexinfo", "")
+        );
+
+    CIndexWriterStats stats;
+    GetIndexWriterStats(stats);
+
+    LOCK(cs_main);
+    int nLag = 0;
+    BlockMap::iterator mi = mapBlockIndex.find(stats.hashTip);
+    if (mi != mapBlockIndex.end() && chainActive.Tip() != NULL) {
+        // Count blocks to undo off a stale branch as well as blocks still to apply
+        const CBlockIndex* pindexFork = chainActive.FindFork(mi->second);
+        if (pindexFork != NULL)
+            nLag = (mi->second->nHeight - pindexFork->nHeight) + (chainActive.Height() - pindexFork->nHeight);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("addressindex", fAddressIndex));
+    ret.push_back(Pair("spentindex", fSpentIndex));
+    ret.push_back(Pair("timestampindex", fTimestampIndex));
+    ret.push_back(Pair("running", stats.fRunning));
+    ret.push_back(Pair("bestblockhash", stats.hashTip.GetHex()));
+    ret.push_back(Pair("height", stats.nTipHeight));
+    ret.push_back(Pair("lag", nLag));
+    ret.push_back(Pair("queued", (int64_t)stats.nQueued));
+    ret.push_back(Pair("batches", (int64_t)stats.nBatches));
+    ret.push_back(Pair("blocks", (int64_t)stats.nDeltasWritten));
+    return ret;
+}
+
+UniValue getvalidationstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getvalidationstats ( reset )\n"
+            "\nReturns latency percentiles of the block validation stages and counts of the items processed.\n"
+            "\nArguments:\n"
+            "1. reset          (boolean, optional, default=false) Clear the statistics after returning them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"stages\": {\n"
+            "    \"name\": {          (object) One entry per stage, e.g. pow_hash, uncles, claimtrie_update, script_verify\n"
+            "      \"count\": n,      (numeric) Number of samples\n"
+            "      \"total\": x.xxx,  (numeric) Total time in milliseconds\n"
+            "      \"mean\": x.xxx,   (numeric) Mean time in milliseconds\n"
+            "      \"p50\": x.xxx,    (numeric) Median in milliseconds\n"
+            "      \"p90\": x.xxx,    (numeric) 90th percentile in milliseconds\n"
+            "      \"p99\": x.xxx,    (numeric) 99th percentile in milliseconds\n"
+            "      \"max\": x.xxx     (numeric) Slowest sample in milliseconds\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"counts\": {\n"
+            "    \"name\": n, ...     (numeric) Blocks, transactions, inputs, sigops, claims and uncles connected\n"
+            "  }\n"
+            "}\n"
+            "\nPercentiles are estimated from power-of-two buckets.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getvalidationstats", "")
+            + HelpExampleCli("getvalidationstats", "true")
+            + HelpExampleRpc("getvalidationstats", "")
+        );
+
+    UniValue stages(UniValue::VOBJ);
+    for (int i = 0; i < VSTAGE_MAX; i++) {
+        const CLatencyHistogram& hist = GetValidationHistogram((ValidationStage)i);
+        uint64_t nCount = hist.GetCount();
+        UniValue stage(UniValue::VOBJ);
+        stage.push_back(Pair("count", (int64_t)nCount));
+        stage.push_back(Pair("total", hist.GetTotal() * 0.001));
+        stage.push_back(Pair("mean", nCount ? hist.GetTotal() * 0.001 / nCount : 0.0));
+        stage.push_back(Pair("p50", hist.GetQuantile(0.5) * 0.001));
+        stage.push_back(Pair("p90", hist.GetQuantile(0.9) * 0.001));
+        stage.push_back(Pair("p99", hist.GetQuantile(0.99) * 0.001));
+        stage.push_back(Pair("max", hist.GetMax() * 0.001));
+        stages.push_back(Pair(GetValidationStageName((ValidationStage)i), stage));
+    }
+    UniValue counts(UniValue::VOBJ);
+    for (int i = 0; i < VCOUNT_MAX; i++)
+        counts.push_back(Pair(GetValidationCounterName((ValidationCounter)i), (int64_t)GetValidationCount((ValidationCounter)i)));
+
+    if (params.size() > 0 && params[0].get_bool())
+        ResetValidationStats();
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("stages", stages));
+    ret.push_back(Pair("counts", counts));
+    return ret;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -307,10 +307,15 @@ UniValue getclaimsforname(const UniValue& params, bool fHelp)
             "}\n"   
         );
 
-    LOCK(cs_main);
     std::string name = params[0].get_str();
-    claimsForNameType claimsForName = pclaimTrie->getClaimsForName(name);
-    int nCurrentHeight = chainActive.Height();
+    claimsForNameType claimsForName;
+    int nCurrentHeight;
+    {
+        // The trie is only locked for the lookup, the JSON is built from the copy
+        LOCK(cs_main);
+        claimsForName = pclaimTrie->getClaimsForName(name);
+        nCurrentHeight = chainActive.Height();
+    }
 
     claimSupportMapType claimSupportMap;
     supportsWithoutClaimsMapType supportsWithoutClaims;
@@ -628,6 +633,51 @@ UniValue getclaimsfortx(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue getmempoolclaims(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw std::runtime_error(
+            "getmempoolclaims \"name\"\n"
+            "Return the claims, updates and supports for a name that are waiting in the memory pool\n"
+            "Arguments:\n"
+            "1.  \"name\"               (string) the name to look up\n"
+            "Result:\n"
+            "[\n"
+            "  {\n"
+            "    \"claim type\"         (string) 'claim', 'update' or 'support'\n"
+            "    \"claimId\"            (string) the claimId created or updated, or the claimId supported\n"
+            "    \"txid\"               (string) the txid of the pending transaction\n"
+            "    \"n\"                  (numeric) vout value\n"
+            "    \"amount\"             (numeric) txout value\n"
+            "    \"time\"               (numeric) the time the transaction entered the pool\n"
+            "  }\n"
+            "]\n"
+        );
+
+    std::string name = params[0].get_str();
+    std::vector<CMempoolClaim> claims;
+    mempool.getClaimIndex(name, claims);
+
+    UniValue ret(UniValue::VARR);
+    for (std::vector<CMempoolClaim>::const_iterator it = claims.begin(); it != claims.end(); ++it)
+    {
+        UniValue o(UniValue::VOBJ);
+        if (it->op == OP_CLAIM_NAME)
+            o.push_back(Pair("claim type", "claim"));
+        else if (it->op == OP_UPDATE_CLAIM)
+            o.push_back(Pair("claim type", "update"));
+        else
+            o.push_back(Pair("claim type", "support"));
+        o.push_back(Pair("claimId", it->claimId.GetHex()));
+        o.push_back(Pair("txid", it->outPoint.hash.GetHex()));
+        o.push_back(Pair("n", (int) it->outPoint.n));
+        o.push_back(Pair("amount", it->nAmount));
+        o.push_back(Pair("time", it->nTime));
+        ret.push_back(o);
+    }
+    return ret;
+}
+
 UniValue proofToJSON(const CClaimTrieProof& proof)
 {
     UniValue result(UniValue::VOBJ);
@@ -90,6 +90,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "signrawtransaction", 1 },
     { "signrawtransaction", 2 },
     { "sendrawtransaction", 1 },
+    { "sendrawtransactions", 0 },
+    { "sendrawtransactions", 1 },
     { "fundrawtransaction", 1 },
     { "gettxout", 1 },
     { "gettxout", 2 },
@@ -102,6 +104,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "importpubkey", 2 },
     { "verifychain", 0 },
     { "verifychain", 1 },
+    { "getvalidationstats", 0 },
     { "keypoolrefill", 0 },
     { "getrawmempool", 0 },
     { "estimatefee", 0 },
@@ -74,7 +74,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
 {
     uint256 txid = tx.GetHash();
     entry.push_back(Pair("txid", txid.GetHex()));
-    entry.push_back(Pair("size", (int)::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION)));
+    entry.push_back(Pair("size", (int)tx.GetTotalSize()));
     entry.push_back(Pair("version", tx.nVersion));
     entry.push_back(Pair("locktime", (int64_t)tx.nLockTime));
     UniValue vin(UniValue::VARR);
@@ -217,8 +217,6 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getrawtransaction", "\"mytxid\", 1")
         );
 
-    LOCK(cs_main);
-
     uint256 hash = ParseHashV(params[0], "parameter 1");
 
     bool fVerbose = false;
@@ -237,6 +235,7 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
 
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hex", strHex));
+    LOCK(cs_main);
     TxToJSON(tx, hashBlock, result);
     return result;
 }
@@ -888,6 +887,84 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
     return hashTx.GetHex();
 }
 
+UniValue sendrawtransactions(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "sendrawtransactions [\"hexstring\",...] ( allowhighfees )\n"
+            "\nSubmits a batch of raw transactions (serialized, hex-encoded) to local node and network.\n"
+            "The transactions are accepted in the order given, so later ones may spend earlier ones.\n"
+            "\nArguments:\n"
+            "1. \"hexstrings\"   (array, required) The hex strings of the raw transactions\n"
+            "2. allowhighfees  (boolean, optional, default=false) Allow high fees\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\": \"hex\",   (string) The transaction hash, absent if the transaction could not be decoded\n"
+            "    \"error\": \"msg\"   (string) Why the transaction was not accepted, absent if it was\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendrawtransactions", "\"[\\\"signedhex\\\",\\\"signedhex\\\"]\"")
+            + HelpExampleRpc("sendrawtransactions", "[\"signedhex\",\"signedhex\"]")
+        );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VARR)(UniValue::VBOOL));
+    const UniValue& hexstrings = params[0].get_array();
+
+    bool fOverrideFees = false;
+    if (params.size() > 1)
+        fOverrideFees = params[1].get_bool();
+
+    std::vector<CTransaction> vtx;
+    std::vector<int> vIndex;
+    std::vector<std::string> vError(hexstrings.size());
+    {
+        LOCK(cs_main);
+        CCoinsViewCache &view = *pcoinsTip;
+        for (unsigned int i = 0; i < hexstrings.size(); i++) {
+            CTransaction tx;
+            if (!hexstrings[i].isStr() || !DecodeHexTx(tx, hexstrings[i].get_str())) {
+                vError[i] = "TX decode failed";
+                continue;
+            }
+            const CCoins* existingCoins = view.AccessCoins(tx.GetHash());
+            if (existingCoins && existingCoins->nHeight < 1000000000) {
+                vError[i] = "transaction already in block chain";
+                continue;
+            }
+            vtx.push_back(tx);
+            vIndex.push_back(i);
+        }
+    }
+
+    std::vector<CValidationState> vState;
+    std::vector<char> vAccepted, vMissingInputs;
+    AcceptToMemoryPoolBatch(mempool, vtx, false, false, !fOverrideFees, vState, vAccepted, vMissingInputs);
+
+    UniValue result(UniValue::VARR);
+    std::vector<UniValue> vEntry(hexstrings.size(), UniValue(UniValue::VOBJ));
+    for (size_t i = 0; i < vtx.size(); i++) {
+        UniValue& entry = vEntry[vIndex[i]];
+        entry.push_back(Pair("txid", vtx[i].GetHash().GetHex()));
+        // Already in the mempool is not an error, it is relayed again as sendrawtransaction does
+        if (vAccepted[i] || mempool.exists(vtx[i].GetHash()))
+            RelayTransaction(vtx[i]);
+        else if (vState[i].IsInvalid())
+            vError[vIndex[i]] = strprintf("%i: %s", vState[i].GetRejectCode(), vState[i].GetRejectReason());
+        else if (vMissingInputs[i])
+            vError[vIndex[i]] = "Missing inputs";
+        else
+            vError[vIndex[i]] = vState[i].GetRejectReason();
+    }
+    for (unsigned int i = 0; i < hexstrings.size(); i++) {
+        if (!vError[i].empty())
+            vEntry[i].push_back(Pair("error", vError[i]));
+        result.push_back(vEntry[i]);
+    }
+    return result;
+}
+
 #ifdef ENABLE_WALLET
 
 
@@ -252,25 +252,25 @@ UniValue stop(const UniValue& params, bool fHelp)
  * Popchain DevTeam
  */
 static const CRPCCommand vRPCCommands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
+{ //  category              name                      actor (function)         okSafeMode okConcurrent
+  //  --------------------- ------------------------  -----------------------  ---------- ------------
     /* Overall control/query calls */
     { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
     { "control",            "debug",                  &debug,                  true  },
-    { "control",            "help",                   &help,                   true  },
+    { "control",            "help",                   &help,                   true,       true  },
     { "control",            "stop",                   &stop,                   true  },
 
     /* P2P networking */
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true  },
     { "network",            "addnode",                &addnode,                true  },
     { "network",            "disconnectnode",         &disconnectnode,         true  },
-    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true  },
+    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,       true  },
     { "network",            "getconnectioncount",     &getconnectioncount,     true  },
-    { "network",            "getnettotals",           &getnettotals,           true  },
+    { "network",            "getnettotals",           &getnettotals,           true,       true  },
     { "network",            "getpeerinfo",            &getpeerinfo,            true  },
     { "network",            "ping",                   &ping,                   true  },
     { "network",            "setban",                 &setban,                 true  },
-    { "network",            "listbanned",             &listbanned,             true  },
+    { "network",            "listbanned",             &listbanned,             true,       true  },
     { "network",            "clearbanned",            &clearbanned,            true  },
 
     /* Block chain and UTXO */
@@ -281,7 +281,7 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "getuncleblockheader",    &getuncleblockheader,    true  },
     { "blockchain",         "getalluncleblock",       &getalluncleblock,       true  },
     /*popchain ghost*/
-    { "blockchain",         "getblock",               &getblock,               true  },
+    { "blockchain",         "getblock",               &getblock,               true,       true  },
     { "blockchain",         "getblockhashes",         &getblockhashes,         true  },
     { "blockchain",         "getblockhash",           &getblockhash,           true  },
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
@@ -290,12 +290,17 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  }, 
     { "blockchain",         "getblockdifficulty",     &getblockdifficulty,     true  },
     { "blockchain",         "getchainwork",           &getchainwork,           true  },
-    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
+    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,       true  },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
+    { "blockchain",         "getsigcacheinfo",        &getsigcacheinfo,        true,       true  },
+    { "blockchain",         "getdbinfo",              &getdbinfo,              true,       true  },
+    { "blockchain",         "getindexinfo",           &getindexinfo,           true,       true  },
+    { "blockchain",         "getvalidationstats",     &getvalidationstats,     true,       true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
     { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "dumpchainstate",         &dumpchainstate,         true,       true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
     { "blockchain",         "getspentinfo",           &getspentinfo,           false },
 
@@ -314,29 +319,30 @@ static const CRPCCommand vRPCCommands[] =
     /* Raw transactions */
     { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true  },
     { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true  },
-    { "rawtransactions",    "decodescript",           &decodescript,           true  },
-    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true  },
+    { "rawtransactions",    "decodescript",           &decodescript,           true,       true  },
+    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,       true  },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false },
+    { "rawtransactions",    "sendrawtransactions",    &sendrawtransactions,    false },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false }, /* uses wallet if enabled */
 #ifdef ENABLE_WALLET
     { "rawtransactions",    "fundrawtransaction",     &fundrawtransaction,     false },
 #endif
 
     /* Address index */
-    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true  },
+    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true,       true  },
     { "addressindex",       "getaddressutxos",        &getaddressutxos,        false },
     { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       false },
     { "addressindex",       "getaddresstxids",        &getaddresstxids,        false },
     { "addressindex",       "getaddressbalance",      &getaddressbalance,      false },
 
     /* Utility functions */
-    { "util",               "createmultisig",         &createmultisig,         true  },
+    { "util",               "createmultisig",         &createmultisig,         true,       true  },
     { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
     { "util",               "verifymessage",          &verifymessage,          true  },
-    { "util",               "estimatefee",            &estimatefee,            true  },
-    { "util",               "estimatepriority",       &estimatepriority,       true  },
-    { "util",               "estimatesmartfee",       &estimatesmartfee,       true  },
-    { "util",               "estimatesmartpriority",  &estimatesmartpriority,  true  },
+    { "util",               "estimatefee",            &estimatefee,            true,       true  },
+    { "util",               "estimatepriority",       &estimatepriority,       true,       true  },
+    { "util",               "estimatesmartfee",       &estimatesmartfee,       true,       true  },
+    { "util",               "estimatesmartpriority",  &estimatesmartpriority,  true,       true  },
 
     /* Not shown in help */
     { "hidden",             "invalidateblock",        &invalidateblock,        true  },
@@ -413,11 +419,12 @@ static const CRPCCommand vRPCCommands[] =
     { "Claimtrie",          "getclaimsintrie",        &getclaimsintrie,        true  },  
     { "Claimtrie",          "getclaimtrie",           &getclaimtrie,           true  },  
     { "Claimtrie",          "getvalueforname",        &getvalueforname,        true  },  
-    { "Claimtrie",          "getclaimsforname",       &getclaimsforname,       true  },  
+    { "Claimtrie",          "getclaimsforname",       &getclaimsforname,       true,       true  },
     { "Claimtrie",          "gettotalclaimednames",   &gettotalclaimednames,   true  },  
     { "Claimtrie",          "gettotalclaims",         &gettotalclaims,         true  },  
     { "Claimtrie",          "gettotalvalueofclaims",  &gettotalvalueofclaims,  true  },  
     { "Claimtrie",          "getclaimsfortx",         &getclaimsfortx,         true  },  
+    { "Claimtrie",          "getmempoolclaims",       &getmempoolclaims,       true  },
     { "Claimtrie",          "getnameproof",           &getnameproof,           true  },  
     { "Claimtrie",          "getclaimbyid",           &getclaimbyid,           true  },
     /*atomic swap rpc interface*/
@@ -552,11 +559,94 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+/**
+ * State shared between the thread executing a JSON-RPC batch and the workers
+ * it handed elements to. Every element is claimed exactly once, by whichever
+ * thread gets to it first, and its result is stored by index.
+ */
+class CRPCBatch
+{
+private:
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    std::vector<bool> vClaimed;
+    size_t nPending;
+
+    bool Claim(size_t i)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (vClaimed[i])
+            return false;
+        vClaimed[i] = true;
+        return true;
+    }
+
+public:
+    const UniValue vReq;
+    std::vector<UniValue> vResults;
+
+    CRPCBatch(const UniValue& vReqIn) : vClaimed(vReqIn.size(), false), nPending(vReqIn.size()), vReq(vReqIn), vResults(vReqIn.size()) {}
+
+    /** Execute element i unless another thread already did */
+    void Run(size_t i)
+    {
+        if (!Claim(i))
+            return;
+        UniValue result = JSONRPCExecOne(vReq[i]);
+        boost::unique_lock<boost::mutex> lock(cs);
+        vResults[i] = result;
+        if (--nPending == 0)
+            cond.notify_all();
+    }
+
+    /** Block until every element has a result */
+    void Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nPending > 0)
+            cond.wait(lock);
+    }
+};
+
+static bool IsConcurrentRequest(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& valMethod = find_value(req.get_obj(), "method");
+    if (!valMethod.isStr())
+        return false;
+    const CRPCCommand *pcmd = tableRPC[valMethod.get_str()];
+    return pcmd && pcmd->okConcurrent;
+}
+
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCWorkDispatcher& dispatch)
 {
+    // Workers may still hold a reference after we return if we ended up
+    // running their element ourselves, hence the shared ownership.
+    boost::shared_ptr<CRPCBatch> batch(new CRPCBatch(vReq));
+
+    // Fan out the elements that do not serialize on cs_main. Each one takes
+    // a slot in the work queue; whatever does not fit runs on this thread.
+    std::vector<size_t> vLocal;
+    for (size_t i = 0; i < vReq.size(); i++) {
+        if (dispatch && IsConcurrentRequest(vReq[i]) &&
+            dispatch(boost::bind(&CRPCBatch::Run, batch, i)))
+            continue;
+        vLocal.push_back(i);
+    }
+
+    BOOST_FOREACH(size_t i, vLocal)
+        batch->Run(i);
+
+    // Help out with dispatched elements no worker has picked up yet, starting
+    // from the back as workers take them from the front.
+    for (size_t i = vReq.size(); i > 0; i--)
+        batch->Run(i - 1);
+    batch->Wait();
+
     UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    BOOST_FOREACH(const UniValue& result, batch->vResults)
+        ret.push_back(result);
 
     return ret.write() + "\n";
 }
@@ -122,6 +122,7 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
+    bool okConcurrent; //!< does its work without holding cs_main, so batch elements may run on other workers
 };
 
 /**
@@ -264,6 +265,7 @@ extern UniValue decodescript(const UniValue& params, bool fHelp);
 extern UniValue fundrawtransaction(const UniValue& params, bool fHelp);
 extern UniValue signrawtransaction(const UniValue& params, bool fHelp);
 extern UniValue sendrawtransaction(const UniValue& params, bool fHelp);
+extern UniValue sendrawtransactions(const UniValue& params, bool fHelp);
 extern UniValue gettxoutproof(const UniValue& params, bool fHelp);
 extern UniValue verifytxoutproof(const UniValue& params, bool fHelp);
 
@@ -282,6 +284,10 @@ extern UniValue getblockdifficulty(const UniValue& params, bool fHelp);
 extern UniValue getchainwork(const UniValue& params, bool fHelp);
 extern UniValue settxfee(const UniValue& params, bool fHelp);
 extern UniValue getmempoolinfo(const UniValue& params, bool fHelp);
+extern UniValue getsigcacheinfo(const UniValue& params, bool fHelp);
+extern UniValue getdbinfo(const UniValue& params, bool fHelp);
+extern UniValue getindexinfo(const UniValue& params, bool fHelp);
+extern UniValue getvalidationstats(const UniValue& params, bool fHelp);
 extern UniValue getrawmempool(const UniValue& params, bool fHelp);
 extern UniValue getblockhashes(const UniValue& params, bool fHelp);
 extern UniValue getblockhash(const UniValue& params, bool fHelp);
@@ -312,6 +318,7 @@ UniValue getblockrewarddata(const UniValue& params, bool fHelp);
 
 extern UniValue getblock(const UniValue& params, bool fHelp);
 extern UniValue gettxoutsetinfo(const UniValue& params, bool fHelp);
+extern UniValue dumpchainstate(const UniValue& params, bool fHelp);
 extern UniValue gettxout(const UniValue& params, bool fHelp);
 extern UniValue verifychain(const UniValue& params, bool fHelp);
 extern UniValue getchaintips(const UniValue& params, bool fHelp);
@@ -348,6 +355,7 @@ extern UniValue gettotalclaimednames(const UniValue& params, bool fHelp);
 extern UniValue gettotalclaims(const UniValue& params, bool fHelp);
 extern UniValue gettotalvalueofclaims(const UniValue& params, bool fHelp);
 extern UniValue getclaimsfortx(const UniValue& params, bool fHelp);
+extern UniValue getmempoolclaims(const UniValue& params, bool fHelp);
 extern UniValue proofToJSON(const CClaimTrieProof& proof);
 extern UniValue getnameproof(const UniValue& params, bool fHelp);
 
@@ -356,6 +364,11 @@ extern UniValue getnameproof(const UniValue& params, bool fHelp);
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const UniValue& vReq);
+/** Hands a closure to another worker thread. Returns false if it could not
+ * be queued, in which case the caller runs it itself. */
+typedef boost::function<bool(const boost::function<void(void)>&)> RPCWorkDispatcher;
+/** Execute a JSON-RPC batch. Elements whose command is marked okConcurrent are
+ * handed to dispatch (if set); the reply keeps the order of the request. */
+std::string JSONRPCExecBatch(const UniValue& vReq, const RPCWorkDispatcher& dispatch = RPCWorkDispatcher());
 
 #endif // POPCHAIN_RPCSERVER_H
@@ -4,12 +4,34 @@
 
 #include "reverselock.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <boost/bind.hpp>
+#include <limits>
 #include <utility>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+static int64_t ToTick(const boost::chrono::system_clock::time_point& t, bool fRoundUp)
 {
+    int64_t nMicros = boost::chrono::duration_cast<boost::chrono::microseconds>(t.time_since_epoch()).count();
+    return fRoundUp ? (nMicros + 999) / 1000 : nMicros / 1000;
+}
+
+static boost::chrono::system_clock::time_point FromTick(int64_t nTick)
+{
+    return boost::chrono::system_clock::time_point(boost::chrono::duration_cast<boost::chrono::system_clock::duration>(boost::chrono::milliseconds(nTick)));
+}
+
+static int64_t MicrosBetween(const boost::chrono::system_clock::time_point& from, const boost::chrono::system_clock::time_point& to)
+{
+    return boost::chrono::duration_cast<boost::chrono::microseconds>(to - from).count();
+}
+
+CScheduler::CScheduler() : nCurrentTick(ToTick(boost::chrono::system_clock::now(), false)), nTasks(0), nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+{
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        wheel[l].resize(WHEEL_SLOTS);
+        nWheelCount[l] = 0;
+    }
 }
 
 CScheduler::~CScheduler()
@@ -25,6 +47,90 @@ static boost::system_time toPosixTime(const boost::chrono::system_clock::time_po
 }
 #endif
 
+void CScheduler::placeTask(std::list<Task>& from, std::list<Task>::iterator it)
+{
+    int64_t nDelta = it->nTick - nCurrentTick;
+    if (nDelta <= 0) {
+        readyTasks.splice(readyTasks.end(), from, it);
+        return;
+    }
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        if (nDelta < ((int64_t)1 << (WHEEL_BITS * (l + 1)))) {
+            std::list<Task>& slot = wheel[l][(it->nTick >> (WHEEL_BITS * l)) & (WHEEL_SLOTS - 1)];
+            slot.splice(slot.end(), from, it);
+            nWheelCount[l]++;
+            return;
+        }
+    }
+    overflow.insert(std::make_pair(it->nTick, *it));
+    from.erase(it);
+}
+
+void CScheduler::advanceTo(int64_t nTick)
+{
+    const int64_t nOverflowPeriod = (int64_t)1 << (WHEEL_BITS * WHEEL_LEVELS);
+    while (nCurrentTick < nTick) {
+        // Jump straight to the next tick at which a non-empty level has
+        // something to expire or move down
+        int k = 0;
+        while (k < WHEEL_LEVELS && nWheelCount[k] == 0)
+            k++;
+        int64_t nNext;
+        if (k == 0)
+            nNext = nCurrentTick + 1;
+        else if (k == WHEEL_LEVELS && overflow.empty())
+            nNext = nTick;
+        else
+            nNext = ((nCurrentTick >> (WHEEL_BITS * k)) + 1) << (WHEEL_BITS * k);
+        if (nNext > nTick) {
+            nCurrentTick = nTick;
+            break;
+        }
+        nCurrentTick = nNext;
+
+        if (nCurrentTick % nOverflowPeriod == 0) {
+            while (!overflow.empty() && overflow.begin()->first - nCurrentTick < nOverflowPeriod) {
+                std::list<Task> task(1, overflow.begin()->second);
+                overflow.erase(overflow.begin());
+                placeTask(task, task.begin());
+            }
+        }
+        // Higher levels first, so what they move down is moved further if due
+        for (int l = WHEEL_LEVELS - 1; l >= 0; l--) {
+            if (nCurrentTick & (((int64_t)1 << (WHEEL_BITS * l)) - 1))
+                continue;
+            std::list<Task>& slot = wheel[l][(nCurrentTick >> (WHEEL_BITS * l)) & (WHEEL_SLOTS - 1)];
+            while (!slot.empty()) {
+                nWheelCount[l]--;
+                placeTask(slot, slot.begin());
+            }
+        }
+    }
+}
+
+int64_t CScheduler::nextTick() const
+{
+    if (!readyTasks.empty())
+        return nCurrentTick;
+    int64_t nNext = std::numeric_limits<int64_t>::max();
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        if (nWheelCount[l] == 0)
+            continue;
+        int64_t nBase = nCurrentTick >> (WHEEL_BITS * l);
+        for (int i = 1; i <= WHEEL_SLOTS; i++) {
+            if (!wheel[l][(nBase + i) & (WHEEL_SLOTS - 1)].empty()) {
+                // Level 0 slots hold tasks for exactly that tick, higher
+                // levels need to be moved down at the start of the slot
+                nNext = std::min(nNext, (nBase + i) << (WHEEL_BITS * l));
+                break;
+            }
+        }
+    }
+    if (!overflow.empty())
+        nNext = std::min(nNext, ((nCurrentTick >> (WHEEL_BITS * WHEEL_LEVELS)) + 1) << (WHEEL_BITS * WHEEL_LEVELS));
+    return nNext;
+}
+
 void CScheduler::serviceQueue()
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
@@ -35,41 +141,68 @@ void CScheduler::serviceQueue()
     // is called.
     while (!shouldStop()) {
         try {
-            while (!shouldStop() && taskQueue.empty()) {
+            while (!shouldStop() && nTasks == 0) {
                 // Wait until there is something to do.
                 newTaskScheduled.wait(lock);
             }
 
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
-
+            // Wait until either there is a new task, or until the tick
+            // at which the wheel has something to expire
+            while (!shouldStop() && nTasks != 0) {
+                advanceTo(ToTick(boost::chrono::system_clock::now(), false));
+                if (!readyTasks.empty())
+                    break;
 // wait_until needs boost 1.50 or later; older versions have timed_wait:
 #if BOOST_VERSION < 105000
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.timed_wait(lock, toPosixTime(taskQueue.begin()->first))) {
-                // Keep waiting until timeout
-            }
+                newTaskScheduled.timed_wait(lock, toPosixTime(FromTick(nextTick())));
 #else
-            // Some boost versions have a conflicting overload of wait_until that returns void.
-            // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.wait_until<>(lock, taskQueue.begin()->first) != boost::cv_status::timeout) {
-                // Keep waiting until timeout
-            }
+                // Some boost versions have a conflicting overload of wait_until that returns void.
+                // Explicitly use a template here to avoid hitting that overload.
+                newTaskScheduled.wait_until<>(lock, FromTick(nextTick()));
 #endif
+            }
             // If there are multiple threads, the queue can empty while we're waiting (another
             // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
+            if (shouldStop() || readyTasks.empty())
                 continue;
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
+            std::list<Task> running;
+            running.splice(running.begin(), readyTasks, readyTasks.begin());
+            --nTasks;
+            if (!readyTasks.empty())
+                newTaskScheduled.notify_one();
+            Task& task = running.front();
 
+            boost::chrono::system_clock::time_point start = boost::chrono::system_clock::now();
             {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
-                f();
+                task.f();
+            }
+            boost::chrono::system_clock::time_point end = boost::chrono::system_clock::now();
+
+            if (!task.name.empty()) {
+                CSchedulerTaskStats& stats = mapTaskStats[task.name];
+                int64_t nRunMicros = MicrosBetween(start, end);
+                int64_t nLateMicros = std::max((int64_t)0, MicrosBetween(task.time, start));
+                stats.nRuns++;
+                stats.nRunMicros += nRunMicros;
+                stats.nMaxRunMicros = std::max(stats.nMaxRunMicros, nRunMicros);
+                stats.nLateMicros += nLateMicros;
+                stats.nMaxLateMicros = std::max(stats.nMaxLateMicros, nLateMicros);
+            }
+
+            if (task.nInterval > 0) {
+                // Next run at the first interval boundary still ahead
+                boost::chrono::milliseconds interval(task.nInterval);
+                task.time += interval;
+                if (task.time <= end)
+                    task.time += interval * ((end - task.time) / interval + 1);
+                task.nTick = ToTick(task.time, true);
+                placeTask(running, running.begin());
+                ++nTasks;
+                newTaskScheduled.notify_one();
             }
         } catch (...) {
             --nThreadsServicingQueue;
@@ -92,39 +225,73 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+void CScheduler::addTask(CScheduler::Function f, boost::chrono::system_clock::time_point t, int64_t nInterval, const std::string& name)
 {
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        std::list<Task> task(1);
+        task.front().f = f;
+        task.front().time = t;
+        task.front().nTick = ToTick(t, true);
+        task.front().nInterval = nInterval;
+        task.front().name = name;
+        placeTask(task, task.begin());
+        ++nTasks;
     }
     newTaskScheduled.notify_one();
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t, const std::string& name)
+{
+    addTask(f, t, 0, name);
+}
+
+void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds, const std::string& name)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), name);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds, const std::string& name)
 {
-    f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+    scheduleEveryMs(f, deltaSeconds * 1000, name);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleEveryMs(CScheduler::Function f, int64_t deltaMilliseconds, const std::string& name)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    assert(deltaMilliseconds > 0);
+    addTask(f, boost::chrono::system_clock::now() + boost::chrono::milliseconds(deltaMilliseconds), deltaMilliseconds, name);
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
                              boost::chrono::system_clock::time_point &last) const
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
-    size_t result = taskQueue.size();
-    if (!taskQueue.empty()) {
-        first = taskQueue.begin()->first;
-        last = taskQueue.rbegin()->first;
+    bool fFound = false;
+    std::vector<const std::list<Task>*> vLists(1, &readyTasks);
+    for (int l = 0; l < WHEEL_LEVELS; l++)
+        for (int i = 0; i < WHEEL_SLOTS; i++)
+            vLists.push_back(&wheel[l][i]);
+    for (size_t i = 0; i < vLists.size(); i++) {
+        for (std::list<Task>::const_iterator it = vLists[i]->begin(); it != vLists[i]->end(); it++) {
+            if (!fFound || it->time < first)
+                first = it->time;
+            if (!fFound || it->time > last)
+                last = it->time;
+            fFound = true;
+        }
+    }
+    for (std::multimap<int64_t, Task>::const_iterator it = overflow.begin(); it != overflow.end(); it++) {
+        if (!fFound || it->second.time < first)
+            first = it->second.time;
+        if (!fFound || it->second.time > last)
+            last = it->second.time;
+        fFound = true;
     }
-    return result;
+    return nTasks;
+}
+
+std::map<std::string, CSchedulerTaskStats> CScheduler::getTaskStats() const
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    return mapTaskStats;
 }
@@ -11,7 +11,11 @@
 #include <boost/function.hpp>
 #include <boost/chrono/chrono.hpp>
 #include <boost/thread.hpp>
+#include <list>
 #include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
 
 //
 // Simple class for background tasks that should be run
@@ -30,6 +34,26 @@
 // delete t;
 // delete s; // Must be done after thread is interrupted/joined.
 //
+// Tasks are kept in a hierarchical timer wheel with millisecond ticks:
+// scheduling and expiring a task is constant time however many are pending,
+// and a task never runs before its time. Any number of threads may service
+// the queue.
+//
+
+/** Number of threads servicing the node's scheduler */
+static const int SCHEDULER_THREADS = 3;
+
+/** Run time and lateness of the runs of one named task */
+struct CSchedulerTaskStats
+{
+    uint64_t nRuns;
+    int64_t nRunMicros;         //!< total time spent in the task
+    int64_t nMaxRunMicros;
+    int64_t nLateMicros;        //!< total time between the due time and the start of the runs
+    int64_t nMaxLateMicros;
+
+    CSchedulerTaskStats() : nRuns(0), nRunMicros(0), nMaxRunMicros(0), nLateMicros(0), nMaxLateMicros(0) {}
+};
 
 class CScheduler
 {
@@ -39,18 +63,22 @@ public:
 
     typedef boost::function<void(void)> Function;
 
-    // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    // Call func at/after time t. Runs of tasks with a name are counted
+    // in getTaskStats.
+    void schedule(Function f, boost::chrono::system_clock::time_point t, const std::string& name = "");
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    void scheduleFromNow(Function f, int64_t deltaSeconds, const std::string& name = "");
+
+    // Another convenience method: call f every deltaSeconds forever,
+    // starting deltaSeconds from now. Runs are due at fixed intervals
+    // from the first one; runs missed because f took longer than the
+    // interval are skipped rather than made up for, and a task never
+    // runs concurrently with itself.
+    void scheduleEvery(Function f, int64_t deltaSeconds, const std::string& name = "");
 
-    // Another convenience method: call f approximately
-    // every deltaSeconds forever, starting deltaSeconds from now.
-    // To be more precise: every time f is finished, it
-    // is rescheduled to run deltaSeconds later. If you
-    // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    // The same with the interval in milliseconds
+    void scheduleEveryMs(Function f, int64_t deltaMilliseconds, const std::string& name = "");
 
     // To keep things as simple as possible, there is no unschedule.
 
@@ -68,14 +96,49 @@ public:
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    // Run counters of the named tasks
+    std::map<std::string, CSchedulerTaskStats> getTaskStats() const;
+
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    struct Task
+    {
+        Function f;
+        boost::chrono::system_clock::time_point time;
+        int64_t nTick;          //!< time rounded up to the millisecond
+        int64_t nInterval;      //!< milliseconds between runs of a recurring task, 0 for one shot tasks
+        std::string name;
+    };
+
+    static const int WHEEL_BITS = 8;
+    static const int WHEEL_SLOTS = 1 << WHEEL_BITS;
+    static const int WHEEL_LEVELS = 4;
+
+    // Level l holds the tasks due between 2^(8l) and 2^(8(l+1)) ticks after
+    // nCurrentTick, in the slot given by bits 8l..8l+7 of their tick; the
+    // slots of higher levels are moved down as nCurrentTick reaches them.
+    std::vector<std::list<Task> > wheel[WHEEL_LEVELS];
+    size_t nWheelCount[WHEEL_LEVELS];
+    // Tasks beyond the last level, moved into it every 2^32 ticks
+    std::multimap<int64_t, Task> overflow;
+    // Due tasks, oldest first
+    std::list<Task> readyTasks;
+    int64_t nCurrentTick;
+    size_t nTasks;
+
+    std::map<std::string, CSchedulerTaskStats> mapTaskStats;
+
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
     bool stopRequested;
     bool stopWhenEmpty;
-    bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+    bool shouldStop() { return stopRequested || (stopWhenEmpty && nTasks == 0); }
+
+    void addTask(Function f, boost::chrono::system_clock::time_point t, int64_t nInterval, const std::string& name);
+    // Move *it from its list to where it belongs for nCurrentTick
+    void placeTask(std::list<Task>& from, std::list<Task>::iterator it);
+    void advanceTo(int64_t nTick);
+    int64_t nextTick() const;
 };
 
 #endif
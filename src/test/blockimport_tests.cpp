@@ -0,0 +1,100 @@
+// Copyright (c) 2017-2018 The Popchain Core Developers
+
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "miner.h"
+#include "pow.h"
+#include "streams.h"
+
+#include "test/test_pop.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockimport_tests, TestChain100Setup)
+
+// A block on top of the current tip with a valid proof of work, not processed
+static CBlock MineBlock(const CScript& scriptPubKey)
+{
+    const CChainParams& chainparams = Params();
+    CBlockTemplate *pblocktemplate = CreateNewBlock(chainparams, scriptPubKey);
+    CBlock block = pblocktemplate->block;
+    delete pblocktemplate;
+
+    block.vtx.resize(1);
+    unsigned int extraNonce = 0;
+    IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
+    for (arith_uint256 i = 0; ; ++i) {
+        block.nNonce = ArithToUint256(i);
+        if (CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus()))
+            break;
+    }
+    return block;
+}
+
+// A record the way blocks are stored in block files
+static void WriteRecord(CAutoFile& file, const CBlock& block)
+{
+    unsigned int nSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    file << FLATDATA(Params().MessageStart()) << nSize << block;
+}
+
+BOOST_AUTO_TEST_CASE(cached_block_hash)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlock block = MineBlock(scriptPubKey);
+    uint256 hash = block.GetHash();
+
+    PrecomputeBlockHashes(block);
+    BOOST_CHECK(block.HasCachedHash());
+    BOOST_CHECK(block.GetHash() == hash);
+
+    // Reading a different block into it drops the cached hash
+    CBlock other = block;
+    other.ForgetHash();
+    other.nNonce = ArithToUint256(UintToArith256(block.nNonce) + 1);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << other;
+    ss >> block;
+    BOOST_CHECK(!block.HasCachedHash());
+    BOOST_CHECK(block.GetHash() == other.GetHash());
+    BOOST_CHECK(block.GetHash() != hash);
+
+    // ProcessNewBlock only caches the hashes of a caller's block while it runs
+    CBlock mined = MineBlock(scriptPubKey);
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlock(state, Params(), NULL, &mined, true, NULL));
+    BOOST_CHECK(!mined.HasCachedHash());
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == mined.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(import_pipeline)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlock block = MineBlock(scriptPubKey);
+    CBlock blockTip;
+    BOOST_CHECK(ReadBlockFromDisk(blockTip, chainActive.Tip(), Params().GetConsensus()));
+
+    // A record that does not decode, a block we already have and a new one
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    unsigned int nSize = 100;
+    std::vector<unsigned char> vGarbage(nSize, 0);
+    file << FLATDATA(Params().MessageStart()) << nSize;
+    file.write((const char*)&vGarbage[0], vGarbage.size());
+    WriteRecord(file, blockTip);
+    WriteRecord(file, block);
+    rewind(file.Get());
+
+    // The reader skips the bad record and still submits the others in order
+    BOOST_CHECK(LoadExternalBlockFile(Params(), file.release()));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 101);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+
+    // An empty file loads nothing
+    CAutoFile empty(tmpfile(), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(!LoadExternalBlockFile(Params(), empty.release()));
+    BOOST_CHECK_EQUAL(chainActive.Height(), 101);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
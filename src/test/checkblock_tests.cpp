@@ -1,6 +1,7 @@
 // Copyright (c) 2017-2018 The Popchain Core Developers
 
 #include "clientversion.h"
+#include "consensus/merkle.h"
 #include "consensus/validation.h"
 #include "main.h" // For CheckBlock
 #include "primitives/block.h"
@@ -11,6 +12,7 @@
 
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
+#include <boost/thread.hpp>
 #include <boost/test/unit_test.hpp>
 
 
@@ -61,4 +63,60 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+static CBlock BlockWithInvalidTransactions()
+{
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_1 << OP_1;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 1;
+    block.vtx.push_back(coinbase);
+    for (int i = 1; i < 40; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = i;
+        if (i == 9)
+            tx.vout.clear();
+        if (i == 25)
+            tx.vout[0].nValue = -1;
+        block.vtx.push_back(tx);
+    }
+    block.nTime = GetTime();
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    block.hashUncles = BlockUncleRoot(block);
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(CheckBlock_first_failure)
+{
+    // The first invalid transaction in block order is reported, whether the
+    // transactions are checked serially or on the block check threads
+    CBlock block = BlockWithInvalidTransactions();
+    CValidationState state;
+    BOOST_CHECK(!CheckBlock(block, state, false, true));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-vout-empty");
+
+    boost::thread_group threadGroup;
+    nScriptCheckThreads = 3;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threadGroup.create_thread(&ThreadBlockCheck);
+    for (int n = 0; n < 10; n++) {
+        CValidationState stateParallel;
+        BOOST_CHECK(!CheckBlock(block, stateParallel, false, true));
+        BOOST_CHECK_EQUAL(stateParallel.GetRejectReason(), "bad-txns-vout-empty");
+    }
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    nScriptCheckThreads = 0;
+
+    block.vtx.erase(block.vtx.begin() + 9);
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    CValidationState stateNext;
+    BOOST_CHECK(!CheckBlock(block, stateNext, false, true));
+    BOOST_CHECK_EQUAL(stateNext.GetRejectReason(), "bad-txns-vout-negative");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
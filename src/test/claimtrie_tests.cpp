@@ -847,6 +847,50 @@ BOOST_AUTO_TEST_CASE(claimtrie_insert_update_claim)
     blocks_to_invalidate.pop_back();
 }
 
+BOOST_AUTO_TEST_CASE(claimtrie_multi_block_reorg)
+{
+    fRequireStandard = false;
+    LOCK(cs_main);
+
+    std::string sName("reorgtest");
+    std::string sValue("testa");
+    std::vector<unsigned char> vchName(sName.begin(), sName.end());
+    std::vector<unsigned char> vchValue(sValue.begin(), sValue.end());
+
+    std::vector<CTransaction> coinbases;
+    BOOST_CHECK(CreateCoinbases(1, coinbases));
+    CMutableTransaction tx1 = BuildTransaction(coinbases[0]);
+    tx1.vout[0].scriptPubKey = CScript() << OP_CLAIM_NAME << vchName << vchValue << OP_2DROP << OP_DROP << OP_TRUE;
+    COutPoint tx1OutPoint(tx1.GetHash(), 0);
+    CClaimValue val;
+
+    // Three blocks on one branch, then two on another branch holding a claim
+    BOOST_CHECK(CreateBlocks(1, 1));
+    uint256 hashFirst = chainActive.Tip()->GetBlockHash();
+    BOOST_CHECK(CreateBlocks(2, 1));
+    uint256 hashLongest = chainActive.Tip()->GetBlockHash();
+    BOOST_CHECK(RemoveBlock(hashFirst));
+
+    AddToMempool(tx1);
+    BOOST_CHECK(CreateBlocks(1, 2));
+    BOOST_CHECK(CreateBlocks(1, 1));
+    BOOST_CHECK(pclaimTrie->getInfoForName(sName, val));
+    BOOST_CHECK(val.outPoint == tx1OutPoint);
+
+    // Going back to the longer branch undoes both blocks in one step, takes
+    // the claim out of the trie and puts its transaction back in the mempool
+    CValidationState state;
+    BOOST_CHECK(ReconsiderBlock(state, mapBlockIndex[hashFirst]));
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    BOOST_CHECK(state.IsValid());
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == hashLongest);
+    BOOST_CHECK(!pclaimTrie->getInfoForName(sName, val));
+    BOOST_CHECK(pclaimTrie->checkConsistency());
+    BOOST_CHECK(mempool.exists(tx1.GetHash()));
+    BOOST_CHECK(pcoinsTip->GetBestBlock() == hashLongest);
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_CASE(claimtrienode_serialize_unserialize)
 {
     fRequireStandard = false;
@@ -345,4 +345,77 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     BOOST_CHECK(spent_a_duplicate_coinbase);
 }
 
+BOOST_AUTO_TEST_CASE(coins_cache_write_dirty)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    uint256 txidKept = GetRandHash();
+    uint256 txidSpent = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+
+    {
+        CCoinsModifier coins = cache.ModifyNewCoins(txidKept);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = 1;
+        coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+    }
+    {
+        CCoinsModifier coins = cache.ModifyNewCoins(txidSpent);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = 2;
+        coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+    }
+    cache.ModifyCoins(txidSpent)->Spend(0);
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK_EQUAL(cache.GetDirtyCount(), 2U);
+
+    BOOST_CHECK(cache.WriteDirty());
+    BOOST_CHECK_EQUAL(cache.GetDirtyCount(), 0U);
+    BOOST_CHECK(base.GetBestBlock() == hashBlock);
+    cache.SelfTest();
+
+    // Unspent entries stay cached and clean, spent ones are dropped
+    BOOST_CHECK(cache.HaveCoinsInCache(txidKept));
+    BOOST_CHECK(!cache.HaveCoinsInCache(txidSpent));
+    CCoins coins;
+    BOOST_CHECK(base.GetCoins(txidKept, coins));
+    BOOST_CHECK_EQUAL(coins.vout[0].nValue, 1);
+
+    // A later change to a written entry is picked up by the next write
+    cache.ModifyCoins(txidKept)->Spend(0);
+    BOOST_CHECK_EQUAL(cache.GetDirtyCount(), 1U);
+    BOOST_CHECK(cache.WriteDirty());
+    BOOST_CHECK(!cache.HaveCoins(txidKept));
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_add_from_base)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    uint256 txid = GetRandHash();
+
+    CCoinsMap mapCoins;
+    CCoinsCacheEntry& entry = mapCoins[txid];
+    entry.coins.vout.resize(1);
+    entry.coins.vout[0].nValue = 1;
+    entry.coins.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    entry.flags = CCoinsCacheEntry::DIRTY;
+    BOOST_CHECK(base.BatchWrite(mapCoins, uint256()));
+
+    CCoins coins;
+    BOOST_CHECK(cache.GetCoinsFromBase(txid, coins));
+    BOOST_CHECK(!cache.HaveCoinsInCache(txid));
+    cache.AddFromBase(txid, coins);
+    BOOST_CHECK(cache.HaveCoinsInCache(txid));
+    BOOST_CHECK_EQUAL(cache.GetDirtyCount(), 0U);
+    cache.SelfTest();
+
+    // An entry that is already cached, and possibly modified, is never replaced
+    cache.ModifyCoins(txid)->vout[0].nValue = 2;
+    BOOST_CHECK(cache.GetCoinsFromBase(txid, coins));
+    cache.AddFromBase(txid, coins);
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txid)->vout[0].nValue, 2);
+    cache.SelfTest();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,106 @@
+// Copyright (c) 2017-2018 The Popchain Core Developers
+
+#include "coins.h"
+#include "coinswriter.h"
+#include "random.h"
+#include "script/script.h"
+#include "txdb.h"
+#include "uint256.h"
+#include "test/test_pop.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinswriter_tests, TestingSetup)
+
+static void AddCoins(CCoinsMap& mapCoins, const uint256& txid, bool fSpent)
+{
+    CCoinsCacheEntry& entry = mapCoins[txid];
+    if (!fSpent) {
+        entry.coins.nHeight = 1;
+        entry.coins.vout.resize(1);
+        entry.coins.vout[0].nValue = 1;
+        entry.coins.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    }
+    entry.flags = CCoinsCacheEntry::DIRTY;
+}
+
+BOOST_AUTO_TEST_CASE(coinswriter_inline)
+{
+    // Without the thread every BatchWrite reaches the database before it returns
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewWriter writer(&db);
+    uint256 txid = GetRandHash(), hashBlock = GetRandHash();
+    CCoinsMap mapCoins;
+    AddCoins(mapCoins, txid, false);
+    BOOST_CHECK(writer.BatchWrite(mapCoins, hashBlock));
+    BOOST_CHECK(mapCoins.empty());
+    BOOST_CHECK(db.HaveCoins(txid));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    BOOST_CHECK_EQUAL(writer.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(coinswriter_background)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewWriter writer(&db);
+    // Tiny limit, so later writes wait for the thread whenever it is busy
+    writer.SetMaxQueuedUsage(1);
+    writer.Start();
+
+    std::vector<uint256> vTxids;
+    uint256 hashBlock;
+    for (int i = 0; i < 20; i++) {
+        CCoinsMap mapCoins;
+        for (int j = 0; j < 50; j++) {
+            vTxids.push_back(GetRandHash());
+            AddCoins(mapCoins, vTxids.back(), false);
+        }
+        // Spend an output of the previous round
+        if (i > 0)
+            AddCoins(mapCoins, vTxids[vTxids.size() - 60], true);
+        hashBlock = GetRandHash();
+        BOOST_CHECK(writer.BatchWrite(mapCoins, hashBlock));
+        // Queued or written, the view answers with the newest state
+        BOOST_CHECK(writer.HaveCoins(vTxids.back()));
+        BOOST_CHECK(writer.GetBestBlock() == hashBlock);
+        if (i > 0)
+            BOOST_CHECK(!writer.HaveCoins(vTxids[vTxids.size() - 60]));
+    }
+
+    BOOST_CHECK(writer.WaitForWrites());
+    BOOST_CHECK_EQUAL(writer.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    for (size_t i = 0; i < vTxids.size(); i++) {
+        bool fSpent = i % 50 == 40 && i < vTxids.size() - 50;
+        BOOST_CHECK_EQUAL(db.HaveCoins(vTxids[i]), !fSpent);
+    }
+    writer.Stop();
+}
+
+BOOST_AUTO_TEST_CASE(coinswriter_cache_flush)
+{
+    // The way pcoinsTip uses it: dirty entries are handed over, the cache keeps them
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewWriter writer(&db);
+    writer.Start();
+    {
+        CCoinsViewCache cache(&writer);
+        uint256 txid = GetRandHash(), hashBlock = GetRandHash();
+        {
+            CCoinsModifier coins = cache.ModifyNewCoins(txid);
+            coins->nHeight = 1;
+            coins->vout.resize(1);
+            coins->vout[0].nValue = 1;
+        }
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.WriteDirty());
+        BOOST_CHECK_EQUAL(cache.GetDirtyCount(), 0U);
+        BOOST_CHECK(cache.HaveCoinsInCache(txid));
+        BOOST_CHECK(writer.WaitForWrites());
+        BOOST_CHECK(db.HaveCoins(txid));
+        BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    }
+    writer.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 
 #include <boost/assign/std/vector.hpp> // for 'operator+=()'
 #include <boost/assert.hpp>
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
                     
 using namespace std;
@@ -45,6 +46,37 @@ BOOST_AUTO_TEST_CASE(dbwrapper)
     }
 }
 
+// Test per-database options and statistics
+BOOST_AUTO_TEST_CASE(dbwrapper_stats)
+{
+    path ph = temp_directory_path() / unique_path();
+    mapMultiArgs["-dboption"].push_back("statstest.cache=2");
+    mapMultiArgs["-dboption"].push_back("othertest.cache=8");
+    std::vector<CDBStats> vStats;
+    {
+        CDBWrapper dbw(ph, CDBOptions("statstest", 1 << 20), true, false, false);
+        BOOST_CHECK(dbw.Write('k', GetRandHash()));
+
+        CDBStats stats;
+        dbw.GetStats(stats);
+        BOOST_CHECK_EQUAL(stats.strName, "statstest");
+        BOOST_CHECK_EQUAL(stats.nCacheSize, (size_t)(2 << 20));
+        BOOST_CHECK(!stats.fSharedCache);
+        BOOST_CHECK_EQUAL(stats.nWrites, 1U);
+
+        GetDBStats(vStats);
+        int nFound = 0;
+        BOOST_FOREACH(const CDBStats& s, vStats)
+            nFound += s.strName == "statstest";
+        BOOST_CHECK_EQUAL(nFound, 1);
+    }
+    // closed databases are no longer reported
+    GetDBStats(vStats);
+    BOOST_FOREACH(const CDBStats& s, vStats)
+        BOOST_CHECK(s.strName != "statstest");
+    mapMultiArgs.erase("-dboption");
+}
+
 // Test batch operations
 BOOST_AUTO_TEST_CASE(dbwrapper_batch)
 {
@@ -124,6 +156,37 @@ BOOST_AUTO_TEST_CASE(dbwrapper_iterator)
     }
 }
 
+// Copy entries between databases as raw bytes, across obfuscation settings
+BOOST_AUTO_TEST_CASE(dbwrapper_raw_copy)
+{
+    for (int i = 0; i < 2; i++) {
+        bool obfuscate = (bool)i;
+        path ph = temp_directory_path() / unique_path();
+        CDBWrapper dbw(ph, (1 << 20), true, false, obfuscate);
+        path ph2 = temp_directory_path() / unique_path();
+        CDBWrapper dbw2(ph2, (1 << 20), true, false, !obfuscate);
+
+        std::pair<char, uint256> key = std::make_pair('j', GetRandHash());
+        uint256 in = GetRandHash();
+        BOOST_CHECK(dbw.Write(key, in));
+
+        boost::scoped_ptr<CDBIterator> it(const_cast<CDBWrapper*>(&dbw)->NewIterator());
+        it->Seek(key);
+        BOOST_CHECK(it->Valid());
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << key;
+        BOOST_CHECK(it->GetKeyBytes() == std::vector<unsigned char>(ssKey.begin(), ssKey.end()));
+
+        CDBBatch batch(&dbw2.GetObfuscateKey());
+        batch.WriteBytes(it->GetKeyBytes(), it->GetValueBytes());
+        BOOST_CHECK(dbw2.WriteBatch(batch));
+
+        uint256 res;
+        BOOST_CHECK(dbw2.Read(key, res));
+        BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+    }
+}
+
 // Test that we do not obfuscation if there is existing data.
 BOOST_AUTO_TEST_CASE(existing_data_no_obfuscate)
 {
@@ -1,5 +1,6 @@
 // Copyright (c) 2017-2018 The Popchain Core Developers
 
+#include "nameclaim.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -100,6 +101,81 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolClaimIndexTest)
+{
+    TestMemPoolEntryHelper entry;
+    std::string sName1("atest");
+    std::string sName2("btest");
+    std::vector<unsigned char> vchName1(sName1.begin(), sName1.end());
+    std::vector<unsigned char> vchName2(sName2.begin(), sName2.end());
+    std::vector<unsigned char> vchValue(20, 'x');
+
+    // A new claim for each name, plus an ordinary output
+    CMutableTransaction txClaim;
+    txClaim.vin.resize(1);
+    txClaim.vin[0].scriptSig = CScript() << OP_11;
+    txClaim.vout.resize(3);
+    txClaim.vout[0].scriptPubKey = CScript() << OP_CLAIM_NAME << vchName1 << vchValue << OP_2DROP << OP_DROP << OP_TRUE;
+    txClaim.vout[0].nValue = 10000LL;
+    txClaim.vout[1].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txClaim.vout[1].nValue = 20000LL;
+    txClaim.vout[2].scriptPubKey = CScript() << OP_CLAIM_NAME << vchName2 << vchValue << OP_2DROP << OP_DROP << OP_TRUE;
+    txClaim.vout[2].nValue = 30000LL;
+    uint160 claimId = ClaimIdHash(txClaim.GetHash(), 0);
+    std::vector<unsigned char> vchClaimId(claimId.begin(), claimId.end());
+
+    // An update of the first claim and a support for it
+    CMutableTransaction txUpdate;
+    txUpdate.vin.resize(1);
+    txUpdate.vin[0].scriptSig = CScript() << OP_11;
+    txUpdate.vin[0].prevout.hash = txClaim.GetHash();
+    txUpdate.vin[0].prevout.n = 0;
+    txUpdate.vout.resize(2);
+    txUpdate.vout[0].scriptPubKey = CScript() << OP_UPDATE_CLAIM << vchName1 << vchClaimId << vchValue << OP_2DROP << OP_2DROP << OP_TRUE;
+    txUpdate.vout[0].nValue = 9000LL;
+    txUpdate.vout[1].scriptPubKey = CScript() << OP_SUPPORT_CLAIM << vchName1 << vchClaimId << OP_2DROP << OP_DROP << OP_TRUE;
+    txUpdate.vout[1].nValue = 500LL;
+
+    CTxMemPool testPool(CFeeRate(0));
+    std::vector<CMempoolClaim> claims;
+
+    testPool.addUnchecked(txClaim.GetHash(), entry.Time(1).FromTx(txClaim));
+    testPool.addUnchecked(txUpdate.GetHash(), entry.Time(2).FromTx(txUpdate));
+
+    BOOST_CHECK(testPool.getClaimIndex(sName1, claims));
+    BOOST_CHECK_EQUAL(claims.size(), 3);
+    BOOST_CHECK(claims[0].op == OP_CLAIM_NAME);
+    BOOST_CHECK(claims[0].outPoint == COutPoint(txClaim.GetHash(), 0));
+    BOOST_CHECK(claims[0].claimId == claimId);
+    BOOST_CHECK_EQUAL(claims[0].nAmount, 10000LL);
+    BOOST_CHECK_EQUAL(claims[0].nTime, 1);
+    BOOST_CHECK(claims[1].op == OP_UPDATE_CLAIM);
+    BOOST_CHECK(claims[1].outPoint == COutPoint(txUpdate.GetHash(), 0));
+    BOOST_CHECK(claims[1].claimId == claimId);
+    BOOST_CHECK(claims[2].op == OP_SUPPORT_CLAIM);
+    BOOST_CHECK(claims[2].outPoint == COutPoint(txUpdate.GetHash(), 1));
+    BOOST_CHECK(claims[2].claimId == claimId);
+
+    claims.clear();
+    testPool.getClaimIndex(sName2, claims);
+    BOOST_CHECK_EQUAL(claims.size(), 1);
+    BOOST_CHECK(claims[0].outPoint == COutPoint(txClaim.GetHash(), 2));
+    BOOST_CHECK(claims[0].claimId == ClaimIdHash(txClaim.GetHash(), 2));
+
+    // Entries leave the index with their transaction
+    std::list<CTransaction> removed;
+    testPool.remove(txUpdate, removed);
+    claims.clear();
+    testPool.getClaimIndex(sName1, claims);
+    BOOST_CHECK_EQUAL(claims.size(), 1);
+    BOOST_CHECK(claims[0].outPoint == COutPoint(txClaim.GetHash(), 0));
+
+    testPool.clear();
+    claims.clear();
+    testPool.getClaimIndex(sName2, claims);
+    BOOST_CHECK(claims.empty());
+}
+
 template<int index>
 void CheckSort(CTxMemPool &pool, std::vector<std::string> &sortedOrder)
 {
@@ -316,6 +392,75 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
 }
 
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorStateTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_11;
+    tx1.vout.resize(2);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    tx1.vout[1].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[1].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(1000LL).SigOps(1).FromTx(tx1));
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vin[0].scriptSig = CScript() << OP_11;
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(2000LL).SigOps(2).FromTx(tx2));
+
+    // Spends both tx1 and tx2; tx1 must only be counted once
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(2);
+    tx3.vin[0].prevout = COutPoint(tx1.GetHash(), 1);
+    tx3.vin[0].scriptSig = CScript() << OP_11;
+    tx3.vin[1].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vin[1].scriptSig = CScript() << OP_11;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 20 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(4000LL).SigOps(4).FromTx(tx3));
+
+    uint64_t size1 = ::GetSerializeSize(tx1, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t size2 = ::GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t size3 = ::GetSerializeSize(tx3, SER_NETWORK, PROTOCOL_VERSION);
+
+    CTxMemPool::txiter it3 = pool.mapTx.find(tx3.GetHash());
+    BOOST_CHECK_EQUAL(it3->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(it3->GetSizeWithAncestors(), size1 + size2 + size3);
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 7000);
+    BOOST_CHECK_EQUAL(it3->GetSigOpCountWithAncestors(), 7);
+
+    // tx3 pays for its parents, so it leads the ancestor fee rate index
+    BOOST_CHECK(pool.mapTx.get<4>().begin()->GetTx().GetHash() == tx3.GetHash());
+
+    // A fee delta on tx1 shows up in its descendants' ancestor fees
+    pool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 0.0, 500LL);
+    CTxMemPool::txiter it2 = pool.mapTx.find(tx2.GetHash());
+    BOOST_CHECK_EQUAL(it2->GetModFeesWithAncestors(), 3500);
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 7500);
+
+    // Once tx1 is mined, it is no longer counted as an ancestor
+    std::vector<CTransaction> vtx;
+    vtx.push_back(tx1);
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts, false);
+    BOOST_CHECK_EQUAL(it2->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it2->GetSizeWithAncestors(), size2);
+    BOOST_CHECK_EQUAL(it2->GetModFeesWithAncestors(), 2000);
+    BOOST_CHECK_EQUAL(it3->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(it3->GetSizeWithAncestors(), size2 + size3);
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 6000);
+    BOOST_CHECK_EQUAL(it3->GetSigOpCountWithAncestors(), 6);
+}
+
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
     CTxMemPool pool(CFeeRate(1000));
@@ -349,4 +349,68 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 
 }
 
+
+BOOST_AUTO_TEST_CASE(BlockAssembler_packages)
+{
+    const CChainParams& chainparams = Params(CBaseChainParams::TESTNET);
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    mapArgs["-blockprioritysize"] = "0";
+
+    // A parent paying nothing with a child that pays for both
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_1;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(0).FromTx(txParent));
+
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_1;
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(100000LL).FromTx(txChild));
+
+    // A lone transaction with a better fee rate than the parent on its own,
+    // but a worse one than the parent and child together
+    CMutableTransaction txLone;
+    txLone.vin.resize(1);
+    txLone.vin[0].scriptSig = CScript() << OP_2;
+    txLone.vout.resize(1);
+    txLone.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txLone.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(txLone.GetHash(), entry.Fee(20000LL).FromTx(txLone));
+
+    // A free spend of the lone transaction is only worth its own fee once
+    // its parent is in the block, and is left out
+    CMutableTransaction txFree;
+    txFree.vin.resize(1);
+    txFree.vin[0].scriptSig = CScript() << OP_1;
+    txFree.vin[0].prevout = COutPoint(txLone.GetHash(), 0);
+    txFree.vout.resize(1);
+    txFree.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txFree.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(txFree.GetHash(), entry.Fee(0).FromTx(txFree));
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(chainparams, pool).SelectTransactions(1, GetTime()));
+    const std::vector<CTransaction>& vtx = pblocktemplate->block.vtx;
+    BOOST_CHECK_EQUAL(vtx.size(), 4);
+    BOOST_CHECK(vtx[1].GetHash() == txParent.GetHash());
+    BOOST_CHECK(vtx[2].GetHash() == txChild.GetHash());
+    BOOST_CHECK(vtx[3].GetHash() == txLone.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[2], 100000LL);
+
+    // Prioritising the free spend puts it in after its parent
+    pool.PrioritiseTransaction(txFree.GetHash(), txFree.GetHash().ToString(), 0.0, 50000LL);
+    pblocktemplate.reset(BlockAssembler(chainparams, pool).SelectTransactions(1, GetTime()));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 5);
+    BOOST_CHECK(pblocktemplate->block.vtx[4].GetHash() == txFree.GetHash());
+
+    mapArgs.erase("-blockprioritysize");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -205,4 +205,71 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 }
 
+BOOST_AUTO_TEST_CASE(BlockPolicyEstimatesPersist)
+{
+    CTxMemPool mpool(CFeeRate(10000));
+    TestMemPoolEntryHelper entry;
+    CAmount basefee(20000);
+    std::list<CTransaction> dummyConflicted;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue=0LL;
+
+    // Fee transactions at ten fee levels, the higher ones mined sooner
+    std::vector<uint256> txHashes[10];
+    std::vector<CTransaction> block;
+    int blocknum = 0;
+    while (blocknum < 100) {
+        for (int j = 0; j < 10; j++) {
+            for (int k = 0; k < 4; k++) {
+                tx.vin[0].prevout.n = 10000*blocknum+100*j+k;
+                uint256 hash = tx.GetHash();
+                mpool.addUnchecked(hash, entry.Fee(basefee * (j+1)).Time(GetTime()).Priority(0).Height(blocknum).FromTx(tx, &mpool));
+                txHashes[j].push_back(hash);
+            }
+        }
+        // Mine everything in the tenth block, so nothing is left unconfirmed at the end
+        for (int h = 0; h <= blocknum%10; h++) {
+            while (txHashes[9-h].size()) {
+                CTransaction btx;
+                if (mpool.lookup(txHashes[9-h].back(), btx))
+                    block.push_back(btx);
+                txHashes[9-h].pop_back();
+            }
+        }
+        mpool.removeForBlock(block, ++blocknum, dummyConflicted);
+        block.clear();
+    }
+    BOOST_CHECK(mpool.size() == 0);
+
+    // Everything is mined within 10 blocks
+    BOOST_CHECK(mpool.estimateFee(10).GetFeePerK() > 0);
+
+    // Estimates read back from a file match the ones that were written, up
+    // to rounding
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(mpool.WriteFeeEstimates(file));
+    rewind(file.Get());
+    CTxMemPool mpoolRead(CFeeRate(10000));
+    BOOST_CHECK(mpoolRead.ReadFeeEstimates(file));
+    for (int i = 1; i <= 10; i++) {
+        CAmount nFee = mpool.estimateFee(i).GetFeePerK();
+        CAmount nFeeRead = mpoolRead.estimateFee(i).GetFeePerK();
+        BOOST_CHECK(nFeeRead <= nFee + 1 && nFeeRead + 1 >= nFee);
+    }
+
+    // Both keep decaying the same way as blocks come in
+    for (int i = 0; i < 50; i++) {
+        mpool.removeForBlock(block, ++blocknum, dummyConflicted);
+        mpoolRead.removeForBlock(block, blocknum, dummyConflicted);
+    }
+    for (int i = 1; i <= 10; i++) {
+        CAmount nFee = mpool.estimateFee(i).GetFeePerK();
+        CAmount nFeeRead = mpoolRead.estimateFee(i).GetFeePerK();
+        BOOST_CHECK(nFeeRead <= nFee + 1 && nFeeRead + 1 >= nFee);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
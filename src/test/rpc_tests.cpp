@@ -9,6 +9,7 @@
 #include "test/test_pop.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
 
 #include <univalue.h>
@@ -305,4 +306,64 @@ BOOST_AUTO_TEST_CASE(rpc_ban)
     BOOST_CHECK_EQUAL(adr.get_str(), "2001:4d48:ac57:400:cacf:e9ff:fe1d:9c63/128");
 }
 
+static bool DispatchOnNewThread(boost::thread_group* group, const boost::function<void(void)>& func)
+{
+    group->create_thread(func);
+    return true;
+}
+
+static UniValue BatchRequest(int id, const std::string& method, const UniValue& params)
+{
+    UniValue req(UniValue::VOBJ);
+    req.push_back(Pair("id", id));
+    req.push_back(Pair("method", method));
+    req.push_back(Pair("params", params));
+    return req;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch)
+{
+    SetRPCWarmupFinished();
+
+    // Mix elements that get dispatched (decodescript) with ones that run on
+    // the calling thread (getblockcount) and ones that fail.
+    UniValue vReq(UniValue::VARR);
+    for (int i = 0; i < 20; i++) {
+        UniValue params(UniValue::VARR);
+        if (i % 5 == 4) {
+            vReq.push_back(BatchRequest(i, "nosuchmethod", params));
+        } else if (i % 2) {
+            vReq.push_back(BatchRequest(i, "getblockcount", params));
+        } else {
+            params.push_back("51");
+            vReq.push_back(BatchRequest(i, "decodescript", params));
+        }
+    }
+
+    boost::thread_group group;
+    UniValue reply;
+    BOOST_CHECK(reply.read(JSONRPCExecBatch(vReq, boost::bind(&DispatchOnNewThread, &group, _1))));
+    group.join_all();
+
+    BOOST_CHECK_EQUAL(reply.size(), vReq.size());
+    for (unsigned int i = 0; i < reply.size(); i++) {
+        BOOST_CHECK_EQUAL(find_value(reply[i], "id").get_int(), (int)i);
+        if (i % 5 == 4) {
+            BOOST_CHECK(find_value(reply[i], "result").isNull());
+            BOOST_CHECK_EQUAL(find_value(find_value(reply[i], "error"), "code").get_int(), RPC_METHOD_NOT_FOUND);
+        } else if (i % 2) {
+            BOOST_CHECK(find_value(reply[i], "error").isNull());
+            BOOST_CHECK_EQUAL(find_value(reply[i], "result").get_int(), 0);
+        } else {
+            BOOST_CHECK(find_value(reply[i], "error").isNull());
+            BOOST_CHECK_EQUAL(find_value(find_value(reply[i], "result"), "asm").get_str(), "1");
+        }
+    }
+
+    // Without a dispatcher everything runs in order on the calling thread
+    UniValue serial;
+    BOOST_CHECK(serial.read(JSONRPCExecBatch(vReq)));
+    BOOST_CHECK_EQUAL(serial.write(), reply.write());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -114,4 +114,49 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+static void countTask(boost::mutex& mutex, int& counter)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    counter++;
+}
+
+BOOST_AUTO_TEST_CASE(recurring_and_far_tasks)
+{
+    CScheduler s;
+    boost::mutex counterMutex;
+    int nRecurring = 0;
+    int nOnce = 0;
+
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    s.scheduleEveryMs(boost::bind(&countTask, boost::ref(counterMutex), boost::ref(nRecurring)), 10, "recurring");
+    // Due in the first, second and last wheel level and beyond the wheel
+    s.schedule(boost::bind(&countTask, boost::ref(counterMutex), boost::ref(nOnce)), now + boost::chrono::milliseconds(20));
+    s.schedule(boost::bind(&countTask, boost::ref(counterMutex), boost::ref(nOnce)), now + boost::chrono::milliseconds(300));
+    s.schedule(boost::bind(&countTask, boost::ref(counterMutex), boost::ref(nOnce)), now + boost::chrono::hours(24));
+    s.schedule(boost::bind(&countTask, boost::ref(counterMutex), boost::ref(nOnce)), now + boost::chrono::hours(24 * 100));
+
+    boost::chrono::system_clock::time_point first, last;
+    BOOST_CHECK_EQUAL(s.getQueueInfo(first, last), 5U);
+    BOOST_CHECK(last == now + boost::chrono::hours(24 * 100));
+
+    boost::thread_group threads;
+    for (int i = 0; i < 2; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &s));
+    MicroSleep(500000);
+    s.stop(false);
+    threads.join_all();
+    // A slow machine may oversleep, so bound the runs by the time that actually passed
+    int64_t nElapsedMs = boost::chrono::duration_cast<boost::chrono::milliseconds>(boost::chrono::system_clock::now() - now).count();
+
+    // The recurring task stays queued, as do the two far ones
+    BOOST_CHECK_EQUAL(s.getQueueInfo(first, last), 3U);
+    BOOST_CHECK_EQUAL(nOnce, 2);
+    BOOST_CHECK(nRecurring >= 10 && nRecurring <= nElapsedMs / 10 + 1);
+
+    std::map<std::string, CSchedulerTaskStats> mapStats = s.getTaskStats();
+    BOOST_CHECK_EQUAL(mapStats.size(), 1U);
+    BOOST_CHECK_EQUAL(mapStats["recurring"].nRuns, (uint64_t)nRecurring);
+    BOOST_CHECK(mapStats["recurring"].nMaxRunMicros <= mapStats["recurring"].nRunMicros);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
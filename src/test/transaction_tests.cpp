@@ -402,4 +402,30 @@ BOOST_AUTO_TEST_CASE(test_IsStandard)
     BOOST_CHECK(!IsStandardTx(t, reason));
 }
 
+BOOST_AUTO_TEST_CASE(test_TotalSize)
+{
+    CMutableTransaction mtx;
+    BOOST_CHECK_EQUAL(CTransaction().GetTotalSize(), ::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION));
+
+    mtx.vin.resize(2);
+    mtx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(300, 1);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    CTransaction tx(mtx);
+    unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK_EQUAL(tx.GetTotalSize(), nSize);
+
+    // Kept through deserialization and assignment
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    CTransaction txRead;
+    ss >> txRead;
+    BOOST_CHECK_EQUAL(txRead.GetTotalSize(), nSize);
+    CTransaction txAssigned;
+    txAssigned = tx;
+    BOOST_CHECK_EQUAL(txAssigned.GetTotalSize(), nSize);
+    BOOST_CHECK_EQUAL(tx.CalculateModifiedSize(), tx.CalculateModifiedSize(nSize));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
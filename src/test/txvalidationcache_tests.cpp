@@ -1,5 +1,6 @@
 // Copyright (c) 2017-2018 The Popchain Core Developers
 
+#include "chainparams.h"
 #include "consensus/validation.h"
 #include "key.h"
 #include "main.h"
@@ -80,4 +81,100 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+static CMutableTransaction
+SignedSpend(const CKey& key, const CScript& scriptPubKey, const COutPoint& prevout, int nOutputs, CAmount nValue, bool fBadSig)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vout.resize(nOutputs);
+    for (int i = 0; i < nOutputs; i++) {
+        tx.vout[i].nValue = nValue;
+        tx.vout[i].scriptPubKey = scriptPubKey;
+    }
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    if (fBadSig)
+        vchSig[10] ^= 1;
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+BOOST_FIXTURE_TEST_CASE(spent_outpoint_heights, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    COutPoint outpoint(coinbaseTxns[0].GetHash(), 0);
+    int nCreated = GetUTXOHeight(outpoint);
+    BOOST_CHECK(nCreated > 0);
+    int nHeight = -1;
+    BOOST_CHECK(!GetSpentOutPointHeight(outpoint, nHeight));
+
+    CMutableTransaction split = SignedSpend(coinbaseKey, scriptPubKey, outpoint, 2, 11*CENT, false);
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, split), scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    int nSplit = chainActive.Height();
+
+    // Spent outpoints are gone from the UTXO set but their height is still known
+    BOOST_CHECK_EQUAL(GetUTXOHeight(outpoint), -1);
+    BOOST_CHECK(GetSpentOutPointHeight(outpoint, nHeight));
+    BOOST_CHECK_EQUAL(nHeight, nCreated);
+
+    // Spending one of several outputs leaves the others, and its undo data without a height
+    COutPoint outpointSplit(split.GetHash(), 0);
+    CMutableTransaction spend = SignedSpend(coinbaseKey, scriptPubKey, outpointSplit, 1, 10*CENT, false);
+    block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(GetUTXOHeight(COutPoint(split.GetHash(), 1)), nSplit);
+    BOOST_CHECK(GetSpentOutPointHeight(outpointSplit, nHeight));
+    BOOST_CHECK_EQUAL(nHeight, nSplit);
+
+    // ... until the block that spent them is disconnected
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        InvalidateBlock(state, Params().GetConsensus(), chainActive.Tip());
+    }
+    BOOST_CHECK(!GetSpentOutPointHeight(outpointSplit, nHeight));
+    BOOST_CHECK_EQUAL(GetUTXOHeight(outpointSplit), nSplit);
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_mempool_batch, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // A spend of a mature coinbase and, in the same batch, spends of its
+    // outputs: one with a bad signature, one double spend and a grandchild
+    CMutableTransaction parent = SignedSpend(coinbaseKey, scriptPubKey, COutPoint(coinbaseTxns[0].GetHash(), 0), 4, 10*CENT, false);
+    std::vector<CMutableTransaction> vmtx;
+    vmtx.push_back(parent);
+    vmtx.push_back(SignedSpend(coinbaseKey, scriptPubKey, COutPoint(parent.GetHash(), 0), 1, 9*CENT, false));
+    vmtx.push_back(SignedSpend(coinbaseKey, scriptPubKey, COutPoint(parent.GetHash(), 1), 1, 9*CENT, false));
+    vmtx.push_back(SignedSpend(coinbaseKey, scriptPubKey, COutPoint(parent.GetHash(), 2), 1, 9*CENT, true));
+    vmtx.push_back(SignedSpend(coinbaseKey, scriptPubKey, COutPoint(parent.GetHash(), 2), 1, 9*CENT, false));
+    vmtx.push_back(SignedSpend(coinbaseKey, scriptPubKey, COutPoint(parent.GetHash(), 1), 1, 8*CENT, false));
+    vmtx.push_back(SignedSpend(coinbaseKey, scriptPubKey, COutPoint(vmtx[1].GetHash(), 0), 1, 8*CENT, false));
+    std::vector<CTransaction> vtx(vmtx.begin(), vmtx.end());
+
+    std::vector<CValidationState> vState;
+    std::vector<char> vAccepted, vMissingInputs;
+    AcceptToMemoryPoolBatch(mempool, vtx, false, false, false, vState, vAccepted, vMissingInputs);
+
+    BOOST_CHECK_EQUAL(vAccepted.size(), vtx.size());
+    BOOST_CHECK(vAccepted[0] && vAccepted[1] && vAccepted[2] && vAccepted[4] && vAccepted[6]);
+    BOOST_CHECK(!vAccepted[3]);
+    BOOST_CHECK(vState[3].IsInvalid());
+    BOOST_CHECK(!vAccepted[5]);
+    BOOST_CHECK_EQUAL(vState[5].GetRejectReason(), "txn-mempool-conflict");
+    BOOST_CHECK_EQUAL(mempool.size(), 5U);
+
+    // The same batch again adds nothing
+    AcceptToMemoryPoolBatch(mempool, vtx, false, false, false, vState, vAccepted, vMissingInputs);
+    for (size_t i = 0; i < vtx.size(); i++)
+        BOOST_CHECK(!vAccepted[i]);
+    BOOST_CHECK_EQUAL(vState[0].GetRejectReason(), "txn-already-in-mempool");
+    BOOST_CHECK_EQUAL(mempool.size(), 5U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,59 @@
+// Copyright (c) 2017-2018 The Popchain Core Developers
+
+#include "validationstats.h"
+#include "test/test_pop.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(validationstats_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(latency_histogram)
+{
+    CLatencyHistogram hist;
+    BOOST_CHECK_EQUAL(hist.GetCount(), 0U);
+    BOOST_CHECK_EQUAL(hist.GetQuantile(0.5), 0.0);
+
+    // 90 fast samples and 10 slow ones
+    for (int i = 0; i < 90; i++)
+        hist.Add(100);
+    for (int i = 0; i < 10; i++)
+        hist.Add(100000);
+    BOOST_CHECK_EQUAL(hist.GetCount(), 100U);
+    BOOST_CHECK_EQUAL(hist.GetTotal(), 90 * 100 + 10 * 100000);
+    BOOST_CHECK_EQUAL(hist.GetMax(), 100000);
+
+    // 100us lands in the [64, 128) bucket, 100ms in [65536, 131072) capped at the max
+    double dMedian = hist.GetQuantile(0.5);
+    BOOST_CHECK(dMedian >= 64 && dMedian < 128);
+    double dTail = hist.GetQuantile(0.99);
+    BOOST_CHECK(dTail >= 65536 && dTail <= 100000);
+    BOOST_CHECK_EQUAL(hist.GetQuantile(1.0), 100000.0);
+
+    // Negative durations (clock adjustments) count as zero
+    hist.Add(-5);
+    BOOST_CHECK_EQUAL(hist.GetCount(), 101U);
+    BOOST_CHECK_EQUAL(hist.GetTotal(), 90 * 100 + 10 * 100000);
+
+    hist.Reset();
+    BOOST_CHECK_EQUAL(hist.GetCount(), 0U);
+    BOOST_CHECK_EQUAL(hist.GetMax(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(validation_counters)
+{
+    ResetValidationStats();
+    RecordValidationTime(VSTAGE_POW_HASH, 250);
+    AddValidationCount(VCOUNT_INPUTS, 7);
+    AddValidationCount(VCOUNT_INPUTS);
+    BOOST_CHECK_EQUAL(GetValidationHistogram(VSTAGE_POW_HASH).GetCount(), 1U);
+    BOOST_CHECK_EQUAL(GetValidationCount(VCOUNT_INPUTS), 8U);
+
+    std::string strText = FormatValidationStatsText();
+    BOOST_CHECK(strText.find("pop_validation_seconds_count{stage=\"pow_hash\"} 1\n") != std::string::npos);
+    BOOST_CHECK(strText.find("pop_validation_items_total{item=\"inputs\"} 8\n") != std::string::npos);
+
+    ResetValidationStats();
+    BOOST_CHECK_EQUAL(GetValidationCount(VCOUNT_INPUTS), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,7 @@
 #include "chain.h"
 #include "chainparams.h"
 #include "hash.h"
+#include "indexwriter.h"
 #include "main.h"
 #include "pow.h"
 #include "uint256.h"
@@ -22,18 +23,20 @@ static const char DB_ADDRESSINDEX = 'a';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
 static const char DB_TIMESTAMPINDEX = 's';
 static const char DB_SPENTINDEX = 'p';
+static const char DB_INDEX_TIP = 'I';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_SNAPSHOT_UNCLES = 'U';
 
 /*popchain ghost*/
 static const char DB_TOTALDIFFICULT = 'd';//key is DB_TOTALDIFFICULT +  hash + height
 /*popchain ghost*/
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", CDBOptions("chainstate", nCacheSize), fMemory, fWipe, true) 
 {
 }
 
@@ -53,10 +56,16 @@ uint256 CCoinsViewDB::GetBestBlock() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    bool fOk = WriteCoins(mapCoins, hashBlock);
+    mapCoins.clear();
+    return fOk;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CDBBatch batch(&db.GetObfuscateKey());
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             if (it->second.coins.IsPruned())
                 batch.Erase(make_pair(DB_COINS, it->first));
@@ -65,8 +74,6 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
@@ -75,7 +82,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", CDBOptions("blockindex", nCacheSize), fMemory, fWipe) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -144,6 +151,55 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     return true;
 }
 
+CCoinsViewCursor *CCoinsViewDB::Cursor() const
+{
+    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper*>(&db)->NewIterator(), GetBestBlock());
+    i->pcursor->Seek(DB_COINS);
+    // Cache the key of the first entry so Valid() needs no deserialization
+    if (!i->pcursor->Valid() || !i->pcursor->GetKey(i->keyTmp))
+        i->keyTmp.first = 0;
+    return i;
+}
+
+CCoinsViewDBCursor::CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn) : CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn)
+{
+}
+
+CCoinsViewDBCursor::~CCoinsViewDBCursor()
+{
+    delete pcursor;
+}
+
+bool CCoinsViewDBCursor::Valid() const
+{
+    return keyTmp.first == DB_COINS;
+}
+
+bool CCoinsViewDBCursor::GetKey(uint256 &txid) const
+{
+    if (!Valid())
+        return false;
+    txid = keyTmp.second;
+    return true;
+}
+
+bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
+{
+    return pcursor->GetValue(coins);
+}
+
+unsigned int CCoinsViewDBCursor::GetValueSize() const
+{
+    return pcursor->GetValueSize();
+}
+
+void CCoinsViewDBCursor::Next()
+{
+    pcursor->Next();
+    if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
+        keyTmp.first = 0; // Past the last coins entry
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(&GetObfuscateKey());
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
@@ -295,6 +351,51 @@ bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned i
     return true;
 }
 
+bool CBlockTreeDB::WriteIndexDeltas(const std::vector<CIndexDelta> &vDeltas) {
+    if (vDeltas.empty())
+        return true;
+    CDBBatch batch(&GetObfuscateKey());
+    // Later deltas may touch keys written by earlier ones; a batch applies its operations in order.
+    for (std::vector<CIndexDelta>::const_iterator it = vDeltas.begin(); it != vDeltas.end(); it++) {
+        for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator ait = it->vAddressIndex.begin(); ait != it->vAddressIndex.end(); ait++) {
+            if (it->fConnect)
+                batch.Write(make_pair(DB_ADDRESSINDEX, ait->first), ait->second);
+            else
+                batch.Erase(make_pair(DB_ADDRESSINDEX, ait->first));
+        }
+        for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator uit = it->vAddressUnspentIndex.begin(); uit != it->vAddressUnspentIndex.end(); uit++) {
+            if (uit->second.IsNull())
+                batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, uit->first));
+            else
+                batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, uit->first), uit->second);
+        }
+        for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator sit = it->vSpentIndex.begin(); sit != it->vSpentIndex.end(); sit++) {
+            if (sit->second.IsNull())
+                batch.Erase(make_pair(DB_SPENTINDEX, sit->first));
+            else
+                batch.Write(make_pair(DB_SPENTINDEX, sit->first), sit->second);
+        }
+        for (std::vector<CTimestampIndexKey>::const_iterator tit = it->vTimestampIndex.begin(); tit != it->vTimestampIndex.end(); tit++)
+            batch.Write(make_pair(DB_TIMESTAMPINDEX, *tit), 0);
+        for (std::vector<std::pair<int, CBlockFileInfo> >::const_iterator fit = it->vBlockFiles.begin(); fit != it->vBlockFiles.end(); fit++)
+            batch.Write(make_pair(DB_BLOCK_FILES, fit->first), fit->second);
+        for (std::vector<CDiskBlockIndex>::const_iterator bit = it->vBlockIndex.begin(); bit != it->vBlockIndex.end(); bit++)
+            batch.Write(make_pair(DB_BLOCK_INDEX, bit->GetBlockHash()), *bit);
+        if (it->nLastBlockFile >= 0)
+            batch.Write(DB_LAST_BLOCK, it->nLastBlockFile);
+    }
+    batch.Write(DB_INDEX_TIP, vDeltas.back().hashTip);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::WriteIndexTip(const uint256 &hashTip) {
+    return Write(DB_INDEX_TIP, hashTip);
+}
+
+bool CBlockTreeDB::ReadIndexTip(uint256 &hashTip) {
+    return Read(DB_INDEX_TIP, hashTip);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -307,6 +408,14 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::WriteSnapshotUncles(const std::vector<std::pair<uint256, std::vector<uint256> > > &vUncles) {
+    return Write(DB_SNAPSHOT_UNCLES, vUncles);
+}
+
+bool CBlockTreeDB::ReadSnapshotUncles(std::vector<std::pair<uint256, std::vector<uint256> > > &vUncles) {
+    return Read(DB_SNAPSHOT_UNCLES, vUncles);
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
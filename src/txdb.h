@@ -23,6 +23,7 @@ struct CTimestampIndexKey;
 struct CTimestampIndexIteratorKey;
 struct CSpentIndexKey;
 struct CSpentIndexValue;
+struct CIndexDelta;
 
 /*popchain ghost*/
 struct CBlockTdKey;
@@ -53,7 +54,33 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! Like BatchWrite, but leaves mapCoins untouched so other threads may keep reading it
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+    CCoinsViewCursor *Cursor() const;
+};
+
+/** Cursor over the coin database. Sees the database as it was when created. */
+class CCoinsViewDBCursor : public CCoinsViewCursor
+{
+public:
+    ~CCoinsViewDBCursor();
+
+    bool Valid() const;
+    bool GetKey(uint256 &txid) const;
+    bool GetValue(CCoins &coins) const;
+    unsigned int GetValueSize() const;
+    void Next();
+
+private:
+    CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn);
+    CCoinsViewDBCursor(const CCoinsViewDBCursor&);
+    void operator=(const CCoinsViewDBCursor&);
+
+    CDBIterator *pcursor;
+    std::pair<char, uint256> keyTmp;
+
+    friend class CCoinsViewDB;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -84,8 +111,13 @@ public:
                           int start = 0, int end = 0);
     bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
+    bool WriteIndexDeltas(const std::vector<CIndexDelta> &vDeltas);
+    bool WriteIndexTip(const uint256 &hashTip);
+    bool ReadIndexTip(uint256 &hashTip);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    bool WriteSnapshotUncles(const std::vector<std::pair<uint256, std::vector<uint256> > > &vUncles);
+    bool ReadSnapshotUncles(std::vector<std::pair<uint256, std::vector<uint256> > > &vUncles);
     bool LoadBlockIndexGuts();
 	/*popchain ghost*/
 	bool WriteTd(CBlockTdKey &key, uint256 td);
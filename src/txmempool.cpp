@@ -6,6 +6,7 @@
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "nameclaim.h"
 #include "policy/fees.h"
 #include "streams.h"
 #include "timedata.h"
@@ -25,13 +26,17 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
     hadNoDependencies(poolHasNoInputsOf), inChainInputValue(_inChainInputValue),
     spendsCoinbase(_spendsCoinbase), sigOpCount(_sigOps), lockPoints(lp)
 {
-    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    nTxSize = tx.GetTotalSize();
     nModSize = tx.CalculateModifiedSize(nTxSize);
     nUsageSize = RecursiveDynamicUsage(tx);
 
     nCountWithDescendants = 1;
     nSizeWithDescendants = nTxSize;
     nModFeesWithDescendants = nFee;
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
+    nSigOpCountWithAncestors = sigOpCount;
     CAmount nValueIn = tx.GetValueOut()+nFee;
     assert(inChainInputValue <= nValueIn);
 
@@ -56,6 +61,7 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 void CTxMemPoolEntry::UpdateFeeDelta(int64_t newFeeDelta)
 {
     nModFeesWithDescendants += newFeeDelta - feeDelta;
+    nModFeesWithAncestors += newFeeDelta - feeDelta;
     feeDelta = newFeeDelta;
 }
 
@@ -121,6 +127,7 @@ bool CTxMemPool::UpdateForDescendants(txiter updateIt, int maxDescendantsToVisit
             modifyFee += cit->GetModifiedFee();
             modifyCount++;
             cachedDescendants[updateIt].insert(cit);
+            mapTx.modify(cit, update_ancestor_state(updateIt->GetTxSize(), updateIt->GetModifiedFee(), 1, updateIt->GetSigOpCount()));
         }
     }
     mapTx.modify(updateIt, update_descendant_state(modifySize, modifyFee, modifyCount));
@@ -173,11 +180,18 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
         if (!UpdateForDescendants(it, 100, mapMemPoolDescendantsToUpdate, setAlreadyIncluded)) {
             // Mark as dirty if we can't do the calculation.
             mapTx.modify(it, set_dirty());
+            // The descendants' ancestor state gets no such shortcut
+            setEntries setDescendants;
+            CalculateDescendants(it, setDescendants);
+            BOOST_FOREACH(txiter dit, setDescendants) {
+                if (dit != it && !setAlreadyIncluded.count(dit->GetTx().GetHash()))
+                    mapTx.modify(dit, update_ancestor_state(it->GetTxSize(), it->GetModifiedFee(), 1, it->GetSigOpCount()));
+            }
         }
     }
 }
 
-bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */)
+bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
 {
     setEntries parentHashes;
     const CTransaction &tx = entry.GetTx();
@@ -254,6 +268,20 @@ void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors
     }
 }
 
+void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncestors)
+{
+    int64_t updateCount = setAncestors.size();
+    int64_t updateSize = 0;
+    CAmount updateFee = 0;
+    int updateSigOps = 0;
+    BOOST_FOREACH(txiter ancestorIt, setAncestors) {
+        updateSize += ancestorIt->GetTxSize();
+        updateFee += ancestorIt->GetModifiedFee();
+        updateSigOps += ancestorIt->GetSigOpCount();
+    }
+    mapTx.modify(it, update_ancestor_state(updateSize, updateFee, updateCount, updateSigOps));
+}
+
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 {
     const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
@@ -264,6 +292,19 @@ void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 
 void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove)
 {
+    // Descendants that stay in the pool (children of a transaction leaving
+    // for a block) no longer have it as an ancestor. This walks the child
+    // links, so it must happen before any of them are severed below.
+    BOOST_FOREACH(txiter removeIt, entriesToRemove) {
+        if (GetMemPoolChildren(removeIt).empty())
+            continue;
+        setEntries setDescendants;
+        CalculateDescendants(removeIt, setDescendants);
+        BOOST_FOREACH(txiter dit, setDescendants) {
+            if (!entriesToRemove.count(dit))
+                mapTx.modify(dit, update_ancestor_state(-(int64_t)removeIt->GetTxSize(), -removeIt->GetModifiedFee(), -1, -(int)removeIt->GetSigOpCount()));
+        }
+    }
     // For each entry, walk back all ancestors and decrement size associated with this
     // transaction
     const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -322,6 +363,17 @@ void CTxMemPoolEntry::UpdateState(int64_t modifySize, CAmount modifyFee, int64_t
     }
 }
 
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount, int modifySigOps)
+{
+    nSizeWithAncestors += modifySize;
+    assert(int64_t(nSizeWithAncestors) > 0);
+    nModFeesWithAncestors += modifyFee;
+    nCountWithAncestors += modifyCount;
+    assert(int64_t(nCountWithAncestors) > 0);
+    nSigOpCountWithAncestors += modifySigOps;
+    assert(int(nSigOpCountWithAncestors) >= 0);
+}
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
     nTransactionsUpdated(0)
 {
@@ -412,6 +464,8 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
         }
     }
     UpdateAncestorsOf(true, newit, setAncestors);
+    UpdateEntryForAncestors(newit, setAncestors);
+    addClaimIndex(*newit);
 
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
@@ -543,6 +597,55 @@ bool CTxMemPool::removeSpentIndex(const uint256 txhash)
     return true;
 }
 
+void CTxMemPool::addClaimIndex(const CTxMemPoolEntry &entry)
+{
+    LOCK(cs);
+    const CTransaction& tx = entry.GetTx();
+    std::vector<mempoolClaimMap::iterator> inserted;
+
+    uint256 txhash = tx.GetHash();
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
+        const CTxOut &out = tx.vout[k];
+        int op;
+        std::vector<std::vector<unsigned char> > vvchParams;
+        if (!DecodeClaimScript(out.scriptPubKey, op, vvchParams))
+            continue;
+        std::string name(vvchParams[0].begin(), vvchParams[0].end());
+        uint160 claimId;
+        if (op == OP_CLAIM_NAME)
+            claimId = ClaimIdHash(txhash, k);
+        else
+            claimId = uint160(vvchParams[1]);
+        CMempoolClaim claim(op, COutPoint(txhash, k), claimId, out.nValue, entry.GetTime());
+        inserted.push_back(mapClaims.insert(std::make_pair(name, claim)));
+    }
+
+    if (!inserted.empty())
+        mapClaimsInserted.insert(make_pair(txhash, inserted));
+}
+
+bool CTxMemPool::getClaimIndex(const std::string &name, std::vector<CMempoolClaim> &results)
+{
+    LOCK(cs);
+    std::pair<mempoolClaimMap::const_iterator, mempoolClaimMap::const_iterator> range = mapClaims.equal_range(name);
+    for (mempoolClaimMap::const_iterator it = range.first; it != range.second; it++)
+        results.push_back(it->second);
+    return true;
+}
+
+void CTxMemPool::removeClaimIndex(const uint256 txhash)
+{
+    LOCK(cs);
+    mempoolClaimMapInserted::iterator it = mapClaimsInserted.find(txhash);
+
+    if (it != mapClaimsInserted.end()) {
+        for (std::vector<mempoolClaimMap::iterator>::iterator mit = it->second.begin(); mit != it->second.end(); mit++) {
+            mapClaims.erase(*mit);
+        }
+        mapClaimsInserted.erase(it);
+    }
+}
+
 void CTxMemPool::removeUnchecked(txiter it)
 {
     const uint256 hash = it->GetTx().GetHash();
@@ -558,6 +661,7 @@ void CTxMemPool::removeUnchecked(txiter it)
     minerPolicyEstimator->removeTx(hash);
     removeAddressIndex(hash);
     removeSpentIndex(hash);
+    removeClaimIndex(hash);
 }
 
 // Calculates descendants of entry that are not already in setDescendants, and adds to
@@ -715,11 +819,14 @@ void CTxMemPool::_clear()
     mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    mapClaims.clear();
+    mapClaimsInserted.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = false;
     rollingMinimumFeeRate = 0;
+    nLastMinFeePerK = 0;
     ++nTransactionsUpdated;
 }
 
@@ -777,6 +884,24 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             i++;
         }
         assert(setParentCheck == GetMemPoolParents(it));
+        // Verify ancestor state is correct.
+        setEntries setAncestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+        uint64_t nCountCheck = setAncestors.size() + 1;
+        uint64_t nSizeCheck = it->GetTxSize();
+        CAmount nFeesCheck = it->GetModifiedFee();
+        unsigned int nSigOpCheck = it->GetSigOpCount();
+        BOOST_FOREACH(txiter ancestorIt, setAncestors) {
+            nSizeCheck += ancestorIt->GetTxSize();
+            nFeesCheck += ancestorIt->GetModifiedFee();
+            nSigOpCheck += ancestorIt->GetSigOpCount();
+        }
+        assert(it->GetCountWithAncestors() == nCountCheck);
+        assert(it->GetSizeWithAncestors() == nSizeCheck);
+        assert(it->GetModFeesWithAncestors() == nFeesCheck);
+        assert(it->GetSigOpCountWithAncestors() == nSigOpCheck);
         // Check children against mapNextTx
         CTxMemPool::setEntries setChildrenCheck;
         std::map<COutPoint, CInPoint>::const_iterator iter = mapNextTx.lower_bound(COutPoint(it->GetTx().GetHash(), 0));
@@ -856,24 +981,35 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     return true;
 }
 
+// The estimator publishes its estimates after every block, so these read
+// them without the mempool lock
+void CTxMemPool::UpdateFeeEstimates() const
+{
+    // Only the first request after a block takes the lock, to compute the estimates
+    if (minerPolicyEstimator->EstimatesStale()) {
+        LOCK(cs);
+        minerPolicyEstimator->UpdateEstimates();
+    }
+}
+
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
 {
-    LOCK(cs);
+    UpdateFeeEstimates();
     return minerPolicyEstimator->estimateFee(nBlocks);
 }
 CFeeRate CTxMemPool::estimateSmartFee(int nBlocks, int *answerFoundAtBlocks) const
 {
-    LOCK(cs);
+    UpdateFeeEstimates();
     return minerPolicyEstimator->estimateSmartFee(nBlocks, answerFoundAtBlocks, *this);
 }
 double CTxMemPool::estimatePriority(int nBlocks) const
 {
-    LOCK(cs);
+    UpdateFeeEstimates();
     return minerPolicyEstimator->estimatePriority(nBlocks);
 }
 double CTxMemPool::estimateSmartPriority(int nBlocks, int *answerFoundAtBlocks) const
 {
-    LOCK(cs);
+    UpdateFeeEstimates();
     return minerPolicyEstimator->estimateSmartPriority(nBlocks, answerFoundAtBlocks, *this);
 }
 
@@ -930,6 +1066,13 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
             BOOST_FOREACH(txiter ancestorIt, setAncestors) {
                 mapTx.modify(ancestorIt, update_descendant_state(0, nFeeDelta, 0));
             }
+            // ... and all descendants' modified fees with ancestors
+            setEntries setDescendants;
+            CalculateDescendants(it, setDescendants);
+            setDescendants.erase(it);
+            BOOST_FOREACH(txiter descendantIt, setDescendants) {
+                mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
+            }
         }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
@@ -1056,8 +1199,10 @@ const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) cons
 
 CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
     LOCK(cs);
-    if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
+    if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0) {
+        nLastMinFeePerK = (CAmount)rollingMinimumFeeRate;
         return CFeeRate(rollingMinimumFeeRate);
+    }
 
     int64_t time = GetTime();
     if (time > lastRollingFeeUpdate + 10) {
@@ -1072,10 +1217,13 @@ CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
 
         if (rollingMinimumFeeRate < minReasonableRelayFee.GetFeePerK() / 2) {
             rollingMinimumFeeRate = 0;
+            nLastMinFeePerK = 0;
             return CFeeRate(0);
         }
     }
-    return std::max(CFeeRate(rollingMinimumFeeRate), minReasonableRelayFee);
+    CFeeRate minFee = std::max(CFeeRate(rollingMinimumFeeRate), minReasonableRelayFee);
+    nLastMinFeePerK = minFee.GetFeePerK();
+    return minFee;
 }
 
 void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
@@ -1083,6 +1231,7 @@ void CTxMemPool::trackPackageRemoved(const CFeeRate& rate) {
     if (rate.GetFeePerK() > rollingMinimumFeeRate) {
         rollingMinimumFeeRate = rate.GetFeePerK();
         blockSinceLastRollingFeeBump = false;
+        nLastMinFeePerK = rate.GetFeePerK();
     }
 }
 
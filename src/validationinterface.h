@@ -6,9 +6,13 @@
 #include <boost/signals2/signal.hpp>
 #include <boost/shared_ptr.hpp>
 
+#include <vector>
+
 class CBlock;
+class CBlockHeader;
 struct CBlockLocator;
 class CBlockIndex;
+class CClaimTrieDelta;
 class CReserveScript;
 class CTransaction;
 class CValidationInterface;
@@ -38,6 +42,8 @@ protected:
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
     virtual void GetScriptForMining(boost::shared_ptr<CReserveScript>&) {};
     virtual void ResetRequestCount(const uint256 &hash) {};
+    virtual void ClaimTrieChanged(const CClaimTrieDelta &delta) {}
+    virtual void NotifyUncles(const CBlockIndex *pindex, const std::vector<CBlockHeader> &vuh) {}
     friend void ::RegisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
@@ -64,6 +70,10 @@ struct CMainSignals {
     boost::signals2::signal<void (boost::shared_ptr<CReserveScript>&)> ScriptForMining;
     /** Notifies listeners that a block has been successfully mined */
     boost::signals2::signal<void (const uint256 &)> BlockFound;
+    /** Notifies listeners of the claim trie changes made by a connected or disconnected block */
+    boost::signals2::signal<void (const CClaimTrieDelta &)> ClaimTrieChanged;
+    /** Notifies listeners of the uncle headers included by a newly connected block */
+    boost::signals2::signal<void (const CBlockIndex *, const std::vector<CBlockHeader> &)> NotifyUncles;
 };
 
 CMainSignals& GetMainSignals();
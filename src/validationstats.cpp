@@ -0,0 +1,150 @@
+// Copyright (c) 2017-2018 The Popchain Core Developers
+
+#include "validationstats.h"
+
+#include "tinyformat.h"
+
+#include <algorithm>
+#include <assert.h>
+
+static const char* const pszStageNames[VSTAGE_MAX] = {
+    "read_block",
+    "prefetch",
+    "pow_hash",
+    "uncles",
+    "claimtrie_update",
+    "claimtrie_root",
+    "script_verify",
+    "index_write",
+    "flush",
+    "chainstate",
+    "callbacks",
+    "connect_block",
+    "connect_tip",
+};
+
+static const char* const pszCounterNames[VCOUNT_MAX] = {
+    "blocks",
+    "transactions",
+    "inputs",
+    "sigops",
+    "claims",
+    "uncles",
+};
+
+static CLatencyHistogram histograms[VSTAGE_MAX];
+static std::atomic<uint64_t> counters[VCOUNT_MAX];
+
+void CLatencyHistogram::Add(int64_t nMicros)
+{
+    if (nMicros < 0)
+        nMicros = 0;
+    int nBucket = 0;
+    for (uint64_t n = nMicros; n != 0 && nBucket < BUCKETS - 1; n >>= 1)
+        nBucket++;
+    vBuckets[nBucket].fetch_add(1, std::memory_order_relaxed);
+    nCount.fetch_add(1, std::memory_order_relaxed);
+    nTotal.fetch_add(nMicros, std::memory_order_relaxed);
+    int64_t nPrevMax = nMax.load(std::memory_order_relaxed);
+    while (nMicros > nPrevMax && !nMax.compare_exchange_weak(nPrevMax, nMicros, std::memory_order_relaxed)) {}
+}
+
+void CLatencyHistogram::Reset()
+{
+    for (int i = 0; i < BUCKETS; i++)
+        vBuckets[i].store(0, std::memory_order_relaxed);
+    nCount.store(0, std::memory_order_relaxed);
+    nTotal.store(0, std::memory_order_relaxed);
+    nMax.store(0, std::memory_order_relaxed);
+}
+
+double CLatencyHistogram::GetQuantile(double dQuantile) const
+{
+    uint64_t vSnapshot[BUCKETS];
+    uint64_t nSamples = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        vSnapshot[i] = vBuckets[i].load(std::memory_order_relaxed);
+        nSamples += vSnapshot[i];
+    }
+    if (nSamples == 0)
+        return 0.0;
+
+    double dRank = dQuantile * nSamples;
+    uint64_t nSeen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        if (vSnapshot[i] == 0 || nSeen + vSnapshot[i] < dRank) {
+            nSeen += vSnapshot[i];
+            continue;
+        }
+        // Interpolate linearly inside the bucket, never beyond the largest sample
+        double dLow = i == 0 ? 0.0 : (double)(1ULL << (i - 1));
+        double dHigh = i == BUCKETS - 1 ? (double)GetMax() : (double)(1ULL << i);
+        double dValue = dLow + (dHigh - dLow) * (dRank - nSeen) / vSnapshot[i];
+        return std::min(dValue, (double)GetMax());
+    }
+    return (double)GetMax();
+}
+
+void RecordValidationTime(ValidationStage stage, int64_t nMicros)
+{
+    assert(stage < VSTAGE_MAX);
+    histograms[stage].Add(nMicros);
+}
+
+void AddValidationCount(ValidationCounter counter, uint64_t n)
+{
+    assert(counter < VCOUNT_MAX);
+    counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+const char* GetValidationStageName(ValidationStage stage)
+{
+    assert(stage < VSTAGE_MAX);
+    return pszStageNames[stage];
+}
+
+const char* GetValidationCounterName(ValidationCounter counter)
+{
+    assert(counter < VCOUNT_MAX);
+    return pszCounterNames[counter];
+}
+
+const CLatencyHistogram& GetValidationHistogram(ValidationStage stage)
+{
+    assert(stage < VSTAGE_MAX);
+    return histograms[stage];
+}
+
+uint64_t GetValidationCount(ValidationCounter counter)
+{
+    assert(counter < VCOUNT_MAX);
+    return counters[counter].load(std::memory_order_relaxed);
+}
+
+void ResetValidationStats()
+{
+    for (int i = 0; i < VSTAGE_MAX; i++)
+        histograms[i].Reset();
+    for (int i = 0; i < VCOUNT_MAX; i++)
+        counters[i].store(0, std::memory_order_relaxed);
+}
+
+std::string FormatValidationStatsText()
+{
+    static const double quantiles[] = { 0.5, 0.9, 0.99 };
+    std::string str;
+    str += "# HELP pop_validation_seconds Time spent in each block validation stage\n";
+    str += "# TYPE pop_validation_seconds summary\n";
+    for (int i = 0; i < VSTAGE_MAX; i++) {
+        const CLatencyHistogram& hist = histograms[i];
+        for (unsigned int q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+            str += strprintf("pop_validation_seconds{stage=\"%s\",quantile=\"%g\"} %.6f\n", pszStageNames[i], quantiles[q], hist.GetQuantile(quantiles[q]) * 0.000001);
+        str += strprintf("pop_validation_seconds_sum{stage=\"%s\"} %.6f\n", pszStageNames[i], hist.GetTotal() * 0.000001);
+        str += strprintf("pop_validation_seconds_count{stage=\"%s\"} %u\n", pszStageNames[i], hist.GetCount());
+    }
+    str += "# HELP pop_validation_items_total Items processed while connecting blocks\n";
+    str += "# TYPE pop_validation_items_total counter\n";
+    for (int i = 0; i < VCOUNT_MAX; i++)
+        str += strprintf("pop_validation_items_total{item=\"%s\"} %u\n", pszCounterNames[i], counters[i].load(std::memory_order_relaxed));
+    return str;
+}
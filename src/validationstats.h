@@ -0,0 +1,84 @@
+// Copyright (c) 2017-2018 The Popchain Core Developers
+
+/**
+ * Per-stage latency histograms and item counters for block validation.
+ *
+ * The "bench" debug category only logs running totals; these histograms keep
+ * the distribution so a regression in one stage shows up in its percentiles.
+ * Recording is lock free and cheap enough to leave on unconditionally.
+ */
+#ifndef BITCOIN_VALIDATIONSTATS_H
+#define BITCOIN_VALIDATIONSTATS_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+enum ValidationStage {
+    VSTAGE_READ_BLOCK,          //!< ConnectTip: load the block from disk
+    VSTAGE_PREFETCH,            //!< ConnectTip: reading the block's inputs into the coins cache
+    VSTAGE_POW_HASH,            //!< CheckBlockHeader: header hash and proof of work
+    VSTAGE_UNCLES,              //!< AcceptBlock: uncle header checks
+    VSTAGE_CLAIMTRIE_UPDATE,    //!< ConnectBlock: claim and support changes
+    VSTAGE_CLAIMTRIE_ROOT,      //!< ConnectTip: claim trie merkle root
+    VSTAGE_SCRIPT_VERIFY,       //!< ConnectBlock: CheckInputs plus waiting for script threads
+    VSTAGE_INDEX_WRITE,         //!< ConnectBlock: undo data, txindex and queueing index deltas
+    VSTAGE_FLUSH,               //!< ConnectTip: flushing the coins and claim trie caches
+    VSTAGE_CHAINSTATE,          //!< ConnectTip: FlushStateToDisk
+    VSTAGE_CALLBACKS,           //!< ConnectTip: mempool update, wallet sync and signals
+    VSTAGE_CONNECT_BLOCK,       //!< ConnectBlock as a whole
+    VSTAGE_CONNECT_TIP,         //!< ConnectTip as a whole
+    VSTAGE_MAX
+};
+
+enum ValidationCounter {
+    VCOUNT_BLOCKS,
+    VCOUNT_TRANSACTIONS,
+    VCOUNT_INPUTS,
+    VCOUNT_SIGOPS,
+    VCOUNT_CLAIMS,              //!< Claim, update and support outputs and spends
+    VCOUNT_UNCLES,
+    VCOUNT_MAX
+};
+
+/**
+ * Histogram of durations in power-of-two microsecond buckets: bucket 0 holds
+ * samples under 1us, bucket b samples in [2^(b-1), 2^b) us, the last bucket
+ * everything longer.
+ */
+class CLatencyHistogram
+{
+public:
+    static const int BUCKETS = 36;
+
+    CLatencyHistogram() { Reset(); }
+
+    void Add(int64_t nMicros);
+    void Reset();
+
+    uint64_t GetCount() const { return nCount.load(std::memory_order_relaxed); }
+    int64_t GetTotal() const { return nTotal.load(std::memory_order_relaxed); }
+    int64_t GetMax() const { return nMax.load(std::memory_order_relaxed); }
+    /** Estimated duration in microseconds below which a fraction dQuantile (0..1) of samples fall */
+    double GetQuantile(double dQuantile) const;
+
+private:
+    std::atomic<uint64_t> vBuckets[BUCKETS];
+    std::atomic<uint64_t> nCount;
+    std::atomic<int64_t> nTotal;
+    std::atomic<int64_t> nMax;
+};
+
+void RecordValidationTime(ValidationStage stage, int64_t nMicros);
+void AddValidationCount(ValidationCounter counter, uint64_t n = 1);
+
+const char* GetValidationStageName(ValidationStage stage);
+const char* GetValidationCounterName(ValidationCounter counter);
+const CLatencyHistogram& GetValidationHistogram(ValidationStage stage);
+uint64_t GetValidationCount(ValidationCounter counter);
+void ResetValidationStats();
+
+/** All histograms and counters in the Prometheus text exposition format */
+std::string FormatValidationStatsText();
+
+#endif // BITCOIN_VALIDATIONSTATS_H
@@ -23,3 +23,13 @@ bool CZMQAbstractNotifier::NotifyTransactionLock(const CTransaction &/*transacti
 {
     return true;
 }
+
+bool CZMQAbstractNotifier::NotifyClaimTrieChanged(const CClaimTrieDelta &/*delta*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyUncles(const CBlockIndex * /*CBlockIndex*/, const std::vector<CBlockHeader> &/*vuh*/)
+{
+    return true;
+}
@@ -5,7 +5,9 @@
 
 #include "zmqconfig.h"
 
+class CBlockHeader;
 class CBlockIndex;
+class CClaimTrieDelta;
 class CZMQAbstractNotifier;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
@@ -33,6 +35,8 @@ public:
     virtual bool NotifyBlock(const CBlockIndex *pindex);
     virtual bool NotifyTransaction(const CTransaction &transaction);
     virtual bool NotifyTransactionLock(const CTransaction &transaction);
+    virtual bool NotifyClaimTrieChanged(const CClaimTrieDelta &delta);
+    virtual bool NotifyUncles(const CBlockIndex *pindex, const std::vector<CBlockHeader> &vuh);
 
 protected:
     void *psocket;
@@ -25,6 +25,8 @@ protected:
     void SyncTransaction(const CTransaction &tx, const CBlock *pblock);
     void UpdatedBlockTip(const CBlockIndex *pindex);
     void NotifyTransactionLock(const CTransaction &tx);
+    void ClaimTrieChanged(const CClaimTrieDelta &delta);
+    void NotifyUncles(const CBlockIndex *pindex, const std::vector<CBlockHeader> &vuh);
 
 private:
     CZMQNotificationInterface();
@@ -1,6 +1,7 @@
 // Copyright (c) 2017-2018 The Popchain Core Developers
 
 #include "chainparams.h"
+#include "claimtrie.h"
 #include "zmqpublishnotifier.h"
 #include "main.h"
 #include "util.h"
@@ -13,6 +14,8 @@ static const char *MSG_HASHTXLOCK = "hashtxlock";
 static const char *MSG_RAWBLOCK   = "rawblock";
 static const char *MSG_RAWTX      = "rawtx";
 static const char *MSG_RAWTXLOCK = "rawtxlock";
+static const char *MSG_CLAIMTRIE = "claimtrie";
+static const char *MSG_RAWUNCLES = "rawuncles";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -208,3 +211,21 @@ bool CZMQPublishRawTransactionLockNotifier::NotifyTransactionLock(const CTransac
     ss << transaction;
     return SendMessage(MSG_RAWTXLOCK, &(*ss.begin()), ss.size());
 }
+
+bool CZMQPublishClaimTrieNotifier::NotifyClaimTrieChanged(const CClaimTrieDelta &delta)
+{
+    LogPrint("zmq", "zmq: Publish claimtrie %s (%s, %u names changed)\n", delta.hashBlock.GetHex(),
+             delta.fConnected ? "connected" : "disconnected", (unsigned int)delta.setChanged.size());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << delta;
+    return SendMessage(MSG_CLAIMTRIE, &(*ss.begin()), ss.size());
+}
+
+bool CZMQPublishRawUnclesNotifier::NotifyUncles(const CBlockIndex *pindex, const std::vector<CBlockHeader> &vuh)
+{
+    uint256 hash = pindex->GetBlockHash();
+    LogPrint("zmq", "zmq: Publish rawuncles %s (%u uncles)\n", hash.GetHex(), (unsigned int)vuh.size());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << hash << vuh;
+    return SendMessage(MSG_RAWUNCLES, &(*ss.begin()), ss.size());
+}
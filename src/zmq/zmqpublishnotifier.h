@@ -62,4 +62,16 @@ public:
     bool NotifyTransactionLock(const CTransaction &transaction);
 };
 
+class CZMQPublishClaimTrieNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyClaimTrieChanged(const CClaimTrieDelta &delta);
+};
+
+class CZMQPublishRawUnclesNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyUncles(const CBlockIndex *pindex, const std::vector<CBlockHeader> &vuh);
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H